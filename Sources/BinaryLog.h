@@ -0,0 +1,448 @@
+// # Binary log
+//
+// A logger for printf-style messages that keeps formatting and I/O away from the calling thread.
+//
+// Each thread appends compact records to its own lock-free ring buffer: the address of the format string, followed by
+// the arguments that the format consumes. A background thread drains the rings into a binary file, where each format
+// string is written once, the first time it is seen, and is then referred to by id.
+//
+// The file is rendered back to text by LogDecoder (Sources/LogDecoderMain.cpp), using printf itself for each
+// conversion so that the text is the same as if it had been printed directly.
+//
+// Format strings must outlive the program, since they are referred to by address until they are drained. (i.e. use
+// string literals) Records are in order for each thread, but the records of different threads may interleave
+// differently than they were logged.
+//
+// Call binary_log_flush to write out everything that has been logged so far, for instance when crashing. It is called
+// at exit.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace binary_log {
+
+// File layout:
+//
+// header:  kMagic (8 bytes), sizeof(wchar_t) (1 byte), 7 bytes of padding.
+// format:  'F', id (u32), length (u32), the format string without its terminating zero.
+// record:  'R', format id (u32), payload length (u32), payload.
+//
+// payload: the number of conversions that were encoded (u16), then for each conversion in the format, in order:
+//   - the width when given as `*` (i32),
+//   - the precision when given as `.*` (i32),
+//   - the value: integers as i64, floating point numbers as f64, pointers as u64, wide characters as u32,
+//     strings as their length in characters (u32, 0xffffffff for null pointers) followed by their characters.
+//
+// A record whose arguments did not fit has fewer encoded conversions than its format, and is rendered up to there.
+constexpr char kMagic[8] = { 'S', 'R', 'L', 'O', 'G', '0', '1', '\0' };
+constexpr uint32_t kNullString = 0xffffffff;
+
+enum class ArgKind : uint8_t {
+  kNone, // %% or %n
+  kSignedInt,
+  kUnsignedInt,
+  kDouble,
+  kPointer,
+  kString,
+  kWideString,
+  kWideChar,
+};
+
+struct Conversion {
+  char const* begin = nullptr; // at the '%'.
+  char const* end = nullptr; // one past the conversion specifier.
+  bool width_arg = false;
+  bool precision_arg = false;
+  int precision = -1; // when given literally.
+  int int_size = 4; // in bytes, for integers.
+  ArgKind kind = ArgKind::kNone;
+};
+
+// Parses the conversion starting at `p`, which points at a '%'.
+inline Conversion
+parse_conversion(char const* p) {
+  Conversion c;
+  c.begin = p++;
+  while (*p && std::strchr("-+ #0", *p)) p++;
+  if (*p == '*') { c.width_arg = true; p++; }
+  while (*p >= '0' && *p <= '9') p++;
+  if (*p == '.') {
+    p++;
+    if (*p == '*') { c.precision_arg = true; p++; }
+    else {
+      c.precision = 0;
+      while (*p >= '0' && *p <= '9') c.precision = 10 * c.precision + (*p++ - '0');
+    }
+  }
+
+  bool wide = false;
+  if (p[0] == 'h' && p[1] == 'h') { p += 2; }
+  else if (p[0] == 'l' && p[1] == 'l') { c.int_size = sizeof(long long); p += 2; }
+  else if (*p == 'h') { p++; }
+  else if (*p == 'l') { c.int_size = sizeof(long); wide = true; p++; }
+  else if (*p == 'z') { c.int_size = sizeof(size_t); p++; }
+  else if (*p == 'j') { c.int_size = sizeof(intmax_t); p++; }
+  else if (*p == 't') { c.int_size = sizeof(ptrdiff_t); p++; }
+
+  switch (*p) {
+  case 'd': case 'i': c.kind = ArgKind::kSignedInt; break;
+  case 'u': case 'o': case 'x': case 'X': c.kind = ArgKind::kUnsignedInt; break;
+  case 'c': c.kind = wide ? ArgKind::kWideChar : ArgKind::kSignedInt; c.int_size = sizeof(int); break;
+  case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': c.kind = ArgKind::kDouble; break;
+  case 'p': c.kind = ArgKind::kPointer; break;
+  case 's': c.kind = wide ? ArgKind::kWideString : ArgKind::kString; break;
+  default: c.kind = ArgKind::kNone; break; // %% and %n consume nothing worth recording.
+  }
+  c.end = *p ? p + 1 : p;
+  return c;
+}
+
+// Encodes the arguments of a record into `out`, returning the size used.
+inline size_t
+encode_args(unsigned char* out, size_t capacity, char const* fmt, va_list args) {
+  size_t size = sizeof(uint16_t);
+  uint16_t num_encoded = 0;
+  bool full = false;
+
+  const auto put = [&](void const* bytes, size_t n) {
+    if (full || size + n > capacity) { full = true; return; }
+    std::memcpy(out + size, bytes, n);
+    size += n;
+  };
+
+  for (auto p = fmt; *p && !full; p++) {
+    if (*p != '%') continue;
+    auto c = parse_conversion(p);
+    p = c.end - 1;
+    if (c.end[-1] == '%') continue;
+
+    int32_t width = 0, precision = c.precision;
+    if (c.width_arg) { width = va_arg(args, int); put(&width, sizeof width); }
+    if (c.precision_arg) { precision = va_arg(args, int); put(&precision, sizeof precision); }
+
+    switch (c.kind) {
+    case ArgKind::kNone: {
+      if (c.end[-1] == 'n') (void)va_arg(args, void*);
+    } break;
+    case ArgKind::kSignedInt: {
+      int64_t v = c.int_size == 8 ? int64_t(va_arg(args, long long)) : int64_t(va_arg(args, int));
+      put(&v, sizeof v);
+    } break;
+    case ArgKind::kUnsignedInt: {
+      int64_t v = c.int_size == 8 ? int64_t(va_arg(args, unsigned long long)) : int64_t(va_arg(args, unsigned int));
+      put(&v, sizeof v);
+    } break;
+    case ArgKind::kDouble: {
+      double v = va_arg(args, double);
+      put(&v, sizeof v);
+    } break;
+    case ArgKind::kPointer: {
+      uint64_t v = uint64_t(uintptr_t(va_arg(args, void*)));
+      put(&v, sizeof v);
+    } break;
+    case ArgKind::kWideChar: {
+      uint32_t v = uint32_t(va_arg(args, int)); // wint_t, promoted to int when it is narrower.
+      put(&v, sizeof v);
+    } break;
+    case ArgKind::kString: {
+      auto s = va_arg(args, char const*);
+      uint32_t len = !s ? kNullString : uint32_t(precision >= 0 ? strnlen(s, size_t(precision)) : std::strlen(s));
+      put(&len, sizeof len);
+      if (s) put(s, len);
+    } break;
+    case ArgKind::kWideString: {
+      auto s = va_arg(args, wchar_t const*);
+      uint32_t len = !s ? kNullString : uint32_t(precision >= 0 ? wcsnlen(s, size_t(precision)) : std::wcslen(s));
+      put(&len, sizeof len);
+      if (s) put(s, len * sizeof(wchar_t));
+    } break;
+    }
+    if (!full) num_encoded++;
+  }
+  std::memcpy(out, &num_encoded, sizeof num_encoded);
+  return size;
+}
+
+// Renders a record as printf would have printed it, appending to `out`.
+//
+// `wchar_size` is the size of wchar_t of the program that wrote the log, since the decoder may run elsewhere.
+inline void
+render_record(std::string& out, char const* fmt, unsigned char const* payload, size_t payload_size, size_t wchar_size) {
+  size_t pos = 0;
+  const auto get = [&](void* bytes, size_t n) {
+    if (pos + n > payload_size) { std::memset(bytes, 0, n); pos = payload_size; return; }
+    std::memcpy(bytes, payload + pos, n);
+    pos += n;
+  };
+
+  const auto append = [&out](char const* spec, auto... args) {
+    char buffer[256];
+    auto n = std::snprintf(buffer, sizeof buffer, spec, args...);
+    if (n < 0) return;
+    if (size_t(n) < sizeof buffer) { out.append(buffer, size_t(n)); return; }
+    std::string big(size_t(n) + 1, '\0');
+    std::snprintf(big.data(), big.size(), spec, args...);
+    out.append(big.data(), size_t(n));
+  };
+
+  uint16_t num_encoded = 0;
+  get(&num_encoded, sizeof num_encoded);
+
+  std::string spec;
+  std::wstring wide;
+  std::string narrow;
+  uint16_t num_rendered = 0;
+  for (auto p = fmt; *p; p++) {
+    if (*p != '%') { out.push_back(*p); continue; }
+    auto c = parse_conversion(p);
+    p = c.end - 1;
+    if (c.end[-1] == '%') { out.push_back('%'); continue; }
+    if (num_rendered == num_encoded) { out.append("... (truncated)\n"); return; }
+    num_rendered++;
+
+    int32_t width = 0, precision = 0;
+    if (c.width_arg) get(&width, sizeof width);
+    if (c.precision_arg) get(&precision, sizeof precision);
+
+    // The conversion without its length modifiers, which we pick ourselves depending on how the value is stored.
+    spec.assign(c.begin, c.end - 1);
+    while (!spec.empty() && std::strchr("hlzjtL", spec.back())) spec.pop_back();
+    auto specifier = c.end[-1];
+
+    const auto append_value = [&](char const* s, auto value) {
+      if (c.width_arg && c.precision_arg) append(s, width, precision, value);
+      else if (c.width_arg) append(s, width, value);
+      else if (c.precision_arg) append(s, precision, value);
+      else append(s, value);
+    };
+
+    switch (c.kind) {
+    case ArgKind::kNone: break;
+    case ArgKind::kSignedInt:
+    case ArgKind::kUnsignedInt: {
+      int64_t v;
+      get(&v, sizeof v);
+      if (specifier == 'c') { spec += 'c'; append_value(spec.c_str(), int(v)); }
+      else { spec += "ll"; spec += specifier; append_value(spec.c_str(), (long long)v); }
+    } break;
+    case ArgKind::kDouble: {
+      double v;
+      get(&v, sizeof v);
+      spec += specifier;
+      append_value(spec.c_str(), v);
+    } break;
+    case ArgKind::kPointer: {
+      uint64_t v;
+      get(&v, sizeof v);
+      spec += 'p';
+      append_value(spec.c_str(), (void*)uintptr_t(v));
+    } break;
+    case ArgKind::kWideChar: {
+      uint32_t v;
+      get(&v, sizeof v);
+      spec += "lc";
+      append_value(spec.c_str(), wint_t(v));
+    } break;
+    case ArgKind::kString: {
+      uint32_t len;
+      get(&len, sizeof len);
+      spec += 's';
+      if (len == kNullString) { append_value(spec.c_str(), (char const*)nullptr); break; }
+      narrow.resize(len);
+      get(narrow.data(), len);
+      append_value(spec.c_str(), narrow.c_str());
+    } break;
+    case ArgKind::kWideString: {
+      uint32_t len;
+      get(&len, sizeof len);
+      spec += "ls";
+      if (len == kNullString) { append_value(spec.c_str(), (wchar_t const*)nullptr); break; }
+      wide.resize(len);
+      for (uint32_t i = 0; i < len; i++) {
+        uint32_t unit = 0;
+        get(&unit, wchar_size); // little-endian, like the machines we run on.
+        wide[i] = wchar_t(unit);
+      }
+      append_value(spec.c_str(), wide.c_str());
+    } break;
+    }
+  }
+}
+
+// Single-producer single-consumer ring of records, owned by one thread and drained by the logger's thread.
+struct Ring {
+  static constexpr size_t kSize = size_t(1) << 20; // power of two.
+
+  std::unique_ptr<unsigned char[]> bytes = std::make_unique<unsigned char[]>(kSize);
+  std::atomic<uint64_t> head = 0; // written by the owning thread.
+  std::atomic<uint64_t> tail = 0; // written by the drainer.
+
+  void write(uint64_t at, void const* src, size_t n) {
+    auto offset = size_t(at & (kSize - 1));
+    auto first = std::min(n, kSize - offset);
+    std::memcpy(bytes.get() + offset, src, first);
+    std::memcpy(bytes.get(), static_cast<unsigned char const*>(src) + first, n - first);
+  }
+
+  void read(uint64_t at, void* dst, size_t n) const {
+    auto offset = size_t(at & (kSize - 1));
+    auto first = std::min(n, kSize - offset);
+    std::memcpy(dst, bytes.get() + offset, first);
+    std::memcpy(static_cast<unsigned char*>(dst) + first, bytes.get(), n - first);
+  }
+};
+
+// In the rings, a record is its size (u32, including this header), the address of its format string (u64) and its payload.
+struct RecordHeader {
+  uint32_t size;
+  uint32_t unused;
+  uint64_t fmt;
+};
+
+constexpr size_t kMaxRecordSize = 16 * 1024;
+
+struct Logger {
+  FILE* file = nullptr;
+
+  std::mutex rings_mutex; // held to register a ring, and while draining.
+  std::vector<Ring*> rings; // never freed, since threads may exit while their last records are still to be drained.
+
+  std::unordered_map<uint64_t, uint32_t> format_ids; // by address.
+  std::vector<unsigned char> drained;
+
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  std::atomic<bool> stopping = false;
+  std::thread drainer;
+
+  explicit Logger(char const* path) {
+    file = std::fopen(path, "wb");
+    if (file) {
+      unsigned char header[16] = {};
+      std::memcpy(header, kMagic, sizeof kMagic);
+      header[8] = uint8_t(sizeof(wchar_t));
+      std::fwrite(header, 1, sizeof header, file);
+    }
+    drainer = std::thread([this]() {
+      while (!stopping.load(std::memory_order_acquire)) {
+        if (!drain()) {
+          std::unique_lock lock(wake_mutex);
+          wake.wait_for(lock, std::chrono::milliseconds(10));
+        }
+      }
+    });
+  }
+
+  void stop() {
+    if (!drainer.joinable()) return;
+    stopping.store(true, std::memory_order_release);
+    wake.notify_one();
+    drainer.join();
+    drain();
+    if (file) std::fclose(file);
+    file = nullptr;
+  }
+
+  Ring* register_ring() {
+    auto ring = new Ring;
+    std::lock_guard lock(rings_mutex);
+    rings.push_back(ring);
+    return ring;
+  }
+
+  // Writes out all the records found in the rings. Returns whether there were any.
+  bool drain() {
+    std::lock_guard lock(rings_mutex);
+    bool any = false;
+    for (auto ring : rings) {
+      auto tail = ring->tail.load(std::memory_order_relaxed);
+      auto head = ring->head.load(std::memory_order_acquire);
+      while (tail < head) {
+        RecordHeader header;
+        ring->read(tail, &header, sizeof header);
+        drained.resize(header.size - sizeof header);
+        ring->read(tail + sizeof header, drained.data(), drained.size());
+        write_record(header.fmt, drained.data(), uint32_t(drained.size()));
+        tail += header.size;
+        any = true;
+      }
+      ring->tail.store(tail, std::memory_order_release);
+    }
+    if (any && file) std::fflush(file);
+    return any;
+  }
+
+  void write_record(uint64_t fmt, unsigned char const* payload, uint32_t payload_size) {
+    if (!file) return;
+    auto [pos, inserted] = format_ids.try_emplace(fmt, uint32_t(format_ids.size()));
+    uint32_t id = pos->second;
+    if (inserted) {
+      auto s = reinterpret_cast<char const*>(uintptr_t(fmt));
+      uint32_t len = uint32_t(std::strlen(s));
+      std::fputc('F', file);
+      std::fwrite(&id, sizeof id, 1, file);
+      std::fwrite(&len, sizeof len, 1, file);
+      std::fwrite(s, 1, len, file);
+    }
+    std::fputc('R', file);
+    std::fwrite(&id, sizeof id, 1, file);
+    std::fwrite(&payload_size, sizeof payload_size, 1, file);
+    std::fwrite(payload, 1, payload_size, file);
+  }
+
+  void push(char const* fmt, va_list args) {
+    thread_local Ring* ring = register_ring();
+
+    unsigned char record[kMaxRecordSize];
+    auto payload_size = encode_args(record + sizeof(RecordHeader), sizeof record - sizeof(RecordHeader), fmt, args);
+    RecordHeader header = { .size = uint32_t(sizeof header + payload_size), .unused = 0, .fmt = uint64_t(uintptr_t(fmt)) };
+    std::memcpy(record, &header, sizeof header);
+
+    auto head = ring->head.load(std::memory_order_relaxed);
+    while (Ring::kSize - (head - ring->tail.load(std::memory_order_acquire)) < header.size) {
+      if (stopping.load(std::memory_order_acquire)) return; // nobody left to drain, e.g. logging from static destructors.
+      wake.notify_one(); // full: wait for the drainer to catch up.
+      std::this_thread::yield();
+    }
+    ring->write(head, record, header.size);
+    ring->head.store(head + header.size, std::memory_order_release);
+  }
+};
+
+inline Logger&
+logger() {
+  static Logger* instance = []() {
+    auto l = new Logger("log.bin");
+    std::atexit([]() { logger().stop(); });
+    return l;
+  }();
+  return *instance;
+}
+
+} // namespace binary_log
+
+inline void
+binary_log_v(char const* fmt, va_list args) {
+  binary_log::logger().push(fmt, args);
+}
+
+inline void
+binary_log_flush() {
+  binary_log::logger().drain();
+}
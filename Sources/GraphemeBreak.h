@@ -0,0 +1,495 @@
+// # Grapheme clusters
+//
+// Where the user-perceived characters of a text start, after the extended grapheme cluster rules of UAX #29. Offsets
+// stay in code units (UTF-16, or UTF-32 where wchar_t is 4 bytes), a character being one or more of them: a surrogate
+// pair, a letter followed by its combining marks, a Hangul syllable made of jamos, a flag, or an emoji sequence joined
+// by zero width joiners.
+//
+// The grapheme break property of each code point comes from kGraphemeBreakRanges, derived from Unicode 14.0: the
+// general categories Mn, Me (Extend), Mc (SpacingMark), Cc, Cf, Zl, Zp (Control), plus the code points that
+// GraphemeBreakProperty.txt and emoji-data.txt (Extended_Pictographic) list beyond them. Hangul syllables are computed.
+// It is looked up in a two-stage table of about 30 KB, filled from the ranges on first use. The rule GB9c of Unicode
+// 15.1, for Indic conjuncts, isn't implemented.
+//
+// Between two code units of printable ASCII or Latin letters (U+0020..U+007E, U+00A0..U+02FF but the soft hyphen),
+// there is always a boundary, whatever comes before or after. Runs of them are found 16 code units at a time with SSE2,
+// and moved across without looking up any property.
+
+#pragma once
+
+#include "TextBoundaryScanner.h" // for TEXT_SCANNER_SSE2
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+enum class GraphemeBreak : uint8_t {
+  kOther,
+  kCR,
+  kLF,
+  kControl,
+  kExtend,
+  kZwj,
+  kRegionalIndicator,
+  kPrepend,
+  kSpacingMark,
+  kL,
+  kV,
+  kT,
+  kLV,
+  kLVT,
+  kExtendedPictographic,
+};
+
+struct GraphemeBreakRange {
+  char32_t first;
+  char32_t last;
+  GraphemeBreak value;
+};
+
+// Sorted, the code points that are missing are kOther.
+inline constexpr GraphemeBreakRange kGraphemeBreakRanges[] = {
+#define G GraphemeBreak
+  { 0x0000, 0x0009, G::kControl }, { 0x000a, 0x000a, G::kLF }, { 0x000b, 0x000c, G::kControl },
+  { 0x000d, 0x000d, G::kCR }, { 0x000e, 0x001f, G::kControl }, { 0x007f, 0x009f, G::kControl },
+  { 0x00a9, 0x00a9, G::kExtendedPictographic }, { 0x00ad, 0x00ad, G::kControl },
+  { 0x00ae, 0x00ae, G::kExtendedPictographic }, { 0x0300, 0x036f, G::kExtend }, { 0x0483, 0x0489, G::kExtend },
+  { 0x0591, 0x05bd, G::kExtend }, { 0x05bf, 0x05bf, G::kExtend }, { 0x05c1, 0x05c2, G::kExtend },
+  { 0x05c4, 0x05c5, G::kExtend }, { 0x05c7, 0x05c7, G::kExtend }, { 0x0600, 0x0605, G::kPrepend },
+  { 0x0610, 0x061a, G::kExtend }, { 0x061c, 0x061c, G::kControl }, { 0x064b, 0x065f, G::kExtend },
+  { 0x0670, 0x0670, G::kExtend }, { 0x06d6, 0x06dc, G::kExtend }, { 0x06dd, 0x06dd, G::kPrepend },
+  { 0x06df, 0x06e4, G::kExtend }, { 0x06e7, 0x06e8, G::kExtend }, { 0x06ea, 0x06ed, G::kExtend },
+  { 0x070f, 0x070f, G::kPrepend }, { 0x0711, 0x0711, G::kExtend }, { 0x0730, 0x074a, G::kExtend },
+  { 0x07a6, 0x07b0, G::kExtend }, { 0x07eb, 0x07f3, G::kExtend }, { 0x07fd, 0x07fd, G::kExtend },
+  { 0x0816, 0x0819, G::kExtend }, { 0x081b, 0x0823, G::kExtend }, { 0x0825, 0x0827, G::kExtend },
+  { 0x0829, 0x082d, G::kExtend }, { 0x0859, 0x085b, G::kExtend }, { 0x0890, 0x0891, G::kPrepend },
+  { 0x0898, 0x089f, G::kExtend }, { 0x08ca, 0x08e1, G::kExtend }, { 0x08e2, 0x08e2, G::kPrepend },
+  { 0x08e3, 0x0902, G::kExtend }, { 0x0903, 0x0903, G::kSpacingMark }, { 0x093a, 0x093a, G::kExtend },
+  { 0x093b, 0x093b, G::kSpacingMark }, { 0x093c, 0x093c, G::kExtend }, { 0x093e, 0x0940, G::kSpacingMark },
+  { 0x0941, 0x0948, G::kExtend }, { 0x0949, 0x094c, G::kSpacingMark }, { 0x094d, 0x094d, G::kExtend },
+  { 0x094e, 0x094f, G::kSpacingMark }, { 0x0951, 0x0957, G::kExtend }, { 0x0962, 0x0963, G::kExtend },
+  { 0x0981, 0x0981, G::kExtend }, { 0x0982, 0x0983, G::kSpacingMark }, { 0x09bc, 0x09bc, G::kExtend },
+  { 0x09be, 0x09be, G::kExtend }, { 0x09bf, 0x09c0, G::kSpacingMark }, { 0x09c1, 0x09c4, G::kExtend },
+  { 0x09c7, 0x09c8, G::kSpacingMark }, { 0x09cb, 0x09cc, G::kSpacingMark }, { 0x09cd, 0x09cd, G::kExtend },
+  { 0x09d7, 0x09d7, G::kExtend }, { 0x09e2, 0x09e3, G::kExtend }, { 0x09fe, 0x09fe, G::kExtend },
+  { 0x0a01, 0x0a02, G::kExtend }, { 0x0a03, 0x0a03, G::kSpacingMark }, { 0x0a3c, 0x0a3c, G::kExtend },
+  { 0x0a3e, 0x0a40, G::kSpacingMark }, { 0x0a41, 0x0a42, G::kExtend }, { 0x0a47, 0x0a48, G::kExtend },
+  { 0x0a4b, 0x0a4d, G::kExtend }, { 0x0a51, 0x0a51, G::kExtend }, { 0x0a70, 0x0a71, G::kExtend },
+  { 0x0a75, 0x0a75, G::kExtend }, { 0x0a81, 0x0a82, G::kExtend }, { 0x0a83, 0x0a83, G::kSpacingMark },
+  { 0x0abc, 0x0abc, G::kExtend }, { 0x0abe, 0x0ac0, G::kSpacingMark }, { 0x0ac1, 0x0ac5, G::kExtend },
+  { 0x0ac7, 0x0ac8, G::kExtend }, { 0x0ac9, 0x0ac9, G::kSpacingMark }, { 0x0acb, 0x0acc, G::kSpacingMark },
+  { 0x0acd, 0x0acd, G::kExtend }, { 0x0ae2, 0x0ae3, G::kExtend }, { 0x0afa, 0x0aff, G::kExtend },
+  { 0x0b01, 0x0b01, G::kExtend }, { 0x0b02, 0x0b03, G::kSpacingMark }, { 0x0b3c, 0x0b3c, G::kExtend },
+  { 0x0b3e, 0x0b3f, G::kExtend }, { 0x0b40, 0x0b40, G::kSpacingMark }, { 0x0b41, 0x0b44, G::kExtend },
+  { 0x0b47, 0x0b48, G::kSpacingMark }, { 0x0b4b, 0x0b4c, G::kSpacingMark }, { 0x0b4d, 0x0b4d, G::kExtend },
+  { 0x0b55, 0x0b57, G::kExtend }, { 0x0b62, 0x0b63, G::kExtend }, { 0x0b82, 0x0b82, G::kExtend },
+  { 0x0bbe, 0x0bbe, G::kExtend }, { 0x0bbf, 0x0bbf, G::kSpacingMark }, { 0x0bc0, 0x0bc0, G::kExtend },
+  { 0x0bc1, 0x0bc2, G::kSpacingMark }, { 0x0bc6, 0x0bc8, G::kSpacingMark }, { 0x0bca, 0x0bcc, G::kSpacingMark },
+  { 0x0bcd, 0x0bcd, G::kExtend }, { 0x0bd7, 0x0bd7, G::kExtend }, { 0x0c00, 0x0c00, G::kExtend },
+  { 0x0c01, 0x0c03, G::kSpacingMark }, { 0x0c04, 0x0c04, G::kExtend }, { 0x0c3c, 0x0c3c, G::kExtend },
+  { 0x0c3e, 0x0c40, G::kExtend }, { 0x0c41, 0x0c44, G::kSpacingMark }, { 0x0c46, 0x0c48, G::kExtend },
+  { 0x0c4a, 0x0c4d, G::kExtend }, { 0x0c55, 0x0c56, G::kExtend }, { 0x0c62, 0x0c63, G::kExtend },
+  { 0x0c81, 0x0c81, G::kExtend }, { 0x0c82, 0x0c83, G::kSpacingMark }, { 0x0cbc, 0x0cbc, G::kExtend },
+  { 0x0cbe, 0x0cbe, G::kSpacingMark }, { 0x0cbf, 0x0cbf, G::kExtend }, { 0x0cc0, 0x0cc1, G::kSpacingMark },
+  { 0x0cc2, 0x0cc2, G::kExtend }, { 0x0cc3, 0x0cc4, G::kSpacingMark }, { 0x0cc6, 0x0cc6, G::kExtend },
+  { 0x0cc7, 0x0cc8, G::kSpacingMark }, { 0x0cca, 0x0ccb, G::kSpacingMark }, { 0x0ccc, 0x0ccd, G::kExtend },
+  { 0x0cd5, 0x0cd6, G::kExtend }, { 0x0ce2, 0x0ce3, G::kExtend }, { 0x0d00, 0x0d01, G::kExtend },
+  { 0x0d02, 0x0d03, G::kSpacingMark }, { 0x0d3b, 0x0d3c, G::kExtend }, { 0x0d3e, 0x0d3e, G::kExtend },
+  { 0x0d3f, 0x0d40, G::kSpacingMark }, { 0x0d41, 0x0d44, G::kExtend }, { 0x0d46, 0x0d48, G::kSpacingMark },
+  { 0x0d4a, 0x0d4c, G::kSpacingMark }, { 0x0d4d, 0x0d4d, G::kExtend }, { 0x0d4e, 0x0d4e, G::kPrepend },
+  { 0x0d57, 0x0d57, G::kExtend }, { 0x0d62, 0x0d63, G::kExtend }, { 0x0d81, 0x0d81, G::kExtend },
+  { 0x0d82, 0x0d83, G::kSpacingMark }, { 0x0dca, 0x0dca, G::kExtend }, { 0x0dcf, 0x0dcf, G::kExtend },
+  { 0x0dd0, 0x0dd1, G::kSpacingMark }, { 0x0dd2, 0x0dd4, G::kExtend }, { 0x0dd6, 0x0dd6, G::kExtend },
+  { 0x0dd8, 0x0dde, G::kSpacingMark }, { 0x0ddf, 0x0ddf, G::kExtend }, { 0x0df2, 0x0df3, G::kSpacingMark },
+  { 0x0e31, 0x0e31, G::kExtend }, { 0x0e33, 0x0e33, G::kSpacingMark }, { 0x0e34, 0x0e3a, G::kExtend },
+  { 0x0e47, 0x0e4e, G::kExtend }, { 0x0eb1, 0x0eb1, G::kExtend }, { 0x0eb3, 0x0eb3, G::kSpacingMark },
+  { 0x0eb4, 0x0ebc, G::kExtend }, { 0x0ec8, 0x0ecd, G::kExtend }, { 0x0f18, 0x0f19, G::kExtend },
+  { 0x0f35, 0x0f35, G::kExtend }, { 0x0f37, 0x0f37, G::kExtend }, { 0x0f39, 0x0f39, G::kExtend },
+  { 0x0f3e, 0x0f3f, G::kSpacingMark }, { 0x0f71, 0x0f7e, G::kExtend }, { 0x0f7f, 0x0f7f, G::kSpacingMark },
+  { 0x0f80, 0x0f84, G::kExtend }, { 0x0f86, 0x0f87, G::kExtend }, { 0x0f8d, 0x0f97, G::kExtend },
+  { 0x0f99, 0x0fbc, G::kExtend }, { 0x0fc6, 0x0fc6, G::kExtend }, { 0x102d, 0x1030, G::kExtend },
+  { 0x1031, 0x1031, G::kSpacingMark }, { 0x1032, 0x1037, G::kExtend }, { 0x1039, 0x103a, G::kExtend },
+  { 0x103b, 0x103c, G::kSpacingMark }, { 0x103d, 0x103e, G::kExtend }, { 0x1056, 0x1057, G::kSpacingMark },
+  { 0x1058, 0x1059, G::kExtend }, { 0x105e, 0x1060, G::kExtend }, { 0x1071, 0x1074, G::kExtend },
+  { 0x1082, 0x1082, G::kExtend }, { 0x1084, 0x1084, G::kSpacingMark }, { 0x1085, 0x1086, G::kExtend },
+  { 0x108d, 0x108d, G::kExtend }, { 0x109d, 0x109d, G::kExtend }, { 0x1100, 0x115f, G::kL }, { 0x1160, 0x11a7, G::kV },
+  { 0x11a8, 0x11ff, G::kT }, { 0x135d, 0x135f, G::kExtend }, { 0x1712, 0x1714, G::kExtend },
+  { 0x1715, 0x1715, G::kSpacingMark }, { 0x1732, 0x1733, G::kExtend }, { 0x1734, 0x1734, G::kSpacingMark },
+  { 0x1752, 0x1753, G::kExtend }, { 0x1772, 0x1773, G::kExtend }, { 0x17b4, 0x17b5, G::kExtend },
+  { 0x17b6, 0x17b6, G::kSpacingMark }, { 0x17b7, 0x17bd, G::kExtend }, { 0x17be, 0x17c5, G::kSpacingMark },
+  { 0x17c6, 0x17c6, G::kExtend }, { 0x17c7, 0x17c8, G::kSpacingMark }, { 0x17c9, 0x17d3, G::kExtend },
+  { 0x17dd, 0x17dd, G::kExtend }, { 0x180b, 0x180d, G::kExtend }, { 0x180e, 0x180e, G::kControl },
+  { 0x180f, 0x180f, G::kExtend }, { 0x1885, 0x1886, G::kExtend }, { 0x18a9, 0x18a9, G::kExtend },
+  { 0x1920, 0x1922, G::kExtend }, { 0x1923, 0x1926, G::kSpacingMark }, { 0x1927, 0x1928, G::kExtend },
+  { 0x1929, 0x192b, G::kSpacingMark }, { 0x1930, 0x1931, G::kSpacingMark }, { 0x1932, 0x1932, G::kExtend },
+  { 0x1933, 0x1938, G::kSpacingMark }, { 0x1939, 0x193b, G::kExtend }, { 0x1a17, 0x1a18, G::kExtend },
+  { 0x1a19, 0x1a1a, G::kSpacingMark }, { 0x1a1b, 0x1a1b, G::kExtend }, { 0x1a55, 0x1a55, G::kSpacingMark },
+  { 0x1a56, 0x1a56, G::kExtend }, { 0x1a57, 0x1a57, G::kSpacingMark }, { 0x1a58, 0x1a5e, G::kExtend },
+  { 0x1a60, 0x1a60, G::kExtend }, { 0x1a62, 0x1a62, G::kExtend }, { 0x1a65, 0x1a6c, G::kExtend },
+  { 0x1a6d, 0x1a72, G::kSpacingMark }, { 0x1a73, 0x1a7c, G::kExtend }, { 0x1a7f, 0x1a7f, G::kExtend },
+  { 0x1ab0, 0x1ace, G::kExtend }, { 0x1b00, 0x1b03, G::kExtend }, { 0x1b04, 0x1b04, G::kSpacingMark },
+  { 0x1b34, 0x1b3a, G::kExtend }, { 0x1b3b, 0x1b3b, G::kSpacingMark }, { 0x1b3c, 0x1b3c, G::kExtend },
+  { 0x1b3d, 0x1b41, G::kSpacingMark }, { 0x1b42, 0x1b42, G::kExtend }, { 0x1b43, 0x1b44, G::kSpacingMark },
+  { 0x1b6b, 0x1b73, G::kExtend }, { 0x1b80, 0x1b81, G::kExtend }, { 0x1b82, 0x1b82, G::kSpacingMark },
+  { 0x1ba1, 0x1ba1, G::kSpacingMark }, { 0x1ba2, 0x1ba5, G::kExtend }, { 0x1ba6, 0x1ba7, G::kSpacingMark },
+  { 0x1ba8, 0x1ba9, G::kExtend }, { 0x1baa, 0x1baa, G::kSpacingMark }, { 0x1bab, 0x1bad, G::kExtend },
+  { 0x1be6, 0x1be6, G::kExtend }, { 0x1be7, 0x1be7, G::kSpacingMark }, { 0x1be8, 0x1be9, G::kExtend },
+  { 0x1bea, 0x1bec, G::kSpacingMark }, { 0x1bed, 0x1bed, G::kExtend }, { 0x1bee, 0x1bee, G::kSpacingMark },
+  { 0x1bef, 0x1bf1, G::kExtend }, { 0x1bf2, 0x1bf3, G::kSpacingMark }, { 0x1c24, 0x1c2b, G::kSpacingMark },
+  { 0x1c2c, 0x1c33, G::kExtend }, { 0x1c34, 0x1c35, G::kSpacingMark }, { 0x1c36, 0x1c37, G::kExtend },
+  { 0x1cd0, 0x1cd2, G::kExtend }, { 0x1cd4, 0x1ce0, G::kExtend }, { 0x1ce1, 0x1ce1, G::kSpacingMark },
+  { 0x1ce2, 0x1ce8, G::kExtend }, { 0x1ced, 0x1ced, G::kExtend }, { 0x1cf4, 0x1cf4, G::kExtend },
+  { 0x1cf7, 0x1cf7, G::kSpacingMark }, { 0x1cf8, 0x1cf9, G::kExtend }, { 0x1dc0, 0x1dff, G::kExtend },
+  { 0x200b, 0x200b, G::kControl }, { 0x200c, 0x200c, G::kExtend }, { 0x200d, 0x200d, G::kZwj },
+  { 0x200e, 0x200f, G::kControl }, { 0x2028, 0x202e, G::kControl }, { 0x203c, 0x203c, G::kExtendedPictographic },
+  { 0x2049, 0x2049, G::kExtendedPictographic }, { 0x2060, 0x206f, G::kControl }, { 0x20d0, 0x20f0, G::kExtend },
+  { 0x2122, 0x2122, G::kExtendedPictographic }, { 0x2139, 0x2139, G::kExtendedPictographic },
+  { 0x2194, 0x2199, G::kExtendedPictographic }, { 0x21a9, 0x21aa, G::kExtendedPictographic },
+  { 0x231a, 0x231b, G::kExtendedPictographic }, { 0x2328, 0x2328, G::kExtendedPictographic },
+  { 0x2388, 0x2388, G::kExtendedPictographic }, { 0x23cf, 0x23cf, G::kExtendedPictographic },
+  { 0x23e9, 0x23f3, G::kExtendedPictographic }, { 0x23f8, 0x23fa, G::kExtendedPictographic },
+  { 0x24c2, 0x24c2, G::kExtendedPictographic }, { 0x25aa, 0x25ab, G::kExtendedPictographic },
+  { 0x25b6, 0x25b6, G::kExtendedPictographic }, { 0x25c0, 0x25c0, G::kExtendedPictographic },
+  { 0x25fb, 0x25fe, G::kExtendedPictographic }, { 0x2600, 0x2605, G::kExtendedPictographic },
+  { 0x2607, 0x2612, G::kExtendedPictographic }, { 0x2614, 0x2685, G::kExtendedPictographic },
+  { 0x2690, 0x2705, G::kExtendedPictographic }, { 0x2708, 0x2712, G::kExtendedPictographic },
+  { 0x2714, 0x2714, G::kExtendedPictographic }, { 0x2716, 0x2716, G::kExtendedPictographic },
+  { 0x271d, 0x271d, G::kExtendedPictographic }, { 0x2721, 0x2721, G::kExtendedPictographic },
+  { 0x2728, 0x2728, G::kExtendedPictographic }, { 0x2733, 0x2734, G::kExtendedPictographic },
+  { 0x2744, 0x2744, G::kExtendedPictographic }, { 0x2747, 0x2747, G::kExtendedPictographic },
+  { 0x274c, 0x274c, G::kExtendedPictographic }, { 0x274e, 0x274e, G::kExtendedPictographic },
+  { 0x2753, 0x2755, G::kExtendedPictographic }, { 0x2757, 0x2757, G::kExtendedPictographic },
+  { 0x2763, 0x2767, G::kExtendedPictographic }, { 0x2795, 0x2797, G::kExtendedPictographic },
+  { 0x27a1, 0x27a1, G::kExtendedPictographic }, { 0x27b0, 0x27b0, G::kExtendedPictographic },
+  { 0x27bf, 0x27bf, G::kExtendedPictographic }, { 0x2934, 0x2935, G::kExtendedPictographic },
+  { 0x2b05, 0x2b07, G::kExtendedPictographic }, { 0x2b1b, 0x2b1c, G::kExtendedPictographic },
+  { 0x2b50, 0x2b50, G::kExtendedPictographic }, { 0x2b55, 0x2b55, G::kExtendedPictographic },
+  { 0x2cef, 0x2cf1, G::kExtend }, { 0x2d7f, 0x2d7f, G::kExtend }, { 0x2de0, 0x2dff, G::kExtend },
+  { 0x302a, 0x302f, G::kExtend }, { 0x3030, 0x3030, G::kExtendedPictographic },
+  { 0x303d, 0x303d, G::kExtendedPictographic }, { 0x3099, 0x309a, G::kExtend },
+  { 0x3297, 0x3297, G::kExtendedPictographic }, { 0x3299, 0x3299, G::kExtendedPictographic },
+  { 0xa66f, 0xa672, G::kExtend }, { 0xa674, 0xa67d, G::kExtend }, { 0xa69e, 0xa69f, G::kExtend },
+  { 0xa6f0, 0xa6f1, G::kExtend }, { 0xa802, 0xa802, G::kExtend }, { 0xa806, 0xa806, G::kExtend },
+  { 0xa80b, 0xa80b, G::kExtend }, { 0xa823, 0xa824, G::kSpacingMark }, { 0xa825, 0xa826, G::kExtend },
+  { 0xa827, 0xa827, G::kSpacingMark }, { 0xa82c, 0xa82c, G::kExtend }, { 0xa880, 0xa881, G::kSpacingMark },
+  { 0xa8b4, 0xa8c3, G::kSpacingMark }, { 0xa8c4, 0xa8c5, G::kExtend }, { 0xa8e0, 0xa8f1, G::kExtend },
+  { 0xa8ff, 0xa8ff, G::kExtend }, { 0xa926, 0xa92d, G::kExtend }, { 0xa947, 0xa951, G::kExtend },
+  { 0xa952, 0xa953, G::kSpacingMark }, { 0xa960, 0xa97c, G::kL }, { 0xa980, 0xa982, G::kExtend },
+  { 0xa983, 0xa983, G::kSpacingMark }, { 0xa9b3, 0xa9b3, G::kExtend }, { 0xa9b4, 0xa9b5, G::kSpacingMark },
+  { 0xa9b6, 0xa9b9, G::kExtend }, { 0xa9ba, 0xa9bb, G::kSpacingMark }, { 0xa9bc, 0xa9bd, G::kExtend },
+  { 0xa9be, 0xa9c0, G::kSpacingMark }, { 0xa9e5, 0xa9e5, G::kExtend }, { 0xaa29, 0xaa2e, G::kExtend },
+  { 0xaa2f, 0xaa30, G::kSpacingMark }, { 0xaa31, 0xaa32, G::kExtend }, { 0xaa33, 0xaa34, G::kSpacingMark },
+  { 0xaa35, 0xaa36, G::kExtend }, { 0xaa43, 0xaa43, G::kExtend }, { 0xaa4c, 0xaa4c, G::kExtend },
+  { 0xaa4d, 0xaa4d, G::kSpacingMark }, { 0xaa7c, 0xaa7c, G::kExtend }, { 0xaab0, 0xaab0, G::kExtend },
+  { 0xaab2, 0xaab4, G::kExtend }, { 0xaab7, 0xaab8, G::kExtend }, { 0xaabe, 0xaabf, G::kExtend },
+  { 0xaac1, 0xaac1, G::kExtend }, { 0xaaeb, 0xaaeb, G::kSpacingMark }, { 0xaaec, 0xaaed, G::kExtend },
+  { 0xaaee, 0xaaef, G::kSpacingMark }, { 0xaaf5, 0xaaf5, G::kSpacingMark }, { 0xaaf6, 0xaaf6, G::kExtend },
+  { 0xabe3, 0xabe4, G::kSpacingMark }, { 0xabe5, 0xabe5, G::kExtend }, { 0xabe6, 0xabe7, G::kSpacingMark },
+  { 0xabe8, 0xabe8, G::kExtend }, { 0xabe9, 0xabea, G::kSpacingMark }, { 0xabec, 0xabec, G::kSpacingMark },
+  { 0xabed, 0xabed, G::kExtend }, { 0xd7b0, 0xd7c6, G::kV }, { 0xd7cb, 0xd7fb, G::kT },
+  { 0xd800, 0xdfff, G::kControl }, { 0xfb1e, 0xfb1e, G::kExtend }, { 0xfe00, 0xfe0f, G::kExtend },
+  { 0xfe20, 0xfe2f, G::kExtend }, { 0xfeff, 0xfeff, G::kControl }, { 0xff9e, 0xff9f, G::kExtend },
+  { 0xfff0, 0xfffb, G::kControl }, { 0x101fd, 0x101fd, G::kExtend }, { 0x102e0, 0x102e0, G::kExtend },
+  { 0x10376, 0x1037a, G::kExtend }, { 0x10a01, 0x10a03, G::kExtend }, { 0x10a05, 0x10a06, G::kExtend },
+  { 0x10a0c, 0x10a0f, G::kExtend }, { 0x10a38, 0x10a3a, G::kExtend }, { 0x10a3f, 0x10a3f, G::kExtend },
+  { 0x10ae5, 0x10ae6, G::kExtend }, { 0x10d24, 0x10d27, G::kExtend }, { 0x10eab, 0x10eac, G::kExtend },
+  { 0x10f46, 0x10f50, G::kExtend }, { 0x10f82, 0x10f85, G::kExtend }, { 0x11000, 0x11000, G::kSpacingMark },
+  { 0x11001, 0x11001, G::kExtend }, { 0x11002, 0x11002, G::kSpacingMark }, { 0x11038, 0x11046, G::kExtend },
+  { 0x11070, 0x11070, G::kExtend }, { 0x11073, 0x11074, G::kExtend }, { 0x1107f, 0x11081, G::kExtend },
+  { 0x11082, 0x11082, G::kSpacingMark }, { 0x110b0, 0x110b2, G::kSpacingMark }, { 0x110b3, 0x110b6, G::kExtend },
+  { 0x110b7, 0x110b8, G::kSpacingMark }, { 0x110b9, 0x110ba, G::kExtend }, { 0x110bd, 0x110bd, G::kPrepend },
+  { 0x110c2, 0x110c2, G::kExtend }, { 0x110cd, 0x110cd, G::kPrepend }, { 0x11100, 0x11102, G::kExtend },
+  { 0x11127, 0x1112b, G::kExtend }, { 0x1112c, 0x1112c, G::kSpacingMark }, { 0x1112d, 0x11134, G::kExtend },
+  { 0x11145, 0x11146, G::kSpacingMark }, { 0x11173, 0x11173, G::kExtend }, { 0x11180, 0x11181, G::kExtend },
+  { 0x11182, 0x11182, G::kSpacingMark }, { 0x111b3, 0x111b5, G::kSpacingMark }, { 0x111b6, 0x111be, G::kExtend },
+  { 0x111bf, 0x111c0, G::kSpacingMark }, { 0x111c2, 0x111c3, G::kPrepend }, { 0x111c9, 0x111cc, G::kExtend },
+  { 0x111ce, 0x111ce, G::kSpacingMark }, { 0x111cf, 0x111cf, G::kExtend }, { 0x1122c, 0x1122e, G::kSpacingMark },
+  { 0x1122f, 0x11231, G::kExtend }, { 0x11232, 0x11233, G::kSpacingMark }, { 0x11234, 0x11234, G::kExtend },
+  { 0x11235, 0x11235, G::kSpacingMark }, { 0x11236, 0x11237, G::kExtend }, { 0x1123e, 0x1123e, G::kExtend },
+  { 0x112df, 0x112df, G::kExtend }, { 0x112e0, 0x112e2, G::kSpacingMark }, { 0x112e3, 0x112ea, G::kExtend },
+  { 0x11300, 0x11301, G::kExtend }, { 0x11302, 0x11303, G::kSpacingMark }, { 0x1133b, 0x1133c, G::kExtend },
+  { 0x1133e, 0x1133e, G::kExtend }, { 0x1133f, 0x1133f, G::kSpacingMark }, { 0x11340, 0x11340, G::kExtend },
+  { 0x11341, 0x11344, G::kSpacingMark }, { 0x11347, 0x11348, G::kSpacingMark }, { 0x1134b, 0x1134d, G::kSpacingMark },
+  { 0x11357, 0x11357, G::kExtend }, { 0x11362, 0x11363, G::kSpacingMark }, { 0x11366, 0x1136c, G::kExtend },
+  { 0x11370, 0x11374, G::kExtend }, { 0x11435, 0x11437, G::kSpacingMark }, { 0x11438, 0x1143f, G::kExtend },
+  { 0x11440, 0x11441, G::kSpacingMark }, { 0x11442, 0x11444, G::kExtend }, { 0x11445, 0x11445, G::kSpacingMark },
+  { 0x11446, 0x11446, G::kExtend }, { 0x1145e, 0x1145e, G::kExtend }, { 0x114b0, 0x114b0, G::kExtend },
+  { 0x114b1, 0x114b2, G::kSpacingMark }, { 0x114b3, 0x114b8, G::kExtend }, { 0x114b9, 0x114b9, G::kSpacingMark },
+  { 0x114ba, 0x114ba, G::kExtend }, { 0x114bb, 0x114bc, G::kSpacingMark }, { 0x114bd, 0x114bd, G::kExtend },
+  { 0x114be, 0x114be, G::kSpacingMark }, { 0x114bf, 0x114c0, G::kExtend }, { 0x114c1, 0x114c1, G::kSpacingMark },
+  { 0x114c2, 0x114c3, G::kExtend }, { 0x115af, 0x115af, G::kExtend }, { 0x115b0, 0x115b1, G::kSpacingMark },
+  { 0x115b2, 0x115b5, G::kExtend }, { 0x115b8, 0x115bb, G::kSpacingMark }, { 0x115bc, 0x115bd, G::kExtend },
+  { 0x115be, 0x115be, G::kSpacingMark }, { 0x115bf, 0x115c0, G::kExtend }, { 0x115dc, 0x115dd, G::kExtend },
+  { 0x11630, 0x11632, G::kSpacingMark }, { 0x11633, 0x1163a, G::kExtend }, { 0x1163b, 0x1163c, G::kSpacingMark },
+  { 0x1163d, 0x1163d, G::kExtend }, { 0x1163e, 0x1163e, G::kSpacingMark }, { 0x1163f, 0x11640, G::kExtend },
+  { 0x116ab, 0x116ab, G::kExtend }, { 0x116ac, 0x116ac, G::kSpacingMark }, { 0x116ad, 0x116ad, G::kExtend },
+  { 0x116ae, 0x116af, G::kSpacingMark }, { 0x116b0, 0x116b5, G::kExtend }, { 0x116b6, 0x116b6, G::kSpacingMark },
+  { 0x116b7, 0x116b7, G::kExtend }, { 0x1171d, 0x1171f, G::kExtend }, { 0x11722, 0x11725, G::kExtend },
+  { 0x11726, 0x11726, G::kSpacingMark }, { 0x11727, 0x1172b, G::kExtend }, { 0x1182c, 0x1182e, G::kSpacingMark },
+  { 0x1182f, 0x11837, G::kExtend }, { 0x11838, 0x11838, G::kSpacingMark }, { 0x11839, 0x1183a, G::kExtend },
+  { 0x11930, 0x11930, G::kExtend }, { 0x11931, 0x11935, G::kSpacingMark }, { 0x11937, 0x11938, G::kSpacingMark },
+  { 0x1193b, 0x1193c, G::kExtend }, { 0x1193d, 0x1193d, G::kSpacingMark }, { 0x1193e, 0x1193e, G::kExtend },
+  { 0x1193f, 0x1193f, G::kPrepend }, { 0x11940, 0x11940, G::kSpacingMark }, { 0x11941, 0x11941, G::kPrepend },
+  { 0x11942, 0x11942, G::kSpacingMark }, { 0x11943, 0x11943, G::kExtend }, { 0x119d1, 0x119d3, G::kSpacingMark },
+  { 0x119d4, 0x119d7, G::kExtend }, { 0x119da, 0x119db, G::kExtend }, { 0x119dc, 0x119df, G::kSpacingMark },
+  { 0x119e0, 0x119e0, G::kExtend }, { 0x119e4, 0x119e4, G::kSpacingMark }, { 0x11a01, 0x11a0a, G::kExtend },
+  { 0x11a33, 0x11a38, G::kExtend }, { 0x11a39, 0x11a39, G::kSpacingMark }, { 0x11a3a, 0x11a3a, G::kPrepend },
+  { 0x11a3b, 0x11a3e, G::kExtend }, { 0x11a47, 0x11a47, G::kExtend }, { 0x11a51, 0x11a56, G::kExtend },
+  { 0x11a57, 0x11a58, G::kSpacingMark }, { 0x11a59, 0x11a5b, G::kExtend }, { 0x11a84, 0x11a89, G::kPrepend },
+  { 0x11a8a, 0x11a96, G::kExtend }, { 0x11a97, 0x11a97, G::kSpacingMark }, { 0x11a98, 0x11a99, G::kExtend },
+  { 0x11c2f, 0x11c2f, G::kSpacingMark }, { 0x11c30, 0x11c36, G::kExtend }, { 0x11c38, 0x11c3d, G::kExtend },
+  { 0x11c3e, 0x11c3e, G::kSpacingMark }, { 0x11c3f, 0x11c3f, G::kExtend }, { 0x11c92, 0x11ca7, G::kExtend },
+  { 0x11ca9, 0x11ca9, G::kSpacingMark }, { 0x11caa, 0x11cb0, G::kExtend }, { 0x11cb1, 0x11cb1, G::kSpacingMark },
+  { 0x11cb2, 0x11cb3, G::kExtend }, { 0x11cb4, 0x11cb4, G::kSpacingMark }, { 0x11cb5, 0x11cb6, G::kExtend },
+  { 0x11d31, 0x11d36, G::kExtend }, { 0x11d3a, 0x11d3a, G::kExtend }, { 0x11d3c, 0x11d3d, G::kExtend },
+  { 0x11d3f, 0x11d45, G::kExtend }, { 0x11d46, 0x11d46, G::kPrepend }, { 0x11d47, 0x11d47, G::kExtend },
+  { 0x11d8a, 0x11d8e, G::kSpacingMark }, { 0x11d90, 0x11d91, G::kExtend }, { 0x11d93, 0x11d94, G::kSpacingMark },
+  { 0x11d95, 0x11d95, G::kExtend }, { 0x11d96, 0x11d96, G::kSpacingMark }, { 0x11d97, 0x11d97, G::kExtend },
+  { 0x11ef3, 0x11ef4, G::kExtend }, { 0x11ef5, 0x11ef6, G::kSpacingMark }, { 0x13430, 0x13438, G::kControl },
+  { 0x16af0, 0x16af4, G::kExtend }, { 0x16b30, 0x16b36, G::kExtend }, { 0x16f4f, 0x16f4f, G::kExtend },
+  { 0x16f51, 0x16f87, G::kSpacingMark }, { 0x16f8f, 0x16f92, G::kExtend }, { 0x16fe4, 0x16fe4, G::kExtend },
+  { 0x16ff0, 0x16ff1, G::kSpacingMark }, { 0x1bc9d, 0x1bc9e, G::kExtend }, { 0x1bca0, 0x1bca3, G::kControl },
+  { 0x1cf00, 0x1cf2d, G::kExtend }, { 0x1cf30, 0x1cf46, G::kExtend }, { 0x1d165, 0x1d165, G::kExtend },
+  { 0x1d166, 0x1d166, G::kSpacingMark }, { 0x1d167, 0x1d169, G::kExtend }, { 0x1d16d, 0x1d16d, G::kSpacingMark },
+  { 0x1d16e, 0x1d172, G::kExtend }, { 0x1d173, 0x1d17a, G::kControl }, { 0x1d17b, 0x1d182, G::kExtend },
+  { 0x1d185, 0x1d18b, G::kExtend }, { 0x1d1aa, 0x1d1ad, G::kExtend }, { 0x1d242, 0x1d244, G::kExtend },
+  { 0x1da00, 0x1da36, G::kExtend }, { 0x1da3b, 0x1da6c, G::kExtend }, { 0x1da75, 0x1da75, G::kExtend },
+  { 0x1da84, 0x1da84, G::kExtend }, { 0x1da9b, 0x1da9f, G::kExtend }, { 0x1daa1, 0x1daaf, G::kExtend },
+  { 0x1e000, 0x1e006, G::kExtend }, { 0x1e008, 0x1e018, G::kExtend }, { 0x1e01b, 0x1e021, G::kExtend },
+  { 0x1e023, 0x1e024, G::kExtend }, { 0x1e026, 0x1e02a, G::kExtend }, { 0x1e130, 0x1e136, G::kExtend },
+  { 0x1e2ae, 0x1e2ae, G::kExtend }, { 0x1e2ec, 0x1e2ef, G::kExtend }, { 0x1e8d0, 0x1e8d6, G::kExtend },
+  { 0x1e944, 0x1e94a, G::kExtend }, { 0x1f000, 0x1f0ff, G::kExtendedPictographic },
+  { 0x1f10d, 0x1f10f, G::kExtendedPictographic }, { 0x1f12f, 0x1f12f, G::kExtendedPictographic },
+  { 0x1f16c, 0x1f171, G::kExtendedPictographic }, { 0x1f17e, 0x1f17f, G::kExtendedPictographic },
+  { 0x1f18e, 0x1f18e, G::kExtendedPictographic }, { 0x1f191, 0x1f19a, G::kExtendedPictographic },
+  { 0x1f1ad, 0x1f1e5, G::kExtendedPictographic }, { 0x1f1e6, 0x1f1ff, G::kRegionalIndicator },
+  { 0x1f201, 0x1f20f, G::kExtendedPictographic }, { 0x1f21a, 0x1f21a, G::kExtendedPictographic },
+  { 0x1f22f, 0x1f22f, G::kExtendedPictographic }, { 0x1f232, 0x1f23a, G::kExtendedPictographic },
+  { 0x1f23c, 0x1f23f, G::kExtendedPictographic }, { 0x1f249, 0x1f3fa, G::kExtendedPictographic },
+  { 0x1f3fb, 0x1f3ff, G::kExtend }, { 0x1f400, 0x1f53d, G::kExtendedPictographic },
+  { 0x1f546, 0x1f64f, G::kExtendedPictographic }, { 0x1f680, 0x1f6ff, G::kExtendedPictographic },
+  { 0x1f774, 0x1f77f, G::kExtendedPictographic }, { 0x1f7d5, 0x1f7ff, G::kExtendedPictographic },
+  { 0x1f80c, 0x1f80f, G::kExtendedPictographic }, { 0x1f848, 0x1f84f, G::kExtendedPictographic },
+  { 0x1f85a, 0x1f85f, G::kExtendedPictographic }, { 0x1f888, 0x1f88f, G::kExtendedPictographic },
+  { 0x1f8ae, 0x1f8ff, G::kExtendedPictographic }, { 0x1f90c, 0x1f93a, G::kExtendedPictographic },
+  { 0x1f93c, 0x1f945, G::kExtendedPictographic }, { 0x1f947, 0x1faff, G::kExtendedPictographic },
+  { 0x1fc00, 0x1fffd, G::kExtendedPictographic }, { 0xe0000, 0xe001f, G::kControl }, { 0xe0020, 0xe007f, G::kExtend },
+  { 0xe0080, 0xe00ff, G::kControl }, { 0xe0100, 0xe01ef, G::kExtend }, { 0xe01f0, 0xe0fff, G::kControl },
+#undef G
+};
+
+// The properties of all code points, in blocks of 256 code points, the blocks with the same properties shared: 101 of
+// them in Unicode 14.0, most of the code points being unassigned. Filled from kGraphemeBreakRanges on first use.
+struct GraphemeBreakTable {
+  uint8_t block_of[0x110000 >> 8];
+  std::vector<std::array<GraphemeBreak, 256>> blocks;
+};
+
+inline GraphemeBreakTable const&
+grapheme_break_table() {
+  static auto const table = [] {
+    GraphemeBreakTable table;
+    std::array<GraphemeBreak, 256> block;
+    auto range = std::begin(kGraphemeBreakRanges);
+    for (char32_t b = 0; b < std::size(table.block_of); b++) {
+      char32_t first = b << 8, last = first + 255;
+      block.fill(GraphemeBreak::kOther);
+      for (; range != std::end(kGraphemeBreakRanges) && range->first <= last; range++) {
+        for (auto c = std::max(range->first, first); c <= std::min(range->last, last); c++) block[c - first] = range->value;
+        if (range->last > last) break; // continues in the next block.
+      }
+      for (auto c = std::max(first, char32_t(0xac00)); c <= std::min(last, char32_t(0xd7a3)); c++) {
+        block[c - first] = (c - 0xac00) % 28 == 0 ? GraphemeBreak::kLV : GraphemeBreak::kLVT; // Hangul syllables.
+      }
+      auto it = std::find(table.blocks.begin(), table.blocks.end(), block);
+      table.block_of[b] = uint8_t(it - table.blocks.begin());
+      if (it == table.blocks.end()) table.blocks.push_back(block);
+    }
+    return table;
+  }();
+  return table;
+}
+
+inline GraphemeBreak
+grapheme_break(char32_t c) {
+  if (c < 0x7f) return c >= 0x20 ? GraphemeBreak::kOther : c == '\r' ? GraphemeBreak::kCR : c == '\n' ? GraphemeBreak::kLF : GraphemeBreak::kControl;
+  if (c >= 0x110000) return GraphemeBreak::kOther;
+  auto const& table = grapheme_break_table();
+  return table.blocks[table.block_of[c >> 8]][c & 0xff];
+}
+
+// The code point that starts at text[i] and its length in code units. Lone surrogates are code points of their own.
+inline char32_t
+grapheme_code_point_at(wchar_t const* text, size_t len, size_t i, size_t* n) {
+  *n = 1;
+  if constexpr (sizeof(wchar_t) == 2) {
+    if (0xd800 <= text[i] && text[i] < 0xdc00 && i + 1 < len && 0xdc00 <= text[i + 1] && text[i + 1] < 0xe000) {
+      *n = 2;
+      return 0x10000 + ((char32_t(text[i]) - 0xd800) << 10) + (char32_t(text[i + 1]) - 0xdc00);
+    }
+  }
+  return char32_t(text[i]);
+}
+
+// The code point that ends at text[i - 1], and its length in code units. i > 0
+inline char32_t
+grapheme_code_point_before(wchar_t const* text, size_t i, size_t* n) {
+  *n = 1;
+  if constexpr (sizeof(wchar_t) == 2) {
+    if (0xdc00 <= text[i - 1] && text[i - 1] < 0xe000 && i >= 2 && 0xd800 <= text[i - 2] && text[i - 2] < 0xdc00) {
+      *n = 2;
+      return 0x10000 + ((char32_t(text[i - 2]) - 0xd800) << 10) + (char32_t(text[i - 1]) - 0xdc00);
+    }
+  }
+  return char32_t(text[i - 1]);
+}
+
+// Whether there is a boundary at text[i], between a code point of property a, of n code units, and one of property b.
+// Looks further back only for emoji sequences and flags.
+inline bool
+grapheme_is_break_between(wchar_t const* text, size_t i, size_t n, GraphemeBreak a, GraphemeBreak b) {
+  using G = GraphemeBreak;
+  if (a == G::kCR && b == G::kLF) return false; // GB3
+  if (a == G::kCR || a == G::kLF || a == G::kControl || b == G::kCR || b == G::kLF || b == G::kControl) return true; // GB4, GB5
+  if (a == G::kL && (b == G::kL || b == G::kV || b == G::kLV || b == G::kLVT)) return false; // GB6
+  if ((a == G::kLV || a == G::kV) && (b == G::kV || b == G::kT)) return false; // GB7
+  if ((a == G::kLVT || a == G::kT) && b == G::kT) return false; // GB8
+  if (b == G::kExtend || b == G::kZwj || b == G::kSpacingMark) return false; // GB9, GB9a
+  if (a == G::kPrepend) return false; // GB9b
+  size_t m;
+  if (a == G::kZwj && b == G::kExtendedPictographic) { // GB11: Extended_Pictographic Extend* ZWJ x Extended_Pictographic
+    for (auto j = i - n; j > 0; j -= m) {
+      auto c = grapheme_break(grapheme_code_point_before(text, j, &m));
+      if (c != G::kExtend) return c != G::kExtendedPictographic;
+    }
+    return true;
+  }
+  if (a == G::kRegionalIndicator && b == G::kRegionalIndicator) { // GB12, GB13: flags are pairs of regional indicators.
+    size_t num_before = 0;
+    for (auto j = i; j > 0 && grapheme_break(grapheme_code_point_before(text, j, &m)) == G::kRegionalIndicator; j -= m) num_before++;
+    return num_before % 2 == 0;
+  }
+  return true; // GB999
+}
+
+// Whether a character starts at text[i]. The start and the end of the text are boundaries.
+inline bool
+grapheme_is_boundary(wchar_t const* text, size_t len, size_t i) {
+  if (i == 0 || i >= len) return true;
+  size_t n, m;
+  auto before = grapheme_code_point_before(text, i, &n);
+  if (n == 1 && sizeof(wchar_t) == 2 && 0xd800 <= before && before < 0xdc00 && 0xdc00 <= text[i] && text[i] < 0xe000) return false; // within a surrogate pair.
+  return grapheme_is_break_between(text, i, n, grapheme_break(before), grapheme_break(grapheme_code_point_at(text, len, i, &m)));
+}
+
+inline bool
+grapheme_is_simple(wchar_t c) {
+  return (0x20 <= c && c <= 0x7e) || (0xa0 <= c && c <= 0x2ff && c != 0xad);
+}
+
+#if TEXT_SCANNER_SSE2
+// Bit i set when text[i] is simple, for 16 code units.
+inline uint32_t
+grapheme_simple_mask_sse2(wchar_t const* text) {
+  __m128i lo, hi;
+  if constexpr (sizeof(wchar_t) == 2) {
+    lo = _mm_loadu_si128((__m128i const*)text);
+    hi = _mm_loadu_si128((__m128i const*)(text + 8));
+  }
+  else {
+    // Saturates code units above 0x7fff to 0x7fff, which isn't simple either.
+    auto p = (__m128i const*)text;
+    lo = _mm_packs_epi32(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+    hi = _mm_packs_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+  }
+  auto zero = _mm_setzero_si128();
+  const auto in16 = [&](__m128i x, uint16_t first, uint16_t last) {
+    auto d = _mm_subs_epu16(_mm_sub_epi16(x, _mm_set1_epi16(int16_t(first))), _mm_set1_epi16(int16_t(last - first)));
+    return _mm_cmpeq_epi16(d, zero);
+  };
+  const auto simple = [&](__m128i x) {
+    return _mm_or_si128(in16(x, 0x20, 0x7e), _mm_andnot_si128(_mm_cmpeq_epi16(x, _mm_set1_epi16(0xad)), in16(x, 0xa0, 0x2ff)));
+  };
+  return uint32_t(_mm_movemask_epi8(_mm_packs_epi16(simple(lo), simple(hi))));
+}
+#endif
+
+// The number of simple code units at the start of text[0..len).
+inline size_t
+grapheme_simple_run(wchar_t const* text, size_t len) {
+  size_t i = 0;
+#if TEXT_SCANNER_SSE2
+  for (; i + 16 <= len; i += 16) {
+    auto mask = grapheme_simple_mask_sse2(text + i);
+    if (mask != 0xffff) return i + size_t(std::countr_one(mask));
+  }
+#endif
+  while (i < len && grapheme_is_simple(text[i])) i++;
+  return i;
+}
+
+// The number of simple code units at the end of text[0..len).
+inline size_t
+grapheme_simple_run_before(wchar_t const* text, size_t len) {
+  size_t i = 0;
+#if TEXT_SCANNER_SSE2
+  for (; i + 16 <= len; i += 16) {
+    auto mask = grapheme_simple_mask_sse2(text + len - i - 16);
+    if (mask != 0xffff) return i + size_t(std::countl_one(uint16_t(mask)));
+  }
+#endif
+  while (i < len && grapheme_is_simple(text[len - i - 1])) i++;
+  return i;
+}
+
+// Moves *i across up to count characters of text[0..len), forward, and returns how many it moved across.
+inline size_t
+grapheme_move_forward(wchar_t const* text, size_t len, size_t* i, size_t count) {
+  size_t moved = 0;
+  while (moved < count && *i < len) {
+    // Between two simple code units, one character per code unit.
+    auto run = grapheme_simple_run(text + *i, std::min(len - *i, count - moved + 1));
+    if (run >= 2) {
+      *i += run - 1;
+      moved += run - 1;
+      continue;
+    }
+    // From a boundary to the next, with the property of the code point before *i.
+    size_t n, m;
+    auto a = grapheme_break(grapheme_code_point_at(text, len, *i, &n));
+    for (*i += n; *i < len; *i += m, n = m) {
+      auto b = grapheme_break(grapheme_code_point_at(text, len, *i, &m));
+      if (grapheme_is_break_between(text, *i, n, a, b)) break;
+      a = b;
+    }
+    moved++;
+  }
+  return moved;
+}
+
+// Moves *i across up to count characters of text[0..*i), backward, and returns how many it moved across.
+inline size_t
+grapheme_move_backward(wchar_t const* text, size_t* i, size_t count) {
+  size_t moved = 0;
+  while (moved < count && *i > 0) {
+    auto max_run = std::min(*i, count - moved + 1);
+    auto run = grapheme_simple_run_before(text + *i - max_run, max_run);
+    if (run >= 2) {
+      *i -= run - 1;
+      moved += run - 1;
+      continue;
+    }
+    // From a boundary to the previous, with the property of the code point at *i.
+    size_t n, m;
+    auto b = grapheme_break(grapheme_code_point_before(text, *i, &m));
+    for (*i -= m; *i > 0; *i -= n) {
+      auto a = grapheme_break(grapheme_code_point_before(text, *i, &n));
+      if (grapheme_is_break_between(text, *i, n, a, b)) break;
+      b = a;
+    }
+    moved++;
+  }
+  return moved;
+}
@@ -0,0 +1,172 @@
+// # Latency histograms
+//
+// Times code blocks, like the entry points of our UIA providers, to find out which of them blow our latency budget.
+//
+// Put MEASURE_LATENCY("Class::Method") at the top of a block, and it will record how long the block took into the
+// histogram for that name. Histograms are log-linear, like HDR histograms: each power of two is split in 16 buckets,
+// so that any percentile is within ~6% of the actual value, whatever the range.
+//
+// Durations are measured in cycles of the timestamp counter, and only converted to nanoseconds when dumping, which
+// keeps the cost of a measurement down to two rdtsc and a few increments.
+//
+// Histograms aren't thread-safe. UIA calls our providers on the ui thread. (ProviderOptions_UseComThreading)
+//
+// Compile with MEASURE_LATENCIES=0 to remove the measurements.
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if !defined(MEASURE_LATENCIES)
+#define MEASURE_LATENCIES 1
+#endif
+
+inline uint64_t
+latency_clock_ticks() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+struct LatencyHistogram {
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kNumSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kMaxExponent = 40; // ~6 minutes at 3GHz, longer durations go into the last bucket.
+  static constexpr int kNumBuckets = (kMaxExponent - kSubBucketBits + 2) * kNumSubBuckets;
+
+  char const* name;
+  uint64_t count = 0;
+  uint64_t max_ticks = 0;
+  uint32_t buckets[kNumBuckets] = {};
+
+  static int bucket_index(uint64_t ticks) {
+    if (ticks < kNumSubBuckets) return int(ticks);
+    int exponent = int(std::bit_width(ticks)) - 1;
+    if (exponent > kMaxExponent) return kNumBuckets - 1;
+    auto sub_bucket = int(ticks >> (exponent - kSubBucketBits)) & (kNumSubBuckets - 1);
+    return (exponent - kSubBucketBits + 1) * kNumSubBuckets + sub_bucket;
+  }
+
+  // The middle of the range of durations that go into bucket i.
+  static double bucket_value(int i) {
+    if (i < kNumSubBuckets) return double(i);
+    int exponent = i / kNumSubBuckets + kSubBucketBits - 1;
+    int sub_bucket = i % kNumSubBuckets;
+    auto width = double(uint64_t(1) << (exponent - kSubBucketBits));
+    return (kNumSubBuckets + sub_bucket) * width + width / 2;
+  }
+
+  void record(uint64_t ticks) {
+    buckets[bucket_index(ticks)]++;
+    count++;
+    max_ticks = std::max(max_ticks, ticks);
+  }
+
+  // p in [0, 1]
+  double percentile_ticks(double p) const {
+    if (count == 0) return 0.0;
+    auto rank = std::max(uint64_t(1), uint64_t(p * double(count) + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      seen += buckets[i];
+      if (seen >= rank) return std::min(bucket_value(i), double(max_ticks));
+    }
+    return double(max_ticks);
+  }
+};
+
+struct LatencyHistograms {
+  std::vector<LatencyHistogram*> all;
+  uint64_t start_ticks = latency_clock_ticks();
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+};
+
+inline LatencyHistograms&
+latency_histograms() {
+  static LatencyHistograms instance;
+  return instance;
+}
+
+inline LatencyHistogram&
+latency_histogram_register(char const* name) {
+  auto h = new LatencyHistogram; // lives as long as the program.
+  h->name = name;
+  latency_histograms().all.push_back(h);
+  return *h;
+}
+
+inline double
+latency_ns_per_tick() {
+  auto& hs = latency_histograms();
+  // Make sure we measure the clock over a long enough time to be accurate.
+  for (;;) {
+    auto ticks = latency_clock_ticks() - hs.start_ticks;
+    auto elapsed = std::chrono::steady_clock::now() - hs.start_time;
+    if (elapsed >= std::chrono::milliseconds(10) && ticks > 0) {
+      return std::chrono::duration<double, std::nano>(elapsed).count() / double(ticks);
+    }
+  }
+}
+
+// When set, also receives every measurement. (see TraceEvents.h)
+inline void (*g_latency_scope_hook)(char const* name, uint64_t start_ticks, uint64_t end_ticks) = nullptr;
+
+struct LatencyScope {
+  LatencyHistogram& histogram;
+  uint64_t start = latency_clock_ticks();
+
+  explicit LatencyScope(LatencyHistogram& h) : histogram(h) {}
+  ~LatencyScope() {
+    auto end = latency_clock_ticks();
+    histogram.record(end - start);
+    if (g_latency_scope_hook) g_latency_scope_hook(histogram.name, start, end);
+  }
+  LatencyScope(LatencyScope const&) = delete;
+  LatencyScope& operator=(LatencyScope const&) = delete;
+};
+
+#if MEASURE_LATENCIES
+#define MEASURE_LATENCY(name_) \
+  static LatencyHistogram& latency_histogram_ = latency_histogram_register(name_); \
+  LatencyScope latency_scope_(latency_histogram_)
+#else
+#define MEASURE_LATENCY(name_) do {} while (0)
+#endif
+
+// Prints count, p50, p99 and max of every histogram that has been recorded into, slowest p99 first. Call with
+// reset=true to start measuring again from scratch, i.e. to compare before/after some action.
+template <typename Print>
+void
+latency_histograms_dump(Print&& print, bool reset = false) {
+  auto& hs = latency_histograms();
+  auto ns_per_tick = latency_ns_per_tick();
+  std::vector<LatencyHistogram*> sorted;
+  for (auto h : hs.all) {
+    if (h->count) sorted.push_back(h);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->percentile_ticks(0.99) > b->percentile_ticks(0.99); });
+
+  print("latency: %zu methods called\n", sorted.size());
+  print("  %-52s %10s %12s %12s %12s\n", "method", "calls", "p50 (ns)", "p99 (ns)", "max (ns)");
+  for (auto h : sorted) {
+    print("  %-52s %10llu %12.0f %12.0f %12.0f\n", h->name, (unsigned long long)h->count,
+      h->percentile_ticks(0.5) * ns_per_tick, h->percentile_ticks(0.99) * ns_per_tick, double(h->max_ticks) * ns_per_tick);
+  }
+  if (reset) {
+    for (auto h : hs.all) {
+      *h = LatencyHistogram{ .name = h->name };
+    }
+  }
+}
@@ -0,0 +1,85 @@
+// # Log Decoder
+//
+// Renders the binary log written by SRFirst and TodoApp (see BinaryLog.h) as the text they used to write.
+//
+// Usage: LogDecoder [log.bin [log.txt]]
+//
+// Reads log.bin by default, and writes to the standard output when no output file is given.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "BinaryLog.h"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+int
+main(int argc, char** argv) {
+  auto input_path = argc > 1 ? argv[1] : "log.bin";
+  auto input = std::fopen(input_path, "rb");
+  if (!input) {
+    std::fprintf(stderr, "could not open %s\n", input_path);
+    return 1;
+  }
+  auto output = argc > 2 ? std::fopen(argv[2], "wb") : stdout;
+  if (!output) {
+    std::fprintf(stderr, "could not open %s\n", argv[2]);
+    return 1;
+  }
+
+  unsigned char header[16];
+  if (std::fread(header, 1, sizeof header, input) != sizeof header || std::memcmp(header, binary_log::kMagic, sizeof binary_log::kMagic) != 0) {
+    std::fprintf(stderr, "%s is not a binary log\n", input_path);
+    return 1;
+  }
+  size_t wchar_size = header[8];
+  if (wchar_size != 2 && wchar_size != 4) {
+    std::fprintf(stderr, "unsupported wchar_t size: %zu\n", wchar_size);
+    return 1;
+  }
+
+  std::unordered_map<uint32_t, std::string> formats;
+  std::vector<unsigned char> payload;
+  std::string text;
+  for (;;) {
+    auto tag = std::fgetc(input);
+    if (tag == EOF) break;
+
+    uint32_t id, len;
+    if (std::fread(&id, sizeof id, 1, input) != 1 || std::fread(&len, sizeof len, 1, input) != 1) {
+      std::fprintf(stderr, "truncated log\n");
+      return 1;
+    }
+    payload.resize(len);
+    if (len > 0 && std::fread(payload.data(), 1, len, input) != len) {
+      std::fprintf(stderr, "truncated log\n");
+      return 1;
+    }
+
+    switch (tag) {
+    case 'F': {
+      formats[id].assign(reinterpret_cast<char const*>(payload.data()), len);
+    } break;
+    case 'R': {
+      auto format = formats.find(id);
+      if (format == formats.end()) {
+        std::fprintf(stderr, "record refers to unknown format %u\n", id);
+        return 1;
+      }
+      text.clear();
+      binary_log::render_record(text, format->second.c_str(), payload.data(), payload.size(), wchar_size);
+      std::fwrite(text.data(), 1, text.size(), output);
+    } break;
+    default: {
+      std::fprintf(stderr, "unknown tag %#x\n", tag);
+      return 1;
+    }
+    }
+  }
+
+  if (output != stdout) std::fclose(output);
+  std::fclose(input);
+  return 0;
+}
@@ -0,0 +1,94 @@
+// # Log filter
+//
+// Categories and levels for log messages, so that the chatty parts of the program (i.e. every UIA call) cost nothing
+// unless somebody wants to read them.
+//
+// Messages above LOG_MAX_LEVEL are compiled out, including the evaluation of their arguments. (Trace messages in
+// release builds by default) The other ones are checked at runtime against the level of their category, which is
+// Info unless set on the command line, with one or more --log=<category>:<level>. For instance:
+//   --log=all:trace --log=input:error
+//
+// The LOG_ macros call an unqualified log(fmt, ...), i.e. the member log() inside classes that prefix their messages,
+// and ::log elsewhere.
+
+#pragma once
+
+#include <cwchar>
+#include <iterator>
+
+enum LogLevel {
+  LogLevel_Off,
+  LogLevel_Error,
+  LogLevel_Info,
+  LogLevel_Trace,
+};
+
+enum LogCategory {
+  LogCategory_Providers,  // UIA element providers: QueryInterface, properties, patterns, navigation
+  LogCategory_TextRanges, // UIA text providers and text ranges
+  LogCategory_Tree,       // building and indexing the ui tree
+  LogCategory_Input,      // window messages, keyboard and mouse
+  LogCategory_Events,     // focus changes, activation and the UIA events we raise
+  LogCategory_Count,
+};
+
+#if !defined(LOG_MAX_LEVEL)
+#if defined(NDEBUG)
+#define LOG_MAX_LEVEL LogLevel_Info
+#else
+#define LOG_MAX_LEVEL LogLevel_Trace
+#endif
+#endif
+
+inline LogLevel g_log_levels[LogCategory_Count] = {
+  LogLevel_Info, LogLevel_Info, LogLevel_Info, LogLevel_Info, LogLevel_Info,
+};
+
+// For guarding more than a single message, e.g. when formatting an argument is expensive in itself.
+#define LOG_ENABLED(category_, level_) ((level_) <= LOG_MAX_LEVEL && (level_) <= g_log_levels[category_])
+
+#define LOG_AT(category_, level_, ...) do { \
+  if constexpr ((level_) <= LOG_MAX_LEVEL) { if ((level_) <= g_log_levels[category_]) { log(__VA_ARGS__); } } \
+} while (0)
+
+#define LOG_ERROR(category_, ...) LOG_AT(category_, LogLevel_Error, __VA_ARGS__)
+#define LOG_INFO(category_, ...) LOG_AT(category_, LogLevel_Info, __VA_ARGS__)
+#define LOG_TRACE(category_, ...) LOG_AT(category_, LogLevel_Trace, __VA_ARGS__)
+
+// Applies every --log=<category>:<level> option of the command line. Returns false if one of them could not be
+// understood, in which case it was ignored.
+inline bool
+log_levels_parse_command_line(wchar_t const* cmdline) {
+  static wchar_t const* const category_names[LogCategory_Count] = {
+    L"providers", L"text", L"tree", L"input", L"events",
+  };
+  static wchar_t const* const level_names[] = { L"off", L"error", L"info", L"trace" };
+  auto matches = [](wchar_t const* s, size_t n, wchar_t const* name) {
+    return std::wcslen(name) == n && std::wcsncmp(s, name, n) == 0;
+  };
+
+  if (!cmdline) return true;
+  bool all_understood = true;
+  for (auto option = std::wcsstr(cmdline, L"--log="); option; option = std::wcsstr(option, L"--log=")) {
+    option += std::wcslen(L"--log=");
+    auto category = option;
+    auto category_end = std::wcschr(category, L':');
+    if (!category_end) { all_understood = false; continue; }
+    auto level = category_end + 1;
+    auto level_size = std::wcscspn(level, L" \t");
+
+    int level_index = -1;
+    for (int i = 0; i < int(std::size(level_names)); ++i) {
+      if (matches(level, level_size, level_names[i])) level_index = i;
+    }
+    bool is_all = matches(category, category_end - category, L"all");
+    bool found_category = is_all;
+    for (int i = 0; i < LogCategory_Count; ++i) {
+      if (!is_all && !matches(category, category_end - category, category_names[i])) continue;
+      found_category = true;
+      if (level_index != -1) g_log_levels[i] = LogLevel(level_index);
+    }
+    if (level_index == -1 || !found_category) all_understood = false;
+  }
+  return all_understood;
+}
@@ -0,0 +1,130 @@
+// # Rect index
+//
+// Bounding volume hierarchies over the rects of the ui nodes, for hit-testing. Rebuilt by the first query after the
+// rects changed, i.e. once per frame at most, however many times screen readers hit-test while the user moves the
+// mouse.
+//
+// There is one hierarchy per ui depth, so that the large rects of containers don't inflate the bounds around their
+// descendants. Its nodes are in depth-first order: an inner node at i has its children at i + 1 and at second_child[i].
+//
+// Shared by UiCore (UiRect) and TodoApp (RECT): Rect is any type with left, top, right and bottom members, bottom and
+// right being exclusive.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+template <typename Rect>
+struct RectIndex {
+  std::vector<Rect>     bounds;
+  std::vector<uint32_t> first_item; // for leaves, the start of their node indices within `items`.
+  std::vector<uint32_t> num_items; // 0 => inner node.
+  std::vector<uint32_t> second_child;
+  std::vector<size_t>   items;
+  std::vector<Rect>     item_rects; // node_rect[items[i]], to test the items of a leaf without jumping around.
+  std::vector<uint32_t> level_roots; // deepest level first.
+  bool dirty = true;
+};
+
+// Builds the hierarchy over items[first, last), splitting at the median of the longest axis.
+template <typename Rect>
+void
+rect_index_build(RectIndex<Rect>& bvh, std::vector<Rect> const& node_rect, size_t first, size_t last) {
+  constexpr size_t kMaxItemsPerLeaf = 4;
+
+  auto node = bvh.bounds.size();
+  Rect bounds = node_rect[bvh.items[first]];
+  for (auto i = first; i < last; i++) {
+    auto r = node_rect[bvh.items[i]];
+    bounds = {
+      .left = std::min(bounds.left, r.left),
+      .top = std::min(bounds.top, r.top),
+      .right = std::max(bounds.right, r.right),
+      .bottom = std::max(bounds.bottom, r.bottom),
+    };
+  }
+  bvh.bounds.push_back(bounds);
+  bvh.first_item.push_back(uint32_t(first));
+  bvh.num_items.push_back(0);
+  bvh.second_child.push_back(0);
+
+  if (last - first <= kMaxItemsPerLeaf) {
+    bvh.num_items[node] = uint32_t(last - first);
+    return;
+  }
+
+  // Twice the center, to stay in integers.
+  auto split_x = bounds.right - bounds.left >= bounds.bottom - bounds.top;
+  auto center = [split_x](Rect r) { return split_x ? r.left + r.right : r.top + r.bottom; };
+  auto mid = first + (last - first) / 2;
+  std::nth_element(bvh.items.begin() + first, bvh.items.begin() + mid, bvh.items.begin() + last, [&](size_t a, size_t b) {
+    return center(node_rect[a]) < center(node_rect[b]);
+  });
+  rect_index_build(bvh, node_rect, first, mid);
+  bvh.second_child[node] = uint32_t(bvh.bounds.size());
+  rect_index_build(bvh, node_rect, mid, last);
+}
+
+// Rebuilds the hierarchies if the rects changed since. node_depth is the depth of each node.
+template <typename Rect>
+void
+rect_index_update(RectIndex<Rect>& bvh, std::vector<Rect> const& node_rect, std::vector<int> const& node_depth) {
+  if (!bvh.dirty) return;
+  bvh.dirty = false;
+  bvh.bounds.clear();
+  bvh.first_item.clear();
+  bvh.num_items.clear();
+  bvh.second_child.clear();
+  bvh.items.clear();
+  bvh.item_rects.clear();
+  bvh.level_roots.clear();
+
+  for (size_t i = 0; i < node_rect.size(); i++) {
+    auto r = node_rect[i];
+    if (r.left < r.right && r.top < r.bottom) bvh.items.push_back(i);
+  }
+  std::stable_sort(bvh.items.begin(), bvh.items.end(), [&](size_t a, size_t b) {
+    return node_depth[a] > node_depth[b];
+  });
+  for (size_t first = 0, last; first < bvh.items.size(); first = last) {
+    auto depth = node_depth[bvh.items[first]];
+    for (last = first + 1; last < bvh.items.size() && node_depth[bvh.items[last]] == depth; last++) {}
+    bvh.level_roots.push_back(uint32_t(bvh.bounds.size()));
+    rect_index_build(bvh, node_rect, first, last);
+  }
+  for (auto index : bvh.items) bvh.item_rects.push_back(node_rect[index]);
+}
+
+// Returns the index of the deepest node whose rect contains the point (the last one in presentation order, among
+// equals), or size_t(-1) when there is none. contains(rect) tells whether a rect contains the point.
+template <typename Rect, typename Contains>
+size_t
+rect_index_search_deepest(RectIndex<Rect> const& bvh, Contains&& contains) {
+  // The first level with a hit has the deepest nodes, and we keep the last of them.
+  size_t found = size_t(-1);
+  for (auto root : bvh.level_roots) {
+    uint32_t stack[64]; // one pending node per level at most, and the median splits keep it under 64 levels.
+    int stack_size = 0;
+    stack[stack_size++] = root;
+    while (stack_size > 0) {
+      auto node = stack[--stack_size];
+      if (!contains(bvh.bounds[node])) continue;
+
+      if (bvh.num_items[node] == 0) {
+        stack[stack_size++] = bvh.second_child[node];
+        stack[stack_size++] = node + 1;
+        continue;
+      }
+      for (auto i = bvh.first_item[node], end = i + bvh.num_items[node]; i < end; i++) {
+        auto index = bvh.items[i];
+        if (found != size_t(-1) && index < found) continue;
+        if (contains(bvh.item_rects[i])) found = index;
+      }
+    }
+    if (found != size_t(-1)) break;
+  }
+  return found;
+}
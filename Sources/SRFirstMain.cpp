@@ -48,7 +48,11 @@
 #define NOMINMAX
 #define _CRT_SECURE_NO_WARNINGS
 
-#include "wyhash.h"
+#include "UiCore.h"
+#include "BinaryLog.h"
+#include "LatencyHistograms.h"
+#include "LogFilter.h"
+#include "SlabPool.h"
 #include "SRFirstResources.h"
 
 #include <Windows.h>
@@ -65,40 +69,23 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <cwchar>
 #include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 // 1. Utils
 
-#define STRINGIFY_INNER(s) # s
-#define STRINGIFY(s) STRINGIFY_INNER(s)
-#define VERIFY(expr) do { auto r = (expr); if (!bool(r)) { \
-  auto LastError = GetLastError(); auto LastErrorAsHRESULT = HRESULT_FROM_WIN32(LastError); \
-  ::log("%s:%d: VERIFY(%s) failed. (GetLastError() returns %#x)\n", __FILE__, __LINE__, STRINGIFY(expr), LastErrorAsHRESULT); \
-  if (::IsDebuggerPresent()) { ::DebugBreak(); } \
-  std::exit(1); \
-} } while(0)
-
 #define VERIFYHR(expr) do { auto hr = (expr); VERIFY(SUCCEEDED(hr)); } while(0)
 
 
-static FILE* g_output_log = fopen("log.txt", "wb");
-//stdout;
-
-void
-logv(char const* fmt, va_list args) {
-    std::vfprintf(g_output_log, fmt, args);
-    std::fflush(g_output_log);
-}
-
+// Writes the latencies of the provider methods called so far to the log.
 void
-log(char const* fmt, ...) {
-  std::va_list args;
-  va_start(args, fmt);
-  ::logv(fmt, args);
-  va_end(args);
+log_latencies(bool reset = false) {
+  latency_histograms_dump([](char const* fmt, auto... args) { ::log(fmt, args...); }, reset);
 }
 
 uint64_t
@@ -107,11 +94,6 @@ bits(uint64_t x, uint64_t start, uint64_t num) {
   return (x >> start)& ((1ULL << num) - 1);
 }
 
-uint64_t
-hash(size_t num_bytes, void const* bytes) {
-  return wyhash(bytes, num_bytes, 0, _wyp);
-}
-
 RECT
 intersection(RECT const a, RECT const b) {
   return {
@@ -120,6 +102,11 @@ intersection(RECT const a, RECT const b) {
   };
 }
 
+RECT
+win32_rect(UiRect const r) {
+  return { .left = r.left, .top = r.top, .right = r.right, .bottom = r.bottom };
+}
+
 RECT
 operator+ (RECT const a, POINT b) {
   return {
@@ -135,6 +122,7 @@ struct RootProvider : public IRawElementProviderSimple
   , public IRawElementProviderFragmentRoot
   , public IRawElementProviderFragment {
 
+    static constexpr LogCategory log_category = LogCategory_Providers;
     void log(char const* fmt, ...) {
         ::log("this(%p) RootProvider::", this);
         std::va_list args;
@@ -194,56 +182,18 @@ LRESULT CALLBACK main_window_proc(
 );
 
 void ui_describe();
-void ui_focus_next();
-void ui_focus_prev();
-void ui_activate();
-
-struct UiTree {
-  using Id = std::uint64_t;
-  // Id == -1 => invalid_id
-  // Id == 0  => root
-  // ...
-
-  enum class Type {
-    kNone,
-    kText,
-    kDocument,
-    kButton,
-    kPane,
-  };
-
-  // Nodes with their properties as separate arrays, APL-style.
-  std::vector<Id>           node_ids; // in presentation order.
-  std::vector<std::wstring> node_names;
-  std::vector<Type>         node_type;
-  std::vector<Id>           node_parent;
-  std::vector<int>          node_depth;
-  std::vector<size_t>       node_text_len; // total length of the text found within this node including its children.
+void ui_uia_raise_focus_changed(UiTree::Id id);
+void ui_uia_raise_text_changed(UiTree::Id id);
+void ui_uia_raise_invoked(UiTree::Id id);
 
-  std::vector<RECT> node_rect;
-
-  std::unordered_map<Id, std::function<void()>> actions;
-  std::unordered_map<Id, IRawElementProviderFragment*> providers;
-
-  Id focused_id = 0;
-
-  int depth_for_adding_element = 0;
-};
+// The elements we handed out to UIA, by id, each with the reference held by this cache.
+static std::unordered_map<UiTree::Id, IRawElementProviderFragment*> g_providers;
 
-bool
-valid_id(UiTree::Id id) {
-  return 0 < id && id < UiTree::Id(-1);
-}
-
-void ui_set_focus_to(UiTree::Id id);
-bool ui_activate(UiTree::Id);
-bool ui_is_ancestor(UiTree::Id candidate_ancestor_id, UiTree::Id of_id);
-
-static UiTree g_ui;
-
-bool
-exists_id(UiTree::Id id) {
-  return valid_id(id) && g_ui.node_ids.end() != std::find(g_ui.node_ids.begin(), g_ui.node_ids.end(), id);
+// Writes out what is left in the log before the process goes down.
+LONG WINAPI
+on_unhandled_exception(EXCEPTION_POINTERS*) {
+  binary_log_flush();
+  return EXCEPTION_CONTINUE_SEARCH;
 }
 
 int __stdcall
@@ -253,12 +203,16 @@ wWinMain(
   LPWSTR     lpCmdLine,
   int       nShowCmd
 ) {
+  ::SetUnhandledExceptionFilter(on_unhandled_exception);
   if (false) {
     VERIFY(::SetConsoleCP(CP_UTF8));
     VERIFY(::SetConsoleOutputCP(CP_UTF8)); // Only works in Windows 10.
     std::printf("Author: Nicolas Léveillé. 2021-03.\n");
   }
   log("START: Starting SRFirst\n");
+  if (!log_levels_parse_command_line(lpCmdLine)) {
+    log("Ignoring some --log options. Expected --log=<category>:<level>.\n");
+  }
   VERIFYHR(::CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
   WNDCLASSW Class = {
     .lpfnWndProc = main_window_proc,
@@ -314,7 +268,13 @@ wWinMain(
   auto Window = ::CreateWindowW(Class.lpszClassName, L"SRFirst", WS_CLIPCHILDREN|WS_GROUP|WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, nullptr, main_menu, nullptr, 0);
   VERIFY(Window);
   g_hwnd = Window;
+  g_ui_events = {
+    .focus_changed = ui_uia_raise_focus_changed,
+    .text_changed = ui_uia_raise_text_changed,
+    .invoked = ui_uia_raise_invoked,
+  };
   ui_describe();
+  ui_text_index_build();
   VERIFY(::ShowWindow(Window, SW_SHOWNORMAL) == 0);
 
   for (;;) {
@@ -328,8 +288,9 @@ wWinMain(
     ::DispatchMessageW(&msg);
   }
 end:
+  log("end: ui_get_index finger hits: %zu misses: %zu\n", g_ui.index_stats.finger_hits, g_ui.index_stats.finger_misses);
   log("end: num_active_providers: %d\n", g_num_active_providers);
-  for (auto& x : g_ui.providers) {
+  for (auto& x : g_providers) {
     x.second->Release();
   }
   log("after_releasing_cache: num_active_providers: %d\n", g_num_active_providers);
@@ -343,6 +304,7 @@ end:
   ::CoUninitialize();
   log("after_com_uninit: num_active_providers: %d\n", g_num_active_providers);
   VERIFY(g_num_active_providers == 0);
+  log_latencies();
   log("END: Ended.\n");
   return 0;
 }
@@ -366,12 +328,12 @@ main_window_proc(
 ) {
     switch (uMsg) {
     case WM_CLOSE: {
-        log("WM_CLOSE received\n");
+        LOG_INFO(LogCategory_Input, "WM_CLOSE received\n");
         ::DestroyWindow(g_hwnd);
         return 0;
     } break;
     case WM_DESTROY: {
-        log("WM_DESTROY received\n");
+        LOG_INFO(LogCategory_Input, "WM_DESTROY received\n");
         // Microsoft recommends making this call from the WM_DESTROY message handler of the window that returns the UI Automation providers.
         // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcoreapi/nf-uiautomationcoreapi-uiareturnrawelementprovider)
         ::UiaReturnRawElementProvider(hwnd, 0, 0, NULL);
@@ -380,7 +342,7 @@ main_window_proc(
     } break;
     //  2.1- Menu handling. URL(https://docs.microsoft.com/en-us/windows/win32/menurc/about-menus#messages-used-with-menus)
     case WM_COMMAND: {
-      log("WM_COMMAND received with command: %#lx\n", long(wParam));
+      LOG_INFO(LogCategory_Input, "WM_COMMAND received with command: %#lx\n", long(wParam));
       switch ((MenuId)LOWORD(wParam)) {
       case MenuId_File_Exit: ::DestroyWindow(g_hwnd); return 0; break;
       case MenuId_Help_About: {
@@ -393,7 +355,7 @@ main_window_proc(
     case WM_GETOBJECT: {
       switch ((DWORD)lParam) {
       case UiaRootObjectId: {
-        log("WM_GETOBJECT received for UiaAutomation with params: %u %u\n", wParam, lParam);
+        LOG_TRACE(LogCategory_Providers, "WM_GETOBJECT received for UiaAutomation with params: %u %u\n", wParam, lParam);
         if (!g_root_provider) {
           g_root_provider = new RootProvider;
         }
@@ -407,11 +369,11 @@ main_window_proc(
       if (0 == ((lParam >> 30) & 1 /* first transition bit*/)) {
         switch (wParam) {
         case VK_TAB: {
-          log("User pressed <Tab> to change focus.\n");
+          LOG_INFO(LogCategory_Input, "User pressed <Tab> to change focus.\n");
           BYTE Keys[256];
           VERIFY(::GetKeyboardState(Keys));
           if (Keys[VK_SHIFT] & (1<<7)) {
-            log("  <Shift-Tab>\n");
+            LOG_INFO(LogCategory_Input, "  <Shift-Tab>\n");
             ui_focus_prev();
           }
           else {
@@ -420,31 +382,36 @@ main_window_proc(
           return 0;
         } break;
         case VK_DOWN: {
-          log("User pressed <Down> to change focus.\n");
+          LOG_INFO(LogCategory_Input, "User pressed <Down> to change focus.\n");
           ui_focus_next();
         } break;
         case VK_UP: {
-          log("User pressed <Up> to change focus.\n");
+          LOG_INFO(LogCategory_Input, "User pressed <Up> to change focus.\n");
           ui_focus_prev();
         } break;
         case VK_RETURN: {
-          log("User pressed <Return> to activate primary action.\n");
+          LOG_INFO(LogCategory_Input, "User pressed <Return> to activate primary action.\n");
           ui_activate();
           return 0;
         } break;
+        case VK_F12: {
+          LOG_INFO(LogCategory_Input, "User pressed <F12> to dump latencies.\n");
+          log_latencies(true);
+          return 0;
+        } break;
         default: {
-          log("WM_KEYDOWN received: %#lx (unmapped)\n", long(wParam));
+          LOG_INFO(LogCategory_Input, "WM_KEYDOWN received: %#lx (unmapped)\n", long(wParam));
         } break;
         }
       }
     } break;
     case WM_CHAR: {
-      log("WM_CHAR with character code %llx (unmapped)\n", long(wParam));
+      LOG_INFO(LogCategory_Input, "WM_CHAR with character code %llx (unmapped)\n", long(wParam));
       return 0;
     } break;
-    case WM_KILLFOCUS: { log("WM_KILLFOCUS received towards %ul\n", ULONG(wParam));  } break;
+    case WM_KILLFOCUS: { LOG_INFO(LogCategory_Input, "WM_KILLFOCUS received towards %ul\n", ULONG(wParam));  } break;
     case WM_SETFOCUS: {
-      log("WM_SETFOCUS received\n");
+      LOG_INFO(LogCategory_Input, "WM_SETFOCUS received\n");
       // Adding a caret, because I thought this might help Narrator follow us. It seems it does not.
       VERIFY(::CreateCaret(hwnd, (HBITMAP) nullptr, 0, 8 /* TODO(nil): DPI */));
       VERIFY(::SetCaretPos(2, 2));
@@ -460,42 +427,12 @@ ITextProvider* create_element_text_provider(UiTree::Id element_id);
 IValueProvider* create_element_value_provider(UiTree::Id element_id);
 IInvokeProvider* create_element_invoke_provider(UiTree::Id element_id);
 
-size_t ui_get_index(UiTree::Id element_id);
-size_t ui_get_parent_index(UiTree::Id id);
-
-// TODO(nil): review TextPoint and ranges:
-//
-// This representation is awkward because it has two potential termination for a right exclusive range:
-// 
-// Either the same id with offset == length of text in element or
-// the next id with offset = 0
-//
-// Only the latter would make the loops natural. However we don't have an id to provide for the last element.
-//
-// One idea is to define ranges for each element in the g_ui arrays, so that we can use a single integer to represent a range.
-//
-// There'd be still an ambiguity about the end of which element we mean, but this could be fixed by using `depth` (which might map nicely to the TextUnit concept)
-//
-struct TextPoint {
-  UiTree::Id id = (uint64_t)-1;
-  int offset = 0;
-
-  friend bool operator==(TextPoint const a, TextPoint const b) {
-    return a.id == b.id && a.offset == b.offset;
-  }
-
-  friend std::strong_ordering operator<=>(TextPoint const a, TextPoint const b) {
-    if (a.id == b.id) { return a.offset <=> b.offset; }
-    return ui_get_index(a.id) <=> ui_get_index(b.id); // TODO(nil): implement enclosure logic. I.e. a document surrounds the text that it contains, so there must be a way to say, place the end point at the end of the enclosing document or at the beginning of the document. Which means that a document surrounds its text and can't logically be compared simply with the index.
-  }
-};
-
-
 ITextRangeProvider* create_text_range(TextPoint start, TextPoint end);
 
 
 HRESULT
 RootProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("RootProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IRawElementProviderSimple) return { "IRawElementProviderSimple", static_cast<IRawElementProviderSimple*>(this) };
@@ -512,39 +449,45 @@ RootProvider::QueryInterface(REFIID riid, void** ppvObject) {
     result = { "IUnknown", this };
   }
 
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
+    log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
+  }
   if (!ppvObject) return E_POINTER;
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  log("  supported_interface %s\n", result.first);
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
 HRESULT
 RootProvider::get_HostRawElementProvider(IRawElementProviderSimple** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::get_HostRawElementProvider");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-get_hostrawelementprovider)
   return UiaHostProviderFromHwnd(g_hwnd, pRetVal);
 }
 
 HRESULT
 RootProvider::get_ProviderOptions(ProviderOptions* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::get_ProviderOptions");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-get_provideroptions)
   return ProviderOptions_ServerSideProvider | ProviderOptions_UseComThreading;
 }
 
 HRESULT
 RootProvider::GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal) {
-  log("%s %d\n", __func__, patternId);
+  MEASURE_LATENCY("RootProvider::GetPatternProvider");
+  LOG_TRACE(log_category, "%s %d\n", __func__, patternId);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-getpatternprovider)
   if (!pRetVal) return E_POINTER;
   *pRetVal = nullptr;
@@ -553,7 +496,8 @@ RootProvider::GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal) {
 
 HRESULT
 RootProvider::GetPropertyValue(PROPERTYID propertyId, VARIANT* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::GetPropertyValue");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-getpropertyvalue)
   if (!pRetVal) return E_POINTER;
 
@@ -585,7 +529,8 @@ RootProvider::GetPropertyValue(PROPERTYID propertyId, VARIANT* pRetVal) {
 
 HRESULT
 RootProvider::get_BoundingRectangle(UiaRect* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::get_BoundingRectangle");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-get_boundingrectangle)
   if (!pRetVal) return E_INVALIDARG;
   RECT ClientRect;
@@ -601,7 +546,8 @@ RootProvider::get_BoundingRectangle(UiaRect* pRetVal) {
 
 HRESULT
 RootProvider::get_FragmentRoot(IRawElementProviderFragmentRoot** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::get_FragmentRoot");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-get_fragmentroot)
   if (!pRetVal) return E_INVALIDARG;
   this->AddRef();
@@ -611,7 +557,8 @@ RootProvider::get_FragmentRoot(IRawElementProviderFragmentRoot** pRetVal) {
 
 HRESULT
 RootProvider::GetEmbeddedFragmentRoots(SAFEARRAY** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::GetEmbeddedFragmentRoots");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-getembeddedfragmentroots)
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = nullptr;
@@ -620,7 +567,8 @@ RootProvider::GetEmbeddedFragmentRoots(SAFEARRAY** pRetVal) {
 
 HRESULT
 RootProvider::GetRuntimeId(SAFEARRAY** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::GetRuntimeId");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-getruntimeid)
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = nullptr;
@@ -629,7 +577,8 @@ RootProvider::GetRuntimeId(SAFEARRAY** pRetVal) {
 
 HRESULT
 RootProvider::Navigate(NavigateDirection direction, IRawElementProviderFragment** pRetVal) {
-  log("%s %d\n", __func__, direction);
+  MEASURE_LATENCY("RootProvider::Navigate");
+  LOG_TRACE(log_category, "%s %d\n", __func__, direction);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-navigate)
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = nullptr;
@@ -638,29 +587,12 @@ RootProvider::Navigate(NavigateDirection direction, IRawElementProviderFragment*
 
   switch (direction) {
   case NavigateDirection_FirstChild: {
-    log("  first-child(Root)\n");
-    if (!g_ui.node_ids.empty()) {
-      for (size_t index = 0; index < g_ui.node_ids.size(); index++) {
-        if (g_ui.node_depth[index] == 0) {
-          VERIFY(g_ui.node_parent[index] == 0);
-          element_id = g_ui.node_ids[index];
-          break;
-        }
-      }
-    }
+    LOG_TRACE(log_category, "  first-child(Root)\n");
+    element_id = ui_navigate(0, UiNavigateDirection::kFirstChild);
   } break;
   case NavigateDirection_LastChild: {
-    log("  last-child(Root)\n");
-    if (!g_ui.node_ids.empty()) {
-      for (size_t ri = g_ui.node_ids.size(); ri > 0; ri--) {
-        auto index = ri - 1;
-        if (g_ui.node_depth[index] == 0) {
-          VERIFY(g_ui.node_parent[index] == 0);
-          element_id = g_ui.node_ids[index];
-          break;
-        }
-      }
-    }
+    LOG_TRACE(log_category, "  last-child(Root)\n");
+    element_id = ui_navigate(0, UiNavigateDirection::kLastChild);
   } break;
 
   default: break;
@@ -675,7 +607,8 @@ RootProvider::Navigate(NavigateDirection direction, IRawElementProviderFragment*
 
 HRESULT
 RootProvider::SetFocus() {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::SetFocus");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-setfocus)
   ::SetFocus(g_hwnd);
   return S_OK;
@@ -683,7 +616,8 @@ RootProvider::SetFocus() {
 
 HRESULT
 RootProvider::GetFocus(IRawElementProviderFragment** pRetVal) {
-  log("%s (%#llx)\n", __func__, g_ui.focused_id);
+  MEASURE_LATENCY("RootProvider::GetFocus");
+  LOG_TRACE(log_category, "%s (%#llx)\n", __func__, g_ui.focused_id);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragmentroot-getfocus)
   if (!pRetVal) return E_POINTER;
 
@@ -697,7 +631,8 @@ RootProvider::GetFocus(IRawElementProviderFragment** pRetVal) {
 
 HRESULT
 RootProvider::ElementProviderFromPoint(double x, double y, IRawElementProviderFragment** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("RootProvider::ElementProviderFromPoint");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragmentroot-elementproviderfrompoint)
   if (!pRetVal) return E_POINTER;
   *pRetVal = nullptr;
@@ -708,24 +643,12 @@ RootProvider::ElementProviderFromPoint(double x, double y, IRawElementProviderFr
   x -= LeftTop.x;
   y -= LeftTop.y;
 
-  auto depth = 0;
-  UiTree::Id id = 0;
-  for (size_t i = 0; i < g_ui.node_rect.size(); i++) {
-    auto d = g_ui.node_depth[i];
-    if (d < depth) continue;
-    auto r = g_ui.node_rect[i];
-    if (y < r.top) continue;
-    if (y >= r.bottom) continue;
-    if (x < r.left) continue;
-    if (x >= r.right) continue;
-    depth = d;
-    id = g_ui.node_ids[i];
-  }
+  auto id = ui_element_from_point(x, y);
 
-  log("  Found element %#llx at depth %d\n", id, depth);
+  LOG_TRACE(log_category, "  Found element %#llx at depth %d\n", id, id ? g_ui.node_depth[ui_get_index(id)] : 0);
 
   if (id) {
-      *pRetVal = create_element_provider(g_ui.focused_id);
+      *pRetVal = create_element_provider(id);
   }
   else {
       this->AddRef();
@@ -739,11 +662,11 @@ struct ProviderInstanceTracker
 {
   ProviderInstanceTracker() { 
     g_num_active_providers++;
-    log("one new instance %p\n", (void*) this);
+    LOG_TRACE(LogCategory_Providers, "one new instance %p\n", (void*) this);
   }
   ~ProviderInstanceTracker() { 
     g_num_active_providers--; 
-    log("one less instance %p\n", (void*)this);
+    LOG_TRACE(LogCategory_Providers, "one less instance %p\n", (void*)this);
   }
 };
 
@@ -776,6 +699,7 @@ struct AnyElementProvider : public IRawElementProviderSimple, public IRawElement
   }
   HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
 
+  static constexpr LogCategory log_category = LogCategory_Providers;
   void log(char const* fmt, ...) {
     ::log("this(%p, id=%#llx) AnyElementProvider::", this, this->id);
     std::va_list args;
@@ -784,13 +708,23 @@ struct AnyElementProvider : public IRawElementProviderSimple, public IRawElement
     va_end(args);
   }
 
+  static void* operator new(size_t size) {
+    VERIFY(size == sizeof(AnyElementProvider));
+    return pool.allocate();
+  }
+  static void operator delete(void* p) { pool.deallocate(p); }
+  static SlabPool<AnyElementProvider> pool;
+
   ULONG reference_count = 1;
   UiTree::Id id = -1;
 };
 
+SlabPool<AnyElementProvider> AnyElementProvider::pool;
+
 
 HRESULT
 AnyElementProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("AnyElementProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IRawElementProviderSimple) return { "IRawElementProviderSimple", static_cast<IRawElementProviderSimple*>(this) };
@@ -806,25 +740,29 @@ AnyElementProvider::QueryInterface(REFIID riid, void** ppvObject) {
     result = { "IUnknown", this };
   }
 
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
+    log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
+  }
   if (!ppvObject) return E_POINTER;
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  log("  supported_interface %s\n", result.first);
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
 HRESULT
 AnyElementProvider::get_HostRawElementProvider(IRawElementProviderSimple** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::get_HostRawElementProvider");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-get_hostrawelementprovider)
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = nullptr;
@@ -833,14 +771,16 @@ AnyElementProvider::get_HostRawElementProvider(IRawElementProviderSimple** pRetV
 
 HRESULT
 AnyElementProvider::get_ProviderOptions(ProviderOptions* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::get_ProviderOptions");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-get_provideroptions)
   return ProviderOptions_ServerSideProvider | ProviderOptions_UseComThreading;
 }
 
 HRESULT
 AnyElementProvider::GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal) {
-  log("%s %d\n", __func__, patternId);
+  MEASURE_LATENCY("AnyElementProvider::GetPatternProvider");
+  LOG_TRACE(log_category, "%s %d\n", __func__, patternId);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-getpatternprovider)
   if (!pRetVal) return E_POINTER;
   *pRetVal = nullptr;
@@ -902,10 +842,10 @@ AnyElementProvider::GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal)
   }
 
   if (!*pRetVal) {
-    log("  %s pattern not supported.\n", pattern? pattern : "");
+    LOG_TRACE(log_category, "  %s pattern not supported.\n", pattern? pattern : "");
   }
   else {
-    log("  %s pattern supported.\n", pattern);
+    LOG_TRACE(log_category, "  %s pattern supported.\n", pattern);
   }
 
   return S_OK;
@@ -913,103 +853,69 @@ AnyElementProvider::GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal)
 
 HRESULT
 AnyElementProvider::GetPropertyValue(PROPERTYID propertyId, VARIANT* pRetVal) {
-  log("%s(%d)\n", __func__, propertyId);
+  MEASURE_LATENCY("AnyElementProvider::GetPropertyValue");
+  LOG_TRACE(log_category, "%s(%d)\n", __func__, propertyId);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementprovidersimple-getpropertyvalue)
   if (!pRetVal) return E_POINTER;
 
   pRetVal->vt = VT_EMPTY;
 
-  auto index = ui_get_index(this->id);
-  VERIFY(g_ui.node_type[index] != UiTree::Type::kNone);
-
-  auto type = g_ui.node_type[index];
-
   char const* propname = nullptr;
+  auto property = UiProperty(-1);
 
   switch (propertyId) {
-  case UIA_NamePropertyId: {
-    pRetVal->vt = VT_BSTR;
-    pRetVal->bstrVal = ::SysAllocString(g_ui.node_names[index].data());
-    propname = "Name";
-  } break;
-
-  case UIA_ControlTypePropertyId: {
-    pRetVal->vt = VT_I4;
-    switch (type) {
-    case UiTree::Type::kText: { pRetVal->lVal = UIA_TextControlTypeId; } break;
-    case UiTree::Type::kDocument: { pRetVal->lVal = UIA_DocumentControlTypeId; } break;
-    case UiTree::Type::kButton: { pRetVal->lVal = UIA_ButtonControlTypeId;  } break;
-    case UiTree::Type::kPane: { pRetVal->lVal = UIA_PaneControlTypeId; } break;
-    default: VERIFY(0); // Implement this missing type
-    }
-    propname = "ControlType";
-  } break;
-
-  case UIA_IsControlElementPropertyId: {
-    propname = "IsControlElement";
-    pRetVal->vt = VT_BOOL;
-    pRetVal->boolVal = VARIANT_TRUE;
-  } break;
-
-  case UIA_IsContentElementPropertyId: {
-    propname = "IsContentElement";
-    pRetVal->vt = VT_BOOL;
-    pRetVal->boolVal = VARIANT_TRUE;
-  } break;
-  case UIA_IsEnabledPropertyId: {
-    pRetVal->vt = VT_BOOL;
-    pRetVal->boolVal = VARIANT_TRUE;
-    propname = "IsEnabled";
-  } break;
-  case UIA_IsKeyboardFocusablePropertyId: {
-    pRetVal->vt = VT_BOOL;
-    pRetVal->boolVal = VARIANT_TRUE;
-    propname = "IsKeyboardFocusable";
-  } break;
-
-  case UIA_LabeledByPropertyId: {
-      if (type == UiTree::Type::kDocument) {
-          pRetVal->vt = VT_BSTR;
-          pRetVal->bstrVal = ::SysAllocString(g_ui.node_names[index].data());
-          propname = "LabeledBy";
-      }
-  } break;
-
-  case UIA_NativeWindowHandlePropertyId: {
-    propname = "NativeWindowHandle";
-    pRetVal->vt = VT_I4;
-    pRetVal->lVal = 0;
-  } break;
+  case UIA_NamePropertyId: { property = UiProperty::kName; propname = "Name"; } break;
+  case UIA_ControlTypePropertyId: { property = UiProperty::kControlType; propname = "ControlType"; } break;
+  case UIA_IsControlElementPropertyId: { property = UiProperty::kIsControlElement; propname = "IsControlElement"; } break;
+  case UIA_IsContentElementPropertyId: { property = UiProperty::kIsContentElement; propname = "IsContentElement"; } break;
+  case UIA_IsEnabledPropertyId: { property = UiProperty::kIsEnabled; propname = "IsEnabled"; } break;
+  case UIA_IsKeyboardFocusablePropertyId: { property = UiProperty::kIsKeyboardFocusable; propname = "IsKeyboardFocusable"; } break;
+  case UIA_LabeledByPropertyId: { property = UiProperty::kLabeledBy; propname = "LabeledBy"; } break;
+  case UIA_NativeWindowHandlePropertyId: { property = UiProperty::kNativeWindowHandle; propname = "NativeWindowHandle"; } break;
   case UIA_FrameworkIdPropertyId: { propname = "FrameworkId";  } break;
   case UIA_AutomationIdPropertyId: { propname = "AutomationId";  } break;
   case UIA_ProcessIdPropertyId: { propname = "ProcessId";  } break;
   case UIA_HelpTextPropertyId: { propname = "HelpText";  } break;
   case UIA_AccessKeyPropertyId: { propname = "AccessKey"; } break;
-
-  case UIA_ProviderDescriptionPropertyId: {
-    pRetVal->vt = VT_BSTR;
-    pRetVal->bstrVal = ::SysAllocString(L"UU::RootProvider");
-    propname = "ProviderDescription";
-  } break;
-  case UIA_ClassNamePropertyId: {
-    pRetVal->vt = VT_BSTR;
-    pRetVal->bstrVal = ::SysAllocString(L"UU::RootProvider");
-    propname = "ClassNameDescription";
-  } break;
-
-  case UIA_HasKeyboardFocusPropertyId: {
-    pRetVal->vt = VT_BOOL;
-    pRetVal->boolVal = g_ui.focused_id == this->id ? VARIANT_TRUE : VARIANT_FALSE;
-    propname = "HasKeyboardFocus";
-  } break;
-
+  case UIA_ProviderDescriptionPropertyId: { property = UiProperty::kProviderDescription; propname = "ProviderDescription"; } break;
+  case UIA_ClassNamePropertyId: { property = UiProperty::kClassName; propname = "ClassNameDescription"; } break;
+  case UIA_HasKeyboardFocusPropertyId: { property = UiProperty::kHasKeyboardFocus; propname = "HasKeyboardFocus"; } break;
+  }
+
+  if (property != UiProperty(-1)) {
+    auto value = ui_get_property(this->id, property);
+    switch (value.kind) {
+    case UiPropertyValue::Kind::kEmpty: break;
+    case UiPropertyValue::Kind::kString: {
+      pRetVal->vt = VT_BSTR;
+      pRetVal->bstrVal = ::SysAllocStringLen(value.string.data(), UINT(value.string.size()));
+    } break;
+    case UiPropertyValue::Kind::kType: {
+      pRetVal->vt = VT_I4;
+      switch (value.type) {
+      case UiTree::Type::kText: { pRetVal->lVal = UIA_TextControlTypeId; } break;
+      case UiTree::Type::kDocument: { pRetVal->lVal = UIA_DocumentControlTypeId; } break;
+      case UiTree::Type::kButton: { pRetVal->lVal = UIA_ButtonControlTypeId;  } break;
+      case UiTree::Type::kPane: { pRetVal->lVal = UIA_PaneControlTypeId; } break;
+      default: VERIFY(0); // Implement this missing type
+      }
+    } break;
+    case UiPropertyValue::Kind::kBool: {
+      pRetVal->vt = VT_BOOL;
+      pRetVal->boolVal = value.boolean ? VARIANT_TRUE : VARIANT_FALSE;
+    } break;
+    case UiPropertyValue::Kind::kInt: {
+      pRetVal->vt = VT_I4;
+      pRetVal->lVal = value.integer;
+    } break;
+    }
   }
 
   if (pRetVal->vt != VT_EMPTY) {
-    log("  supported_property %s\n", propname);
+    LOG_TRACE(log_category, "  supported_property %s\n", propname);
   }
   else {
-    if (propname) { log("  unsupported_property %s\n", propname); }
+    if (propname) { LOG_TRACE(log_category, "  unsupported_property %s\n", propname); }
   }
   
   return S_OK;
@@ -1017,11 +923,12 @@ AnyElementProvider::GetPropertyValue(PROPERTYID propertyId, VARIANT* pRetVal) {
 
 HRESULT
 AnyElementProvider::get_BoundingRectangle(UiaRect* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::get_BoundingRectangle");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-get_boundingrectangle)
   if (!pRetVal) return E_INVALIDARG;
 
-  RECT ClientRect = g_ui.node_rect[ui_get_index(this->id)];
+  RECT ClientRect = win32_rect(ui_get_bounding_rectangle(this->id));
   POINT LeftTop = { .x = ClientRect.left, .y = ClientRect.top };
   VERIFY(::ClientToScreen(g_hwnd, &LeftTop));
   pRetVal->left = double(LeftTop.x);
@@ -1033,7 +940,8 @@ AnyElementProvider::get_BoundingRectangle(UiaRect* pRetVal) {
 
 HRESULT
 AnyElementProvider::get_FragmentRoot(IRawElementProviderFragmentRoot** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::get_FragmentRoot");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-get_fragmentroot)
   if (!pRetVal) return E_INVALIDARG;
   g_root_provider->AddRef();
@@ -1043,7 +951,8 @@ AnyElementProvider::get_FragmentRoot(IRawElementProviderFragmentRoot** pRetVal)
 
 HRESULT
 AnyElementProvider::GetEmbeddedFragmentRoots(SAFEARRAY** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::GetEmbeddedFragmentRoots");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-getembeddedfragmentroots)
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = nullptr;
@@ -1052,14 +961,15 @@ AnyElementProvider::GetEmbeddedFragmentRoots(SAFEARRAY** pRetVal) {
 
 HRESULT
 AnyElementProvider::GetRuntimeId(SAFEARRAY** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::GetRuntimeId");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-getruntimeid)
   if (!pRetVal) return E_INVALIDARG;
 
   LONG ids[] = { UiaAppendRuntimeId, LONG(bits(this->id, 0, 32)) };
   auto num_ids = sizeof ids / sizeof ids[0];
 
-  log("  id: UiAppendRuntimeId.%#llx\n", int(ids[1]));
+  LOG_TRACE(log_category, "  id: UiAppendRuntimeId.%#llx\n", int(ids[1]));
 
   SAFEARRAY* psa = ::SafeArrayCreateVector(VT_I4, 0, LONG(num_ids));
   if (psa == NULL) {
@@ -1077,72 +987,25 @@ AnyElementProvider::GetRuntimeId(SAFEARRAY** pRetVal) {
 
 HRESULT
 AnyElementProvider::Navigate(NavigateDirection direction, IRawElementProviderFragment** pRetVal) {
-  log("%s %d\n", __func__, direction);
+  MEASURE_LATENCY("AnyElementProvider::Navigate");
+  LOG_TRACE(log_category, "%s %d\n", __func__, direction);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-navigate)
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = nullptr;
 
-  UiTree::Id element_id = -1;
-
-  auto index = ui_get_index(this->id);
-  auto this_depth = g_ui.node_depth[index];
-  auto this_parent = g_ui.node_parent[index];
-  auto navtype = "unknown";
+  char const* navtype = nullptr;
+  auto ui_direction = UiNavigateDirection::kParent;
   switch (direction) {
-  case NavigateDirection_Parent: {
-      navtype = "parent";
-      element_id = g_ui.node_parent[index];
-      VERIFY(element_id == this_parent);
-  } break;
-  case NavigateDirection_NextSibling: {
-    navtype = "next-sibling";
-    for (auto i = index + 1; i < g_ui.node_ids.size() && g_ui.node_depth[i] >= this_depth; i++) {
-      if (g_ui.node_depth[i] == this_depth) {
-        index = i;
-        break;
-      }
-    }
-    element_id = g_ui.node_ids[index];
-    VERIFY(element_id == this->id || g_ui.node_parent[index] == this_parent);
-  } break;
-  case NavigateDirection_PreviousSibling: { 
-    navtype = "prev-sibling";
-    for (auto ri = index; ri > 0 && g_ui.node_depth[ri-1] >= this_depth; ri--) {
-      auto i = ri - 1;
-      if (g_ui.node_depth[i] == this_depth) {
-        index = i;
-        break;
-      }
-    }
-    element_id = g_ui.node_ids[index];
-    VERIFY(element_id == this->id || g_ui.node_parent[index] == this_parent);
-  } break;
-  case NavigateDirection_FirstChild: {
-      navtype = "first-child";
-      for (auto i = index + 1; i < g_ui.node_ids.size() && g_ui.node_depth[i] >= this_depth + 1; i++) {
-        if (g_ui.node_depth[i] == this_depth + 1) {
-          index = i;
-          VERIFY(g_ui.node_parent[index] == this->id);
-          break;
-        }
-      }
-      element_id = g_ui.node_ids[index];
-      VERIFY(element_id == this->id || g_ui.node_parent[index] == this->id);
-  } break;
-  case NavigateDirection_LastChild: {
-      navtype = "last-child";
-      for (auto i = index + 1; i < g_ui.node_ids.size() && g_ui.node_depth[i] >= this_depth + 1; i++) {
-        if (g_ui.node_depth[i] == this_depth + 1) {
-          index = i;
-          VERIFY(g_ui.node_parent[index] == this->id);
-        }
-      }
-      element_id = g_ui.node_ids[index];
-      VERIFY(element_id == this->id || g_ui.node_parent[index] == this->id);
-  } break;
+  case NavigateDirection_Parent: { navtype = "parent"; ui_direction = UiNavigateDirection::kParent; } break;
+  case NavigateDirection_NextSibling: { navtype = "next-sibling"; ui_direction = UiNavigateDirection::kNextSibling; } break;
+  case NavigateDirection_PreviousSibling: { navtype = "prev-sibling"; ui_direction = UiNavigateDirection::kPrevSibling; } break;
+  case NavigateDirection_FirstChild: { navtype = "first-child"; ui_direction = UiNavigateDirection::kFirstChild; } break;
+  case NavigateDirection_LastChild: { navtype = "last-child"; ui_direction = UiNavigateDirection::kLastChild; } break;
+  default: return S_OK; // no such element.
   }
+  auto element_id = ui_navigate(this->id, ui_direction);
 
-  log("  Navigating (%s) from element %#llx to %#llx\n", navtype, this->id, element_id);
+  LOG_TRACE(log_category, "  Navigating (%s) from element %#llx to %#llx\n", navtype, this->id, element_id);
 
   if (element_id == 0) {
     g_root_provider->AddRef();
@@ -1156,7 +1019,8 @@ AnyElementProvider::Navigate(NavigateDirection direction, IRawElementProviderFra
 
 HRESULT
 AnyElementProvider::SetFocus() {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementProvider::SetFocus");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-irawelementproviderfragment-setfocus)
   ui_set_focus_to(this->id);
   return S_OK;
@@ -1185,6 +1049,7 @@ struct AnyElementValueProvider : public IValueProvider {
   }
   HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
 
+  static constexpr LogCategory log_category = LogCategory_Providers;
   void log(char const* fmt, ...) {
     ::log("this(%p, id=%#llx) AnyElementValueProvider::", this, this->id);
     std::va_list args;
@@ -1199,8 +1064,9 @@ struct AnyElementValueProvider : public IValueProvider {
 
 HRESULT
 AnyElementValueProvider::get_IsReadOnly(BOOL* pRetVal) {
+  MEASURE_LATENCY("AnyElementValueProvider::get_IsReadOnly");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-ivalueprovider-get_isreadonly)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
   *pRetVal = TRUE;
   return S_OK;
@@ -1208,22 +1074,26 @@ AnyElementValueProvider::get_IsReadOnly(BOOL* pRetVal) {
 
 HRESULT
 AnyElementValueProvider::get_Value(BSTR* pRetVal) {
+  MEASURE_LATENCY("AnyElementValueProvider::get_Value");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-ivalueprovider-get_value)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
-  *pRetVal = ::SysAllocString(g_ui.node_names[ui_get_index(this->id)].data());
+  auto name = ui_node_name(ui_get_index(this->id));
+  *pRetVal = ::SysAllocStringLen(name.data(), UINT(name.size()));
   return S_OK;
 }
 
 HRESULT
 AnyElementValueProvider::SetValue(LPCWSTR val) {
+  MEASURE_LATENCY("AnyElementValueProvider::SetValue");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-ivalueprovider-setvalue)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   return E_ACCESSDENIED;
 }
 
 HRESULT
 AnyElementValueProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("AnyElementValueProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IValueProvider) return { "IValueProvider", static_cast<IValueProvider*>(this) };
@@ -1235,19 +1105,22 @@ AnyElementValueProvider::QueryInterface(REFIID riid, void** ppvObject) {
     result = { "IUnknown", this };
   }
 
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
+    log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
+  }
   if (!ppvObject) return E_POINTER;
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  log("  supported_interface %s\n", result.first);
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
@@ -1276,6 +1149,7 @@ struct AnyElementTextProvider : public ITextProvider {
   }
   HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
 
+  static constexpr LogCategory log_category = LogCategory_TextRanges;
   void log(char const* fmt, ...) {
     ::log("this(%p, id=%#llx) AnyElementTextProvider::", this, this->id);
     std::va_list args;
@@ -1290,6 +1164,7 @@ struct AnyElementTextProvider : public ITextProvider {
 
 HRESULT 
 AnyElementTextProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("AnyElementTextProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IValueProvider) return { "ITextProvider", (ITextProvider*)this };
@@ -1301,42 +1176,46 @@ AnyElementTextProvider::QueryInterface(REFIID riid, void** ppvObject) {
     result = { "IUnknown", this };
   }
 
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
+    log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
+  }
   if (!ppvObject) return E_POINTER;
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  log("  supported_interface %s\n", result.first);
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
 HRESULT
 AnyElementTextProvider::get_DocumentRange(ITextRangeProvider** pRetVal) {
+  MEASURE_LATENCY("AnyElementTextProvider::get_DocumentRange");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextprovider-get_documentrange)
-  log("%s (unsupported)\n", __func__);
+  LOG_TRACE(log_category, "%s (unsupported)\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
 
   *pRetVal = nullptr;
 
-  auto this_index = ui_get_index(this->id);
-  auto type = g_ui.node_type[this_index];
-  if (type == UiTree::Type::kDocument) {
-    *pRetVal = create_text_range({ .id = this->id, .offset = 0 }, { .id = this->id, .offset = static_cast<int>(g_ui.node_text_len[this_index]) });
+  TextRange range;
+  if (ui_get_document_range(this->id, &range)) {
+    *pRetVal = create_text_range(range.start, range.end);
   }
   return S_OK;
 }
 
 HRESULT 
 AnyElementTextProvider::get_SupportedTextSelection(SupportedTextSelection* pRetVal) {
+  MEASURE_LATENCY("AnyElementTextProvider::get_SupportedTextSelection");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextprovider-get_supportedtextselection)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
 
   *pRetVal = SupportedTextSelection_None;
@@ -1345,8 +1224,9 @@ AnyElementTextProvider::get_SupportedTextSelection(SupportedTextSelection* pRetV
 
 HRESULT
 AnyElementTextProvider::GetSelection(SAFEARRAY** pRetVal) {
+  MEASURE_LATENCY("AnyElementTextProvider::GetSelection");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextprovider-getselection)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
 
   *pRetVal = nullptr;
@@ -1355,8 +1235,9 @@ AnyElementTextProvider::GetSelection(SAFEARRAY** pRetVal) {
 
 HRESULT
 AnyElementTextProvider::GetVisibleRanges(SAFEARRAY** pRetVal) {
+  MEASURE_LATENCY("AnyElementTextProvider::GetVisibleRanges");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextprovider-getvisibleranges)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
 
   // TODO(nil): we need to provide ranges here, which is possible once we implement a ITextRangeProvider.
@@ -1368,24 +1249,26 @@ AnyElementTextProvider::GetVisibleRanges(SAFEARRAY** pRetVal) {
 
 HRESULT
 AnyElementTextProvider::RangeFromChild(IRawElementProviderSimple* childElement, ITextRangeProvider** pRetVal) {
+  MEASURE_LATENCY("AnyElementTextProvider::RangeFromChild");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextprovider-rangefromchild)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!childElement) return E_INVALIDARG;
   if (!pRetVal) return E_INVALIDARG;
 
   auto p = dynamic_cast<AnyElementProvider*>(childElement); // NOTE(nil): this requires RTTI. We can avoid that by using QueryInterface, most likely.
-  log("  id=%#llx\n", p->id);
+  LOG_TRACE(log_category, "  id=%#llx\n", p->id);
   *pRetVal = nullptr;
   return E_NOTIMPL;
 }
 
 HRESULT
 AnyElementTextProvider::RangeFromPoint(UiaPoint point, ITextRangeProvider** pRetVal) {
+  MEASURE_LATENCY("AnyElementTextProvider::RangeFromPoint");
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextprovider-rangefrompoint)
-  log("%s\n", __func__);
+  LOG_TRACE(log_category, "%s\n", __func__);
   if (!pRetVal) return E_INVALIDARG;
 
-  log("  {%f %f}\n", point.x, point.y);
+  LOG_TRACE(log_category, "  {%f %f}\n", point.x, point.y);
   *pRetVal = nullptr;
   return E_NOTIMPL;
 }
@@ -1426,107 +1309,94 @@ struct AnyElementTextRangeProvider : public ITextRangeProvider {
   }
   HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
 
+  static constexpr LogCategory log_category = LogCategory_TextRanges;
   void log(char const* fmt, ...) {
-    ::log("this(%p, start_id=%#llx, start_offset=%d, end_id=%#llx, end_offset=%d) AnyElementTextRangeProvider::", this, this->start.id, this->start.offset, this->end.id, this->end.offset);
+    ::log("this(%p, start_id=%#llx, start_offset=%d, end_id=%#llx, end_offset=%d) AnyElementTextRangeProvider::", this, this->range.start.id, this->range.start.offset, this->range.end.id, this->range.end.offset);
     std::va_list args;
     va_start(args, fmt);
     ::logv(fmt, args);
     va_end(args);
   }
 
+  TextPoint& get_endpoint(TextPatternRangeEndpoint kind) {
+    return kind == TextPatternRangeEndpoint_Start ? this->range.start : this->range.end;
+  }
+
   ULONG reference_count = 1;
 
-  TextPoint start;
-  TextPoint end;
+  TextRange range;
 };
 
 ITextRangeProvider*
 create_text_range(TextPoint start, TextPoint end) {
   auto p = new AnyElementTextRangeProvider;
-  p->start = start;
-  p->end = end;
+  p->range = { start, end };
 
   return p;
 }
 
 HRESULT
 AnyElementTextRangeProvider::AddToSelection() {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::AddToSelection");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-addtoselection)
   return E_UNEXPECTED;
 }
 
 HRESULT
 AnyElementTextRangeProvider::Clone(ITextRangeProvider** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::Clone");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-clone)
   if (!pRetVal) return E_POINTER;
 
-  *pRetVal = create_text_range(this->start, this->end);
+  *pRetVal = create_text_range(this->range.start, this->range.end);
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::Compare(ITextRangeProvider* range, BOOL* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::Compare");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-compare)
   if (!pRetVal) return E_POINTER;
   if (!range) return E_POINTER;
   auto other = dynamic_cast<AnyElementTextRangeProvider*>(range);
-  *pRetVal = other->start == this->start && other->end == this->end;
+  if (!other) return E_INVALIDARG;
+  *pRetVal = other->range.start == this->range.start && other->range.end == this->range.end;
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::CompareEndpoints(TextPatternRangeEndpoint endpoint, ITextRangeProvider* targetRange, TextPatternRangeEndpoint targetEndpoint, int* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::CompareEndpoints");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-compareendpoints)
   if (!targetRange) return E_POINTER;
   if (!pRetVal) return E_POINTER;
   auto other = dynamic_cast<AnyElementTextRangeProvider*>(targetRange);
+  if (!other) return E_INVALIDARG;
 
-  const auto get_endpoint = [](AnyElementTextRangeProvider* range, TextPatternRangeEndpoint kind) -> TextPoint {
-    switch (kind) {
-    case TextPatternRangeEndpoint_Start: return range->start;
-    case TextPatternRangeEndpoint_End: return range->end;
-    }
-    return {.id=0, .offset=0};
-  };
-
-  auto compare_result = get_endpoint(this, endpoint) <=> get_endpoint(other, targetEndpoint);
-  *pRetVal = 0;
-
-  if (compare_result == std::strong_ordering::less) {
-    *pRetVal = -1;
-  }
-  else if (compare_result == std::strong_ordering::equal) {
-    *pRetVal = 0;
-  }
-  else if (compare_result == std::strong_ordering::greater) {
-    *pRetVal = +1;
-  }
+  auto a = ui_text_offset(this->get_endpoint(endpoint));
+  auto b = ui_text_offset(other->get_endpoint(targetEndpoint));
+  *pRetVal = a < b ? -1 : (a > b ? +1 : 0);
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::ExpandToEnclosingUnit(TextUnit unit) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::ExpandToEnclosingUnit");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-expandtoenclosingunit)
 
-  // TODO(nil): implement this..
-
-  // We'll implement a simpler version of this, by letting it expand it always to the full element..
-  auto new_start = TextPoint{ .id = this->start.id, .offset = 0 };
-  auto new_end = TextPoint{ .id = this->end.id, .offset = static_cast<int>(g_ui.node_names[ui_get_index(this->end.id)].size()) };
-
-  this->start = new_start;
-  this->end = new_end;
+  ui_text_range_expand_to_enclosing_unit(this->range, UiTextUnit(unit));
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::FindAttribute(TEXTATTRIBUTEID attributeId, VARIANT val, BOOL backward, ITextRangeProvider** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::FindAttribute");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-findattribute)
 
   // TODO(nil): we don't have attributes, so we're not implementing this yet.
@@ -1536,56 +1406,25 @@ AnyElementTextRangeProvider::FindAttribute(TEXTATTRIBUTEID attributeId, VARIANT
 
 HRESULT
 AnyElementTextRangeProvider::FindText(BSTR text, BOOL backward, BOOL ignoreCase, ITextRangeProvider** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::FindText");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-findtext)
   if (!pRetVal) return E_POINTER;
   if (!text) return E_POINTER;
-  if (backward) return E_NOTIMPL; // TODO(nil): implement backward search
-  if (ignoreCase) return E_NOTIMPL; // TODO(nil): implement ignoreCase
-
-  std::wstring search_text = text;
 
   *pRetVal = nullptr;
 
-  auto id = this->start.id;
-  auto offset = this->start.offset;
-
-  auto end_id = this->end.id;
-  auto end_offset = this->end.offset;
-
-  bool reached_end = false;
-  bool found_match = false;
-
-  for (; !reached_end && !found_match;) {
-    auto i = ui_get_index(id);
-    auto pos = g_ui.node_names[i].find(search_text, offset); // this algorithm does not find text that crosses elements.
-
-    if (id == end_id) {
-      reached_end = pos == std::wstring::npos || (pos + search_text.size()) >= end_offset;
-    }
-
-    if (pos != std::wstring::npos && !reached_end) {
-      auto m_start = TextPoint{ .id = id, .offset = static_cast<int>(pos) };
-      auto m_end = TextPoint{ .id = id, .offset = static_cast<int>(pos + search_text.size()) };
-      *pRetVal = create_text_range(m_start, m_end);
-      found_match = true;
-    }
-
-    if (i + 1 < g_ui.node_ids.size()) {
-      id = g_ui.node_ids[i + 1];
-      offset = 0;
-    }
-    else {
-      reached_end = true;
-    }
+  TextRange found;
+  if (ui_text_range_find(this->range, { text, SysStringLen(text) }, backward, ignoreCase, &found)) {
+    *pRetVal = create_text_range(found.start, found.end);
   }
-
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::GetAttributeValue(TEXTATTRIBUTEID attributeId, VARIANT* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::GetAttributeValue");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-getattributevalue)
   // TODO(nil): we don't have attributes yet.
   return E_NOTIMPL;
@@ -1593,7 +1432,8 @@ AnyElementTextRangeProvider::GetAttributeValue(TEXTATTRIBUTEID attributeId, VARI
 
 HRESULT
 AnyElementTextRangeProvider::GetBoundingRectangles(SAFEARRAY** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::GetBoundingRectangles");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-getboundingrectangles)
 
   // @TAG(Copypasta)
@@ -1603,17 +1443,17 @@ AnyElementTextRangeProvider::GetBoundingRectangles(SAFEARRAY** pRetVal) {
   VERIFY(::ClientToScreen(g_hwnd, &LeftTop));
 
   std::vector<RECT> rects;
-  auto id = this->start.id;
+  auto id = this->range.start.id;
   auto reached_end = false;
   for (; !reached_end;) {
     auto i = ui_get_index(id);
     // TODO(nil): what should happen when the node encloses others? It can't be a line then, and probably should be skipped?
-    auto r = intersection(g_ui.node_rect[i], ClientRect);
+    auto r = intersection(win32_rect(g_ui.node_rect[i]), ClientRect);
     if (r.left <= r.right && r.top <= r.bottom) {
       rects.push_back(r + LeftTop);
     }
     
-    if (id == this->end.id) {
+    if (id == this->range.end.id) {
       reached_end = true;
     }
 
@@ -1645,14 +1485,15 @@ AnyElementTextRangeProvider::GetBoundingRectangles(SAFEARRAY** pRetVal) {
 
 HRESULT
 AnyElementTextRangeProvider::GetChildren(SAFEARRAY** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::GetChildren");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-getchildren)
 
   std::vector<IRawElementProviderSimple*> children;
 
   bool reached_end = false;
-  auto id = this->start.id;
-  auto offset = this->start.offset;
+  auto id = this->range.start.id;
+  auto offset = this->range.start.offset;
   for (; !reached_end;) {
     // NOTE(nil): this loop (and many of the other ones) have to be updated as soon as there are non textual elements in the loop, which have to be skipped.
     auto i = ui_get_index(id);
@@ -1661,7 +1502,7 @@ AnyElementTextRangeProvider::GetChildren(SAFEARRAY** pRetVal) {
       children.push_back(sp);
     }
 
-    if (id == this->end.id) {
+    if (id == this->range.end.id) {
       reached_end = true;
     } else if (i + 1 >= g_ui.node_ids.size()) {
       reached_end = true;
@@ -1686,75 +1527,36 @@ AnyElementTextRangeProvider::GetChildren(SAFEARRAY** pRetVal) {
 
 HRESULT
 AnyElementTextRangeProvider::GetEnclosingElement(IRawElementProviderSimple** pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::GetEnclosingElement");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-getenclosingelement)
   if (!pRetVal) return E_POINTER;
-  if (this->start.id == this->end.id) {
-    *pRetVal = create_simple_element_provider(this->start.id);
+
+  auto index = ui_text_range_enclosing_index(this->range);
+  if (index == size_t(-1)) {
+    // the range spans several top-level elements, so it's enclosed by the root.
+    g_root_provider->AddRef();
+    *pRetVal = static_cast<IRawElementProviderSimple*>(g_root_provider);
     return S_OK;
   }
 
-  auto start_id = this->start.id;
-  auto end_id = this->end.id;
-
-  auto i = ui_get_index(start_id);
-  auto j = ui_get_index(end_id);
-  
-  while (g_ui.node_depth[i] < g_ui.node_depth[j]) {
-    i = ui_get_parent_index(start_id);
-    start_id = g_ui.node_ids[i];
-  }
-  while (g_ui.node_depth[j] < g_ui.node_depth[i]) {
-    j = ui_get_parent_index(end_id);
-    end_id = g_ui.node_ids[j];
-  }
-  VERIFY(g_ui.node_depth[i] == g_ui.node_depth[j]);
-  while (start_id != end_id) {
-    i = ui_get_parent_index(start_id);
-    start_id = g_ui.node_ids[i];
-    j = ui_get_parent_index(end_id);
-    end_id = g_ui.node_ids[j];
-  }
-  auto enclosing_id = start_id;
-  VERIFY(ui_is_ancestor(enclosing_id, this->start.id));
-  VERIFY(ui_is_ancestor(enclosing_id, this->end.id));
-
-  *pRetVal = create_simple_element_provider(enclosing_id);
+  *pRetVal = create_simple_element_provider(g_ui.node_ids[index]);
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::GetText(int maxLength, BSTR* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::GetText");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-gettext)
   if (!pRetVal) return E_POINTER;
 
   *pRetVal = nullptr;
 
-  std::wstring text;
-  auto reached_end = false;
-  auto id = this->start.id;
-  auto offset = this->start.offset;
-  for (; !reached_end;) {
-    auto i = ui_get_index(id);
-    auto len = id == this->end.id ? this->end.offset - offset : g_ui.node_names[i].size();
-    text.append(g_ui.node_names[i], offset, len);
-    if (id == this->end.id) {
-      reached_end = true;
-    }
-    else if (i + 1 >= g_ui.node_ids.size()) {
-      reached_end = true;
-    }
-    else {
-      id = g_ui.node_ids[i + 1];
-      offset = 0;
-    }
-  }
-
-  auto normalized_max_len = maxLength < 0 ? text.size() : maxLength;
-
-  auto str = ::SysAllocStringLen(text.data(), std::min(text.size(), normalized_max_len));
+  auto len = ui_text_range_get_text_len(this->range, maxLength);
+  auto str = ::SysAllocStringLen(nullptr, UINT(len));
   if (!str) return E_OUTOFMEMORY;
+  ui_text_range_copy(this->range, len, str);
 
   *pRetVal = str;
   return S_OK;
@@ -1762,139 +1564,72 @@ AnyElementTextRangeProvider::GetText(int maxLength, BSTR* pRetVal) {
 
 HRESULT
 AnyElementTextRangeProvider::Move(TextUnit unit, int count, int* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::Move");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-move)
 
   if (!pRetVal) return E_POINTER;
+  *pRetVal = 0;
 
-  if (this->start == this->end) return S_OK;
-  
-  // For a non-degenerate (non-empty) text range, ITextRangeProvider::Move should normalize and move the text range by performing the following steps.
-  // 
-  // 1. Collapse the text range to a degenerate(empty) range at the starting endpoint.
-  auto this_id = this->start.id;
-  auto this_offset = this->start.offset;
-
-  // 2. If necessary, move the resulting text range backward in the document to the beginning of the requested unit boundary.
-  switch (unit) {
-  case TextUnit_Document: {
-    auto id = this_id;
-    auto index = ui_get_index(id);
-    while (id && g_ui.node_type[index] != UiTree::Type::kDocument) {
-      id = g_ui.node_parent[index];
-      index = ui_get_index(id);
-    }
-    if (id) {
-      this_id = id;
-      this_offset = 0;
-    }
-  } break;
-  case TextUnit_Page: break; // we don't have pages.
-  case TextUnit_Paragraph: {
-    auto id = this_id;
-    auto index = ui_get_index(id);
-    while (id && g_ui.node_type[index] != UiTree::Type::kText) {
-      id = g_ui.node_parent[index];
-      index = ui_get_index(id);
-    }
-    if (id) {
-      this_id = id;
-      this_offset = 0;
-    }
-  } break;
-  case TextUnit_Line: return E_NOTIMPL; // we don't have lines.
-  case TextUnit_Word: return E_NOTIMPL; // we don't have words.
-  case TextUnit_Character: return E_NOTIMPL; // we have characters, and that's all we have.
-  case TextUnit_Format: return E_NOTIMPL; // we don't have format/attributes.
-  }
-
-  // 3. Move the text range forward or backward in the document by the requested number of text unit boundaries.
-  struct AdvanceResult {
-    UiTree::Id new_id;
-    int steps_taken;
-  };
-
-  const auto advance_by_type = [](UiTree::Id id, int signed_count, UiTree::Type type) -> AdvanceResult {
-    auto index = ui_get_index(id);
-    VERIFY(g_ui.node_type[index] == type);
-    auto num_steps = abs(signed_count);
-    auto iinc = signed_count / num_steps;
-    auto steps = 0;
-    auto i = std::ptrdiff_t(index);
-    while (0 <= i && i < g_ui.node_ids.size() && steps < num_steps) {
-      if (g_ui.node_type[i] == type) {
-        id = g_ui.node_ids[i];
-        steps++;
-      }
-      i += iinc;
-    }
-    return { .new_id = id, .steps_taken = iinc * steps };
-  };
-
-  auto advance = AdvanceResult{ .new_id = this_id, .steps_taken = 0 };
-
-  switch (unit) {
-  case TextUnit_Document: {
-    advance = advance_by_type(this_id, count, UiTree::Type::kDocument);
-  } break;
-  case TextUnit_Page: break; // we don't have pages.
-  case TextUnit_Paragraph: {
-    advance = advance_by_type(this_id, count, UiTree::Type::kText);
-  } break;
-  case TextUnit_Line: return E_NOTIMPL; // we don't have lines.
-  case TextUnit_Word: return E_NOTIMPL; // we don't have words.
-  case TextUnit_Character: return E_NOTIMPL; // we have characters, and that's all we have.
-  case TextUnit_Format: return E_NOTIMPL; // we don't have format/attributes.
-  }
-
-  // 4. Expand the text range from the degenerate state by moving the ending endpoint forward by one requested text unit boundary.
-  auto new_start = TextPoint{ .id = advance.new_id, .offset = 0 };
-
-  // NOTE(nil): For now we'll pretend that our resolution is exactly one element, so we go until the end of that element.
-  auto new_end = TextPoint{ .id = new_start.id, .offset = static_cast<int>(g_ui.node_text_len[ui_get_index(new_start.id)]) };
-
-  this->start = new_start;
-  this->end = new_end;
+  if (!ui_text_range_move(this->range, UiTextUnit(unit), count, pRetVal)) return E_NOTIMPL;
   return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::MoveEndpointByRange(TextPatternRangeEndpoint endpoint, ITextRangeProvider* targetRange, TextPatternRangeEndpoint targetEndpoint) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::MoveEndpointByRange");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-moveendpointbyrange)
-  return E_NOTIMPL;
+  if (!targetRange) return E_POINTER;
+  auto other = dynamic_cast<AnyElementTextRangeProvider*>(targetRange);
+  if (!other) return E_INVALIDARG;
+
+  auto point = other->get_endpoint(targetEndpoint);
+  ui_text_range_move_endpoint_by_range(this->range, endpoint == TextPatternRangeEndpoint_Start, point);
+  return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::MoveEndpointByUnit(TextPatternRangeEndpoint endpoint, TextUnit unit, int count, int* pRetVal) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::MoveEndpointByUnit");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-moveendpointbyunit)
-  return E_NOTIMPL;
+
+  if (!pRetVal) return E_POINTER;
+  *pRetVal = 0;
+  if (unit < TextUnit_Character || unit > TextUnit_Document) return E_INVALIDARG;
+
+  ui_text_range_move_endpoint_by_unit(this->range, endpoint == TextPatternRangeEndpoint_Start, UiTextUnit(unit), count, pRetVal);
+  return S_OK;
 }
 
 HRESULT
 AnyElementTextRangeProvider::RemoveFromSelection() {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::RemoveFromSelection");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-removefromselection)
   return E_NOTIMPL;
 }
 
 HRESULT
 AnyElementTextRangeProvider::ScrollIntoView(BOOL alignToTop) {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::ScrollIntoView");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-scrollintoview)
   return E_NOTIMPL;
 }
 
 HRESULT
 AnyElementTextRangeProvider::Select() {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementTextRangeProvider::Select");
+  LOG_TRACE(log_category, "%s\n", __func__);
   // URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/nf-uiautomationcore-itextrangeprovider-select)
   return E_NOTIMPL;
 }
 
 HRESULT
 AnyElementTextRangeProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("AnyElementTextRangeProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_ITextRangeProvider) return { "ITextRangeProvider", static_cast<ITextRangeProvider*>(this) };
@@ -1906,19 +1641,22 @@ AnyElementTextRangeProvider::QueryInterface(REFIID riid, void** ppvObject) {
     result = { "IUnknown", this };
   }
 
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
+    log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
+  }
   if (!ppvObject) return E_POINTER;
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  log("  supported_interface %s\n", result.first);
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
@@ -1940,6 +1678,7 @@ struct AnyElementInvokeProvider : public IInvokeProvider {
   }
   HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
 
+  static constexpr LogCategory log_category = LogCategory_Providers;
   void log(char const* fmt, ...) {
     ::log("this(%p, id=%#llx) AnyElementInvokeProvider::", this, this->id);
     std::va_list args;
@@ -1954,13 +1693,15 @@ struct AnyElementInvokeProvider : public IInvokeProvider {
 
 HRESULT 
 AnyElementInvokeProvider::Invoke() {
-  log("%s\n", __func__);
+  MEASURE_LATENCY("AnyElementInvokeProvider::Invoke");
+  LOG_TRACE(log_category, "%s\n", __func__);
   VERIFY(ui_activate(this->id));
   return S_OK;
 }
 
 HRESULT
 AnyElementInvokeProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("AnyElementInvokeProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IInvokeProvider) return { "IInvokeProvider", static_cast<IInvokeProvider*>(this) };
@@ -1972,19 +1713,22 @@ AnyElementInvokeProvider::QueryInterface(REFIID riid, void** ppvObject) {
     result = { "IUnknown", this };
   }
 
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
+    log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
+  }
   if (!ppvObject) return E_POINTER;
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  log("  supported_interface %s\n", result.first);
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
@@ -1992,14 +1736,14 @@ IRawElementProviderFragment*
 create_element_provider(UiTree::Id element_id) {
   VERIFY(exists_id(element_id));
 
-  auto& cache = g_ui.providers;
+  auto& cache = g_providers;
   auto ep = cache.find(element_id);
   if (ep != cache.end()) {
     ep->second->AddRef();
     return ep->second;
   }
 
-  auto p = new AnyElementProvider;
+  auto p = new AnyElementProvider; // the reference held by the cache.
   p->id = element_id;
   cache[p->id] = p;
   cache[p->id]->AddRef();
@@ -2009,7 +1753,7 @@ create_element_provider(UiTree::Id element_id) {
 
 IRawElementProviderSimple*
 create_simple_element_provider(UiTree::Id element_id) {
-  auto p = create_element_provider(g_ui.focused_id);
+  auto p = create_element_provider(element_id);
   IRawElementProviderSimple* sp;
   VERIFYHR(p->QueryInterface<IRawElementProviderSimple>(&sp));
   p->Release();
@@ -2045,110 +1789,46 @@ create_element_invoke_provider(UiTree::Id element_id) {
   return p;
 }
 
-size_t
-ui_get_parent_index(UiTree::Id id) {
-  auto index = ui_get_index(id);
-  auto parent_id = g_ui.node_parent[index];
-  return ui_get_index(parent_id);
-}
-
-bool
-ui_is_ancestor(UiTree::Id candidate_ancestor_id, UiTree::Id of_id) {
-  auto id = of_id;
-
-  while (id != 0) {
-    auto index = ui_get_index(id);
-    auto parent_id = g_ui.node_parent[index];
-    if (parent_id == candidate_ancestor_id) return true;
+// The events of the core, raised to UIA clients.
 
-    id = parent_id;
+void
+ui_uia_raise_focus_changed(UiTree::Id id) {
+  ::SetActiveWindow(g_hwnd);
+  if (UiaClientsAreListening() && g_root_provider) {
+    auto sp = create_simple_element_provider(id);
+    VERIFYHR(UiaRaiseAutomationEvent(sp, UIA_AutomationFocusChangedEventId));
+    sp->Release();
   }
-
-  return false;
 }
 
-UiTree::Id
-ui_named_element(wchar_t const* name, UiTree::Type type) {
-  auto index = g_ui.node_ids.size();
-  auto depth = g_ui.depth_for_adding_element;
-
-  UiTree::Id parent_id = -1;
-  if (depth == 0) {
-    parent_id = 0;
-  }
-  else {
-    auto parent_depth = depth - 1;
-    auto parent_pos = std::find(g_ui.node_depth.rbegin(), g_ui.node_depth.rend(), parent_depth);
-    VERIFY(parent_pos != g_ui.node_depth.rend());
-    auto relative_index = std::distance(g_ui.node_depth.rbegin(), parent_pos);
-    auto parent_index = index - 1 - relative_index;
-    parent_id = g_ui.node_ids[parent_index];
-  }
-
-  auto num_bytes = wcslen(name) * sizeof name[0];
-  auto id = hash(num_bytes, name);
-  id = wyhash64(id, parent_id);
-
-  VERIFY(valid_id(id));
-  VERIFY(g_ui.node_ids.end() == std::find(g_ui.node_ids.begin(), g_ui.node_ids.end(), id));
-  g_ui.node_ids.push_back(id);
-  g_ui.node_names.push_back(name);
-  g_ui.node_type.push_back(type);
-  g_ui.node_depth.push_back(depth);
-  g_ui.node_parent.push_back(parent_id);
-  g_ui.node_rect.push_back({});
-  g_ui.node_text_len.push_back(0);
-
-  auto node_len = g_ui.node_names[index].size();
-
-  g_ui.node_text_len[index] = node_len;
-  for (auto parent_id = g_ui.node_parent[index]; parent_id; ) {
-    auto parent_index = ui_get_index(parent_id);
-    g_ui.node_text_len[parent_index] += node_len;
-
-    parent_id = g_ui.node_parent[parent_index];
+void
+ui_uia_raise_text_changed(UiTree::Id id) {
+  if (UiaClientsAreListening() && g_root_provider) {
+    auto sp = create_simple_element_provider(id);
+    VERIFYHR(UiaRaiseAutomationEvent(sp, UIA_Text_TextChangedEventId));
+    sp->Release();
   }
-  return id;
-}
-
-UiTree::Id
-ui_document(wchar_t const* text) {
-    return ui_named_element(text, UiTree::Type::kDocument);
-}
-
-UiTree::Id
-ui_text_paragraph(wchar_t const* text) {
-    return ui_named_element(text, UiTree::Type::kText);
-}
-
-UiTree::Id
-ui_button(wchar_t const* text, std::function<void()> action) {
-  auto id = ui_named_element(text, UiTree::Type::kButton);
-  VERIFY(g_ui.actions.insert_or_assign(id, action).second);
-  return id;
-}
-
-UiTree::Id
-ui_pane(wchar_t const* text) {
-  return ui_named_element(text, UiTree::Type::kPane);
 }
 
 void
-ui_set_rect(UiTree::Id id, RECT rect) {
-  auto i = ui_get_index(id);
-  g_ui.node_rect.resize(std::max(g_ui.node_rect.size(), i + 1));
-  g_ui.node_rect[i] = rect;
+ui_uia_raise_invoked(UiTree::Id id) {
+  if (UiaClientsAreListening() && g_root_provider) {
+    auto sp = create_simple_element_provider(id);
+    VERIFYHR(UiaRaiseAutomationEvent(sp, UIA_Invoke_InvokedEventId));
+    sp->Release();
+  }
 }
 
 void
 ui_describe() {
-  log("ui_describe: START\n");
+  LOG_INFO(LogCategory_Tree, "ui_describe: START\n");
   UiTree::Id fid = {};
  
   constexpr auto kEnableUiRects = false; // the UI rects aren't necessary for the screen-reader to announce elements, unless users want a "tactile" feel using the mouse.
 
-  using Co = LONG;
-  const auto extend = [](RECT r, POINT p) -> RECT {
+  using Co = int32_t;
+  struct Point { Co x, y; };
+  const auto extend = [](UiRect r, Point p) -> UiRect {
     return {
       .left = std::min(r.left, p.x),
       .top = std::min(r.top, p.y),
@@ -2165,7 +1845,7 @@ ui_describe() {
 
   auto pane = ui_pane(L"Main");
   {
-    RECT pane_rect = { x, y, x + width, y };
+    UiRect pane_rect = { x, y, x + width, y };
 
     UiTree::Id id;
 
@@ -2173,7 +1853,7 @@ ui_describe() {
     g_ui.depth_for_adding_element++;
     auto document = ui_document(L"Main");
     {
-      RECT document_rect = pane_rect;
+      UiRect document_rect = pane_rect;
       
       if (kEnableUiRects) x += 10;
       g_ui.depth_for_adding_element++;
@@ -2210,110 +1890,23 @@ ui_describe() {
     if (kEnableUiRects) pane_rect = extend(pane_rect, { x, y });
     if (kEnableUiRects) ui_set_rect(pane, pane_rect);
   }
-  log("ui_describe: END\n");
+  LOG_INFO(LogCategory_Tree, "ui_describe: END\n");
 
-  log("g_ui.node_ids.size() = %zu\n", g_ui.node_ids.size());
+  LOG_INFO(LogCategory_Tree, "g_ui.node_ids.size() = %zu\n", g_ui.node_ids.size());
 
   // Initialize focus
   if (g_ui.focused_id == 0 && !g_ui.node_ids.empty()) {
       ui_set_focus_to(fid);
   }
 
-  log("UI Tree:\n");
+  LOG_INFO(LogCategory_Tree, "UI Tree:\n");
   for (size_t i = 0; i < g_ui.node_ids.size(); i++) {
     unsigned long long id = g_ui.node_ids[i];
     int depth = g_ui.node_depth[i];
     int type = (int)g_ui.node_type[i];
-    wchar_t* name = g_ui.node_names[i].data();
-    int len = g_ui.node_text_len[i];
-    log("%*snode: %d %#llx (%ls) len(%d)\n", 2+4*int(depth), "", type, id, name, len);
+    auto name = ui_node_name(i);
+    int len = int(ui_node_text_len(i));
+    LOG_INFO(LogCategory_Tree, "%*snode: %d %#llx (%.*ls) len(%d)\n", 2+4*int(depth), "", type, id, int(name.size()), name.data(), len);
   }
-  log("\n");
+  LOG_INFO(LogCategory_Tree, "\n");
 }
-
-size_t
-ui_get_index(UiTree::Id id) {
-  VERIFY(valid_id(id));
-  static struct {
-    UiTree::Id id[2];
-    size_t index[2];
-  } fingers;
-  static int next = 0;
-
-  if (id == fingers.id[0]) {
-    return fingers.index[0];
-  }
-  else if (id == fingers.id[1]) {
-    return fingers.index[1];
-  }
-
-  log("ui_get_index finger cache miss, for id %#llx (cached ids: %#llx %#llx)\n", id, fingers.id[0], fingers.id[1]);
-
-  size_t index;
-  for (index = 0; index < g_ui.node_ids.size(); index++) {
-    if (g_ui.node_ids[index] == id) break;
-  }
-  VERIFY(index < g_ui.node_ids.size()); // is this a case that needs instead to be legitimately handled, like if we have elements that disappear?
-  fingers.id[next & 1] = id;
-  fingers.index[next & 1] = index;
-  next++;
-
-  return index;
-}
-
-// TODO(nil): embed in single describe function.
-void
-ui_focus_next() {
-  auto index = ui_get_index(g_ui.focused_id);
-  if (index >= g_ui.node_ids.size() - 1) return;
-  
-  index++;
-  ui_set_focus_to(g_ui.node_ids[index]);
-}
-
-void
-ui_focus_prev() {
-  auto index = ui_get_index(g_ui.focused_id);
-  if (index <= 0) return;
-  
-  index--;
-  ui_set_focus_to(g_ui.node_ids[index]);
-}
-
-void
-ui_activate() {
-  if (g_ui.focused_id) ui_activate(g_ui.focused_id);
-}
-
-void
-ui_set_focus_to(UiTree::Id id) {
-    if (id == g_ui.focused_id) {
-        log("redundant ui_set_focus_to\n");
-        return;
-    }
-    log("changing focus from %#llx to %#llx\n", g_ui.focused_id, id);
-    ::SetActiveWindow(g_hwnd);
-    g_ui.focused_id = id;
-    if (UiaClientsAreListening() && g_root_provider) {
-        auto sp = create_simple_element_provider(g_ui.focused_id);
-        VERIFYHR(UiaRaiseAutomationEvent(sp, UIA_AutomationFocusChangedEventId));
-        sp->Release();
-    }
-}
-
-bool
-ui_activate(UiTree::Id id) {
-  log("activating %#llx\n", id);
-  auto action_pos = g_ui.actions.find(id);
-  if (action_pos == g_ui.actions.end()) return false;
-
-  auto fn = action_pos->second;
-  fn();
-
-  if (UiaClientsAreListening() && g_root_provider) {
-    auto sp = create_simple_element_provider(g_ui.focused_id);
-    VERIFYHR(UiaRaiseAutomationEvent(sp, UIA_Invoke_InvokedEventId));
-    sp->Release();
-  }
-  return true;
-}
\ No newline at end of file
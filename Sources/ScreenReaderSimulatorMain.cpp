@@ -0,0 +1,370 @@
+// # Screen-Reader Simulator
+//
+// A headless stand-in for NVDA or Narrator, to load the ui core with the calls screen-readers make and see how it holds
+// up: walking the whole tree, fetching the properties of every element, reading documents paragraph by paragraph,
+// following the focus and the mouse.
+//
+// Providers are COM objects that only exist on Windows, so each simulated call makes the core call (see "4. Providers"
+// in UiCore.h) that the provider method of the same name in SRFirstMain.cpp makes, less the COM marshalling. Calls are
+// measured like the providers are, with MEASURE_LATENCY.
+//
+// Usage: ScreenReaderSimulator [script]
+//
+// Scripts have one command per line, and # starts a comment:
+//   tree <num_nodes>          builds panes of documents of paragraphs, like UiCoreBenchmark
+//   walk                      visits every element with Navigate, like a UIA tree walker
+//   properties                fetches the properties screen-readers ask for, of every element
+//   focus <count>             moves the focus to the next elements, which get announced
+//   say_all <num_paragraphs>  reads from the focused element on, with Move(Paragraph) and GetText
+//   hover <num_points>        follows the mouse wandering over the window, announcing what is under it
+//   update <count>            changes the text of random paragraphs, which get announced
+//   latencies                 prints the latencies of the calls so far, and starts measuring again
+//   repeat <count>            repeats the commands up to the matching `end`
+//
+// Without a script, runs default_script. Every command reports how many calls per second it made, and the latencies
+// of the calls made since the last `latencies` are printed at the end.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "UiCore.h"
+#include "LatencyHistograms.h"
+#include "UiBenchmarkTree.h"
+#include "wyhash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static char const* const default_script = R"(
+# A screen-reader starting up on a large document, then its user reading and exploring it.
+tree 100000
+walk
+properties
+latencies
+focus 100
+say_all 1000
+hover 100000
+repeat 10
+  update 100
+  focus 10
+end
+)";
+
+static size_t g_num_calls = 0;
+static uint64_t g_checksum = 0; // what the calls returned, so that none of them can be optimized away.
+
+// 1. The calls of a screen-reader
+
+// Returns 0 for the root, and -1 when there is no such element.
+UiTree::Id
+sim_navigate(UiTree::Id id, UiNavigateDirection direction) {
+  g_num_calls++;
+  if (id == 0) {
+    MEASURE_LATENCY("RootProvider::Navigate");
+    return ui_navigate(0, direction);
+  }
+  MEASURE_LATENCY("AnyElementProvider::Navigate");
+  return ui_navigate(id, direction);
+}
+
+void
+sim_get_property(UiTree::Id id, UiProperty property) {
+  MEASURE_LATENCY("AnyElementProvider::GetPropertyValue");
+  g_num_calls++;
+  auto value = ui_get_property(id, property);
+  switch (value.kind) {
+  case UiPropertyValue::Kind::kEmpty: break;
+  case UiPropertyValue::Kind::kString: {
+    auto bstr = std::wstring(value.string); // the provider allocates a BSTR.
+    g_checksum += bstr.size();
+  } break;
+  case UiPropertyValue::Kind::kType: g_checksum += uint64_t(value.type); break;
+  case UiPropertyValue::Kind::kBool: g_checksum += value.boolean; break;
+  case UiPropertyValue::Kind::kInt: g_checksum += uint64_t(value.integer); break;
+  }
+}
+
+void
+sim_get_bounding_rectangle(UiTree::Id id) {
+  MEASURE_LATENCY("AnyElementProvider::get_BoundingRectangle");
+  g_num_calls++;
+  auto r = ui_get_bounding_rectangle(id);
+  g_checksum += uint64_t(r.right - r.left);
+}
+
+// Returns 0 for the root.
+UiTree::Id
+sim_element_from_point(double x, double y) {
+  MEASURE_LATENCY("RootProvider::ElementProviderFromPoint");
+  g_num_calls++;
+  return ui_element_from_point(x, y);
+}
+
+// Returns false for elements without a text pattern.
+bool
+sim_get_document_range(UiTree::Id id, TextRange* range) {
+  MEASURE_LATENCY("AnyElementTextProvider::get_DocumentRange");
+  g_num_calls++;
+  return ui_get_document_range(id, range);
+}
+
+int
+sim_move(TextRange& range, UiTextUnit unit, int count) {
+  MEASURE_LATENCY("AnyElementTextRangeProvider::Move");
+  g_num_calls++;
+  int moved = 0;
+  VERIFY(ui_text_range_move(range, unit, count, &moved));
+  return moved;
+}
+
+void
+sim_get_text(TextRange range, int max_length) {
+  MEASURE_LATENCY("AnyElementTextRangeProvider::GetText");
+  g_num_calls++;
+  auto len = ui_text_range_get_text_len(range, max_length);
+  auto bstr = std::wstring(len, L'\0'); // the provider allocates a BSTR.
+  ui_text_range_copy(range, len, bstr.data());
+  g_checksum += bstr.size();
+}
+
+// What gets announced when an element gets the focus, or appears under the mouse: its name, its role, and for the
+// focus, the ancestors that changed. (which readers cache, so we only read their names)
+void
+sim_announce(UiTree::Id id, bool with_ancestors) {
+  sim_get_property(id, UiProperty::kName);
+  sim_get_property(id, UiProperty::kControlType);
+  sim_get_property(id, UiProperty::kHasKeyboardFocus);
+  sim_get_bounding_rectangle(id);
+  if (!with_ancestors) return;
+  for (auto parent = sim_navigate(id, UiNavigateDirection::kParent); parent != 0; parent = sim_navigate(parent, UiNavigateDirection::kParent)) {
+    sim_get_property(parent, UiProperty::kName);
+  }
+}
+
+// 2. Scenarios
+
+void
+sim_build_tree(size_t num_nodes) {
+  ui_benchmark_build_tree(num_nodes);
+  if (!g_ui.node_ids.empty()) ui_set_focus_to(g_ui.node_ids[0]);
+}
+
+// Depth-first, the way UIA's tree walkers go: first child, or else the next sibling of the closest ancestor that has one.
+void
+sim_walk() {
+  UiTree::Id id = 0;
+  for (;;) {
+    auto next = sim_navigate(id, UiNavigateDirection::kFirstChild);
+    while (next == UiTree::Id(-1) && id != 0) {
+      next = sim_navigate(id, UiNavigateDirection::kNextSibling);
+      if (next == UiTree::Id(-1)) id = sim_navigate(id, UiNavigateDirection::kParent);
+    }
+    if (next == UiTree::Id(-1)) return;
+    id = next;
+  }
+}
+
+void
+sim_properties() {
+  for (size_t i = 0; i < g_ui.node_ids.size(); i++) {
+    auto id = g_ui.node_ids[i];
+    sim_get_property(id, UiProperty::kName);
+    sim_get_property(id, UiProperty::kControlType);
+    sim_get_property(id, UiProperty::kIsEnabled);
+    sim_get_property(id, UiProperty::kHasKeyboardFocus);
+    sim_get_bounding_rectangle(id);
+  }
+}
+
+void
+sim_focus(size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    auto focused_id = g_ui.focused_id;
+    ui_focus_next();
+    if (g_ui.focused_id == focused_id) ui_set_focus_to(g_ui.node_ids[0]); // wrap around.
+  }
+}
+
+void
+sim_say_all(size_t num_paragraphs) {
+  if (g_ui.document_indices.empty()) return;
+
+  // Read from the document of the focused element, or the first one when the focus isn't in a document.
+  auto document_id = g_ui.node_ids[g_ui.document_indices[0]];
+  for (auto id = g_ui.focused_id; id != 0; id = sim_navigate(id, UiNavigateDirection::kParent)) {
+    if (g_ui.node_type[ui_get_index(id)] == UiTree::Type::kDocument) document_id = id;
+  }
+  TextRange range;
+  VERIFY(sim_get_document_range(document_id, &range));
+  for (size_t i = 0; i < num_paragraphs; i++) {
+    if (sim_move(range, UiTextUnit::kParagraph, 1) == 0) break;
+    sim_get_text(range, -1);
+  }
+}
+
+void
+sim_hover(size_t num_points) {
+  uint64_t seed = 42;
+  auto width = double(ui_benchmark_num_panes(g_ui.node_ids.size()) * kPaneWidth);
+  double mouse_x = 0.0, mouse_y = 0.0;
+  UiTree::Id hovered_id = 0;
+  for (size_t i = 0; i < num_points; i++) {
+    mouse_x = std::clamp(mouse_x + double(wy2u0k(wyrand(&seed), 21)) - 10.0, -50.0, width + 50.0);
+    mouse_y = std::clamp(mouse_y + double(wy2u0k(wyrand(&seed), 21)) - 10.0, -50.0, double(kPaneHeight) + 50.0);
+    auto id = sim_element_from_point(mouse_x, mouse_y);
+    if (id != hovered_id && id != 0) sim_announce(id, false);
+    hovered_id = id;
+  }
+}
+
+void
+sim_update(size_t count) {
+  auto const& paragraphs = g_ui.paragraph_indices;
+  if (paragraphs.empty()) return;
+  static uint64_t seed = 42;
+  std::wstring text;
+  for (size_t i = 0; i < count; i++) {
+    auto id = g_ui.node_ids[paragraphs[wy2u0k(wyrand(&seed), paragraphs.size())]];
+    text.assign(wy2u0k(wyrand(&seed), 120), L'x');
+    ui_set_text(id, text.c_str());
+  }
+}
+
+// 3. Scripts
+
+struct Command {
+  int line;
+  std::string name;
+  size_t count = 0;
+  size_t end = 0; // for repeat, the index of its `end`.
+};
+
+// Returns false after printing what is wrong with the script.
+bool
+parse_script(std::string_view script, std::vector<Command>& commands) {
+  std::vector<size_t> open_repeats;
+  int line_number = 0;
+  while (!script.empty()) {
+    auto line_end = script.find('\n');
+    auto line = script.substr(0, line_end);
+    script.remove_prefix(line_end == std::string_view::npos ? script.size() : line_end + 1);
+    line_number++;
+
+    line = line.substr(0, line.find('#'));
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) continue;
+    line.remove_prefix(first);
+    auto name_end = line.find_first_of(" \t\r");
+    auto command = Command{ .line = line_number, .name = std::string(line.substr(0, name_end)) };
+    auto argument = name_end == std::string_view::npos ? std::string() : std::string(line.substr(name_end));
+
+    static struct { char const* name; bool takes_count; } const known_commands[] = {
+      { "tree", true }, { "walk", false }, { "properties", false }, { "focus", true }, { "say_all", true },
+      { "hover", true }, { "update", true }, { "latencies", false }, { "repeat", true }, { "end", false },
+    };
+    auto known = std::find_if(std::begin(known_commands), std::end(known_commands), [&](auto const& c) { return command.name == c.name; });
+    if (known == std::end(known_commands)) {
+      std::fprintf(stderr, "line %d: unknown command %s\n", line_number, command.name.c_str());
+      return false;
+    }
+    if (known->takes_count) {
+      char* argument_end;
+      command.count = size_t(std::strtoull(argument.c_str(), &argument_end, 10));
+      if (argument_end == argument.c_str()) {
+        std::fprintf(stderr, "line %d: %s expects a number\n", line_number, command.name.c_str());
+        return false;
+      }
+    }
+
+    if (command.name == "repeat") {
+      open_repeats.push_back(commands.size());
+    }
+    else if (command.name == "end") {
+      if (open_repeats.empty()) {
+        std::fprintf(stderr, "line %d: end without repeat\n", line_number);
+        return false;
+      }
+      commands[open_repeats.back()].end = commands.size();
+      open_repeats.pop_back();
+    }
+    commands.push_back(std::move(command));
+  }
+  if (!open_repeats.empty()) {
+    std::fprintf(stderr, "line %d: repeat without end\n", commands[open_repeats.back()].line);
+    return false;
+  }
+  return true;
+}
+
+void
+print_latencies() {
+  latency_histograms_dump([](char const* fmt, auto... args) { std::printf(fmt, args...); }, true);
+}
+
+void
+run_commands(std::vector<Command> const& commands, size_t first, size_t last, int depth) {
+  for (auto i = first; i < last; i++) {
+    auto const& command = commands[i];
+    if (command.name == "repeat") {
+      std::printf("%*srepeat %zu\n", 2 * depth, "", command.count);
+      for (size_t n = 0; n < command.count; n++) run_commands(commands, i + 1, command.end, depth + 1);
+      i = command.end;
+      continue;
+    }
+    if (command.name == "latencies") {
+      print_latencies();
+      continue;
+    }
+
+    auto num_calls = g_num_calls;
+    auto t0 = std::chrono::steady_clock::now();
+    if (command.name == "tree") sim_build_tree(command.count);
+    else if (command.name == "walk") sim_walk();
+    else if (command.name == "properties") sim_properties();
+    else if (command.name == "focus") sim_focus(command.count);
+    else if (command.name == "say_all") sim_say_all(command.count);
+    else if (command.name == "hover") sim_hover(command.count);
+    else if (command.name == "update") sim_update(command.count);
+    auto t1 = std::chrono::steady_clock::now();
+
+    auto seconds = std::chrono::duration<double>(t1 - t0).count();
+    num_calls = g_num_calls - num_calls;
+    std::printf("%*s%-10s %10zu calls in %9.3f ms: %12.0f calls/s\n", 2 * depth, "", command.name.c_str(), num_calls,
+      seconds * 1000.0, num_calls ? double(num_calls) / seconds : 0.0);
+  }
+}
+
+int
+main(int argc, char** argv) {
+  std::string script = default_script;
+  if (argc > 1) {
+    auto f = std::fopen(argv[1], "rb");
+    if (!f) {
+      std::fprintf(stderr, "could not open %s\n", argv[1]);
+      return 1;
+    }
+    script.clear();
+    char buffer[4096];
+    for (size_t n; (n = std::fread(buffer, 1, sizeof buffer, f)) > 0;) script.append(buffer, n);
+    std::fclose(f);
+  }
+
+  std::vector<Command> commands;
+  if (!parse_script(script, commands)) return 1;
+
+  // Like screen-readers, listen to the events of the ui and announce what changed.
+  g_ui_events.focus_changed = [](UiTree::Id id) { sim_announce(id, true); };
+  g_ui_events.text_changed = [](UiTree::Id id) { sim_get_property(id, UiProperty::kName); };
+
+  run_commands(commands, 0, commands.size(), 0);
+  print_latencies();
+  std::printf("checksum: %llu\n", (unsigned long long)g_checksum);
+  g_ui = {};
+  return 0;
+}
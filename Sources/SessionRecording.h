@@ -0,0 +1,231 @@
+// # Session recording
+//
+// Records what drives the ui of a session, the keyboard input and the calls made into our UIA providers, so that the
+// session can be replayed without a user, a window or a screen reader. A slow session then becomes a repeatable
+// benchmark, whose frame times can be compared across builds.
+//
+// File layout: the 8 bytes of kSessionMagic, then one record after another, until the end of the file:
+//   u8     kind (SessionRecordKind)
+//   varint microseconds since the previous record
+//   kind == kKeys:
+//     u8 1 for a key down, 0 for a key up
+//     u8 virtual key of the message
+//     u8 n, followed by the n virtual keys whose state changed since the previous kKeys record
+//   kind == kCall:
+//     u8     method (SessionCall)
+//     varint id of the element (0 for the root)
+//     varint zigzag-encoded arguments, kSessionCallNumArgs of them
+//
+// Only changes of the keyboard state are written, so that a key press usually takes 6 bytes, and a provider call
+// between 5 and 15 bytes.
+//
+// Like the trace, recording isn't thread-safe: records must be written from the ui thread.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+inline constexpr char kSessionMagic[8] = { 'T', 'O', 'D', 'O', 'R', 'E', 'C', '1' };
+
+enum class SessionRecordKind : uint8_t {
+  kKeys = 1,
+  kCall = 2,
+};
+
+// The provider calls that we record: those that read the tree or change the state of the ui.
+enum class SessionCall : uint8_t {
+  kGetObject, // WM_GETOBJECT for the root, which creates the root provider.
+  kElementProviderFromPoint, // args: x, y in client coordinates.
+  kGetFocus,
+  kGetBoundingRectangle,
+  kGetRuntimeId,
+  kNavigate, // args: direction.
+  kGetPatternProvider, // args: pattern id.
+  kGetPropertyValue, // args: property id.
+  kSetFocus,
+  kInvoke,
+  kCount,
+};
+
+inline constexpr int kSessionCallNumArgs = 2;
+
+struct SessionRecord {
+  SessionRecordKind kind;
+  uint64_t time_us; // since the start of the session.
+
+  // kKeys
+  bool down;
+  uint8_t vk;
+  uint8_t const* keys; // 256 entries, with bit 7 set for the keys that are down, like GetKeyboardState.
+
+  // kCall
+  SessionCall call;
+  uint64_t id;
+  int64_t args[kSessionCallNumArgs];
+};
+
+struct SessionRecorder {
+  std::FILE* file = nullptr;
+  std::chrono::steady_clock::time_point last_time;
+  uint8_t keys[256] = {};
+  size_t num_records = 0;
+};
+
+inline SessionRecorder g_session_recorder;
+
+// Returns false if the file could not be created.
+inline bool
+session_record_start(char const* path) {
+  auto& r = g_session_recorder;
+  r.file = std::fopen(path, "wb");
+  if (!r.file) return false;
+  std::fwrite(kSessionMagic, 1, sizeof(kSessionMagic), r.file);
+  r.last_time = std::chrono::steady_clock::now();
+  return true;
+}
+
+// Returns false if the file could not be written.
+inline bool
+session_record_stop() {
+  auto& r = g_session_recorder;
+  if (!r.file) return true;
+  auto ok = !std::ferror(r.file);
+  ok = std::fclose(r.file) == 0 && ok;
+  r.file = nullptr;
+  return ok;
+}
+
+inline void
+session_write_varint(uint64_t x) {
+  uint8_t buffer[10];
+  size_t n = 0;
+  do {
+    buffer[n++] = uint8_t(x & 0x7f) | (x >= 0x80 ? 0x80 : 0);
+    x >>= 7;
+  } while (x);
+  std::fwrite(buffer, 1, n, g_session_recorder.file);
+}
+
+inline void
+session_write_record_header(SessionRecordKind kind) {
+  auto& r = g_session_recorder;
+  auto now = std::chrono::steady_clock::now();
+  std::fputc(int(kind), r.file);
+  session_write_varint(uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now - r.last_time).count()));
+  r.last_time = now;
+  r.num_records++;
+}
+
+// keys: as returned by GetKeyboardState.
+inline void
+session_record_keys(bool down, uint8_t vk, uint8_t const keys[256]) {
+  auto& r = g_session_recorder;
+  if (!r.file) return;
+  session_write_record_header(SessionRecordKind::kKeys);
+  uint8_t changed[256];
+  size_t num_changed = 0;
+  for (size_t i = 0; i < 256; i++) {
+    auto key_down = uint8_t(keys[i] & 0x80);
+    if (key_down != r.keys[i]) {
+      changed[num_changed++] = uint8_t(i);
+      r.keys[i] = key_down;
+    }
+  }
+  if (num_changed == 256) {
+    // Can't be told apart from 0 changes, so we leave one to the next record. Only happens with a broken keyboard state.
+    r.keys[changed[--num_changed]] ^= 0x80;
+  }
+  uint8_t header[] = { uint8_t(down), vk, uint8_t(num_changed) };
+  std::fwrite(header, 1, sizeof(header), r.file);
+  std::fwrite(changed, 1, num_changed, r.file);
+}
+
+inline void
+session_record_call(SessionCall call, uint64_t id, int64_t arg0 = 0, int64_t arg1 = 0) {
+  auto& r = g_session_recorder;
+  if (!r.file) return;
+  session_write_record_header(SessionRecordKind::kCall);
+  std::fputc(int(call), r.file);
+  session_write_varint(id);
+  for (auto arg : { arg0, arg1 }) {
+    session_write_varint((uint64_t(arg) << 1) ^ uint64_t(arg >> 63));
+  }
+}
+
+struct SessionReader {
+  std::vector<uint8_t> data;
+  size_t pos = 0;
+  uint64_t time_us = 0;
+  uint8_t keys[256] = {};
+};
+
+// Returns false if the file could not be read or isn't a session recording.
+inline bool
+session_reader_open(SessionReader& reader, char const* path) {
+  auto f = std::fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buffer[64 * 1024];
+  for (size_t n; (n = std::fread(buffer, 1, sizeof(buffer), f)) > 0;) {
+    reader.data.insert(reader.data.end(), buffer, buffer + n);
+  }
+  std::fclose(f);
+  if (reader.data.size() < sizeof(kSessionMagic) || std::memcmp(reader.data.data(), kSessionMagic, sizeof(kSessionMagic)) != 0) {
+    return false;
+  }
+  reader.pos = sizeof(kSessionMagic);
+  return true;
+}
+
+// Returns false at the end of the recording, or when the rest of it is truncated.
+inline bool
+session_reader_next(SessionReader& reader, SessionRecord* record) {
+  auto& data = reader.data;
+  auto& pos = reader.pos;
+  bool ok = true;
+  const auto read_u8 = [&]() -> uint8_t {
+    if (pos >= data.size()) { ok = false; return 0; }
+    return data[pos++];
+  };
+  const auto read_varint = [&]() -> uint64_t {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      auto byte = read_u8();
+      x |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    return x;
+  };
+
+  if (pos >= data.size()) return false;
+  *record = {};
+  record->kind = SessionRecordKind(read_u8());
+  record->time_us = reader.time_us + read_varint();
+  switch (record->kind) {
+  case SessionRecordKind::kKeys: {
+    record->down = read_u8() != 0;
+    record->vk = read_u8();
+    auto num_changed = read_u8();
+    for (int i = 0; i < num_changed; i++) {
+      reader.keys[read_u8()] ^= 0x80;
+    }
+    record->keys = reader.keys;
+  } break;
+  case SessionRecordKind::kCall: {
+    record->call = SessionCall(read_u8());
+    record->id = read_varint();
+    for (auto& arg : record->args) {
+      auto zigzag = read_varint();
+      arg = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+    }
+    ok = ok && record->call < SessionCall::kCount;
+  } break;
+  default: ok = false; break;
+  }
+  if (!ok) return false;
+  reader.time_us = record->time_us;
+  return true;
+}
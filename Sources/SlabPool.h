@@ -0,0 +1,48 @@
+// # Slab pool
+//
+// Allocator for objects of a single type that come and go, such as providers. Objects are carved out of slabs that
+// are kept for the lifetime of the pool, and freed objects are reused first.
+//
+// Like the rest of the ui, it isn't thread-safe.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+template <typename T, size_t kObjectsPerSlab = 256>
+struct SlabPool {
+  union Slot {
+    Slot* next_free;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  std::vector<std::unique_ptr<Slot[]>> slabs;
+  Slot* free_list = nullptr;
+  size_t num_live = 0;
+  size_t num_allocations = 0; // since the start, to observe that a steady state does not allocate.
+
+  void* allocate() {
+    if (!free_list) {
+      slabs.push_back(std::make_unique<Slot[]>(kObjectsPerSlab));
+      auto slab = slabs.back().get();
+      for (size_t i = kObjectsPerSlab; i > 0; i--) {
+        slab[i - 1].next_free = free_list;
+        free_list = &slab[i - 1];
+      }
+    }
+    auto slot = free_list;
+    free_list = slot->next_free;
+    num_live++;
+    num_allocations++;
+    return slot;
+  }
+
+  void deallocate(void* p) {
+    auto slot = static_cast<Slot*>(p);
+    slot->next_free = free_list;
+    free_list = slot;
+    num_live--;
+  }
+};
@@ -0,0 +1,275 @@
+// # Text boundary scanner
+//
+// Finds where words and lines start in the text of a name, as bitmaps with one bit per code unit. (UTF-16, or UTF-32
+// where wchar_t is 4 bytes) A word is a run of letters or of punctuation, with the spaces and newlines after it. A
+// line ends after a newline, with \r\n counting as one. The start of the text starts a word and a line.
+//
+// Text is classified 64 code units at a time into masks, one per class, from which the boundaries are a few shifts
+// and ands away. Text is classified 16 code units at a time with SSE2, or 32 with AVX2 (compile with /arch:AVX2 or
+// -mavx2), except where there are spaces or punctuation beyond ASCII, which are left to text_char_class, one code unit
+// at a time.
+//
+// Each bitmap comes with the number of bits set before every 512 bits, so that finding the n-th boundary, or counting
+// the boundaries before a position, is a lookup in the directory and a few popcounts.
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXT_SCANNER_SSE2 1
+#include <emmintrin.h>
+#else
+#define TEXT_SCANNER_SSE2 0
+#endif
+#if defined(__AVX2__)
+#define TEXT_SCANNER_AVX2 1
+#include <immintrin.h>
+#else
+#define TEXT_SCANNER_AVX2 0
+#endif
+
+enum class TextCharClass {
+  kWord,
+  kSpace,
+  kPunctuation,
+  kNewline,
+};
+
+inline TextCharClass
+text_char_class(wchar_t c) {
+  switch (c) {
+  case L'\n': case L'\r': case L'\v': case L'\f': case 0x85: case 0x2028: case 0x2029: return TextCharClass::kNewline;
+  case L' ': case L'\t': case 0xa0: case 0x1680: case 0x202f: case 0x205f: case 0x3000: return TextCharClass::kSpace;
+  }
+  if (0x2000 <= c && c <= 0x200a) return TextCharClass::kSpace;
+  if ((L'!' <= c && c <= L'/') || (L':' <= c && c <= L'@') || (L'[' <= c && c <= L'`') || (L'{' <= c && c <= L'~')) return TextCharClass::kPunctuation;
+  if ((0xa1 <= c && c <= 0xbf) || (0x2010 <= c && c <= 0x2027) || (0x2030 <= c && c <= 0x205e) || (0x3001 <= c && c <= 0x303f)) return TextCharClass::kPunctuation;
+  return TextCharClass::kWord;
+}
+
+// One bit per code unit of a chunk of 64, set for the code units of each class. Spaces are the rest.
+struct TextClassMasks {
+  uint64_t word = 0;
+  uint64_t punctuation = 0;
+  uint64_t newline = 0;
+  uint64_t cr = 0;
+  uint64_t lf = 0;
+};
+
+enum class TextScanner {
+  kScalar,
+  kSse2,
+  kAvx2,
+  kBest = TEXT_SCANNER_AVX2 ? kAvx2 : TEXT_SCANNER_SSE2 ? kSse2 : kScalar,
+};
+
+inline void
+text_classify_scalar(wchar_t const* text, size_t len, size_t bit, TextClassMasks& masks) {
+  for (size_t i = 0; i < len; i++, bit++) {
+    auto b = uint64_t(1) << bit;
+    switch (text_char_class(text[i])) {
+    case TextCharClass::kWord: masks.word |= b; break;
+    case TextCharClass::kPunctuation: masks.punctuation |= b; break;
+    case TextCharClass::kNewline: masks.newline |= b; break;
+    case TextCharClass::kSpace: break;
+    }
+    if (text[i] == L'\r') masks.cr |= b;
+    if (text[i] == L'\n') masks.lf |= b;
+  }
+}
+
+#if TEXT_SCANNER_SSE2
+// Classifies 16 code units, or returns false when some of them are spaces or punctuation beyond ASCII.
+inline bool
+text_classify_sse2(wchar_t const* text, size_t bit, TextClassMasks& masks) {
+  __m128i lo, hi; // 8 code units each, in 16 bit lanes.
+  if constexpr (sizeof(wchar_t) == 2) {
+    lo = _mm_loadu_si128((__m128i const*)text);
+    hi = _mm_loadu_si128((__m128i const*)(text + 8));
+  }
+  else {
+    // Saturates code units above 0x7fff to 0x7fff, a letter like all of them.
+    auto p = (__m128i const*)text;
+    lo = _mm_packs_epi32(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+    hi = _mm_packs_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+  }
+  auto zero = _mm_setzero_si128();
+  const auto in16 = [&](__m128i x, uint16_t first, uint16_t last) {
+    auto d = _mm_subs_epu16(_mm_sub_epi16(x, _mm_set1_epi16(int16_t(first))), _mm_set1_epi16(int16_t(last - first)));
+    return _mm_cmpeq_epi16(d, zero);
+  };
+  const auto special = [&](__m128i x) { // the ranges of text_char_class beyond ASCII.
+    return _mm_or_si128(_mm_or_si128(in16(x, 0x80, 0xbf), in16(x, 0x1680, 0x1680)), _mm_or_si128(in16(x, 0x2000, 0x205f), in16(x, 0x3000, 0x303f)));
+  };
+  if (_mm_movemask_epi8(_mm_or_si128(special(lo), special(hi)))) return false;
+  const auto to_ascii = [&](__m128i x) { // other code units are letters, like 'a'.
+    auto ascii = _mm_cmpeq_epi16(_mm_and_si128(x, _mm_set1_epi16(int16_t(0xff80))), zero);
+    return _mm_or_si128(_mm_and_si128(ascii, x), _mm_andnot_si128(ascii, _mm_set1_epi16('a')));
+  };
+
+  auto c = _mm_packus_epi16(to_ascii(lo), to_ascii(hi));
+  const auto eq = [&](char x) { return _mm_cmpeq_epi8(c, _mm_set1_epi8(x)); };
+  const auto in = [&](char first, char last) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(char(first - 1))), _mm_cmpgt_epi8(_mm_set1_epi8(char(last + 1)), c));
+  };
+  auto newline = in('\n', '\r'); // \n \v \f \r
+  auto punctuation = _mm_or_si128(_mm_or_si128(in('!', '/'), in(':', '@')), _mm_or_si128(in('[', '`'), in('{', '~')));
+  auto space = _mm_or_si128(eq(' '), eq('\t'));
+  auto word = ~uint64_t(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(newline, punctuation), space))) & 0xffff;
+  masks.word |= word << bit;
+  masks.punctuation |= uint64_t(_mm_movemask_epi8(punctuation)) << bit;
+  masks.newline |= uint64_t(_mm_movemask_epi8(newline)) << bit;
+  masks.cr |= uint64_t(_mm_movemask_epi8(eq('\r'))) << bit;
+  masks.lf |= uint64_t(_mm_movemask_epi8(eq('\n'))) << bit;
+  return true;
+}
+#endif
+
+#if TEXT_SCANNER_AVX2
+// Same as text_classify_sse2, for 32 code units.
+inline bool
+text_classify_avx2(wchar_t const* text, size_t bit, TextClassMasks& masks) {
+  // Packing works within each 128 bit half, so every pack is followed by putting the quarters back in order.
+  __m256i lo, hi; // 16 code units each, in 16 bit lanes.
+  if constexpr (sizeof(wchar_t) == 2) {
+    lo = _mm256_loadu_si256((__m256i const*)text);
+    hi = _mm256_loadu_si256((__m256i const*)(text + 16));
+  }
+  else {
+    auto p = (__m256i const*)text;
+    lo = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)), 0xd8);
+    hi = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)), 0xd8);
+  }
+  auto zero = _mm256_setzero_si256();
+  const auto in16 = [&](__m256i x, uint16_t first, uint16_t last) {
+    auto d = _mm256_subs_epu16(_mm256_sub_epi16(x, _mm256_set1_epi16(int16_t(first))), _mm256_set1_epi16(int16_t(last - first)));
+    return _mm256_cmpeq_epi16(d, zero);
+  };
+  const auto special = [&](__m256i x) {
+    return _mm256_or_si256(_mm256_or_si256(in16(x, 0x80, 0xbf), in16(x, 0x1680, 0x1680)), _mm256_or_si256(in16(x, 0x2000, 0x205f), in16(x, 0x3000, 0x303f)));
+  };
+  auto specials = _mm256_or_si256(special(lo), special(hi));
+  if (!_mm256_testz_si256(specials, specials)) return false;
+  const auto to_ascii = [&](__m256i x) {
+    auto ascii = _mm256_cmpeq_epi16(_mm256_and_si256(x, _mm256_set1_epi16(int16_t(0xff80))), zero);
+    return _mm256_blendv_epi8(_mm256_set1_epi16('a'), x, ascii);
+  };
+
+  auto c = _mm256_permute4x64_epi64(_mm256_packus_epi16(to_ascii(lo), to_ascii(hi)), 0xd8);
+  const auto eq = [&](char x) { return _mm256_cmpeq_epi8(c, _mm256_set1_epi8(x)); };
+  const auto in = [&](char first, char last) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(char(first - 1))), _mm256_cmpgt_epi8(_mm256_set1_epi8(char(last + 1)), c));
+  };
+  const auto bits = [](__m256i m) { return uint64_t(uint32_t(_mm256_movemask_epi8(m))); };
+  auto newline = in('\n', '\r');
+  auto punctuation = _mm256_or_si256(_mm256_or_si256(in('!', '/'), in(':', '@')), _mm256_or_si256(in('[', '`'), in('{', '~')));
+  auto space = _mm256_or_si256(eq(' '), eq('\t'));
+  masks.word |= (~bits(_mm256_or_si256(_mm256_or_si256(newline, punctuation), space)) & 0xffffffff) << bit;
+  masks.punctuation |= bits(punctuation) << bit;
+  masks.newline |= bits(newline) << bit;
+  masks.cr |= bits(eq('\r')) << bit;
+  masks.lf |= bits(eq('\n')) << bit;
+  return true;
+}
+#endif
+
+// len <= 64
+inline TextClassMasks
+text_classify_chunk(wchar_t const* text, size_t len, TextScanner scanner) {
+  TextClassMasks masks;
+  size_t i = 0;
+#if TEXT_SCANNER_AVX2
+  if (scanner == TextScanner::kAvx2) {
+    for (; i + 32 <= len; i += 32) {
+      if (!text_classify_avx2(text + i, i, masks)) text_classify_scalar(text + i, 32, i, masks);
+    }
+  }
+#endif
+#if TEXT_SCANNER_SSE2
+  if (scanner != TextScanner::kScalar) {
+    for (; i + 16 <= len; i += 16) {
+      if (!text_classify_sse2(text + i, i, masks)) text_classify_scalar(text + i, 16, i, masks);
+    }
+  }
+#endif
+  text_classify_scalar(text + i, len - i, i, masks);
+  return masks;
+}
+
+struct TextBoundaryBits {
+  std::vector<uint64_t> bits; // bit i of bits[i / 64] for code unit i.
+  std::vector<uint32_t> rank; // the number of bits set before bits[8 * k], and the total at the end.
+};
+
+inline void
+text_scan_boundaries(wchar_t const* text, size_t len, TextBoundaryBits& words, TextBoundaryBits& lines,
+  TextScanner scanner = TextScanner::kBest) {
+  auto num_chunks = (len + 63) / 64;
+  words.bits.resize(num_chunks);
+  lines.bits.resize(num_chunks);
+
+  TextClassMasks prev; // the masks of the previous chunk, of which only bit 63 matters.
+  for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+    auto chunk_len = std::min(len - chunk * 64, size_t(64));
+    auto m = text_classify_chunk(text + chunk * 64, chunk_len, scanner);
+    auto prev_word = (m.word << 1) | (prev.word >> 63);
+    auto prev_punctuation = (m.punctuation << 1) | (prev.punctuation >> 63);
+    auto prev_newline = (m.newline << 1) | (prev.newline >> 63);
+    auto prev_cr = (m.cr << 1) | (prev.cr >> 63);
+    auto in_text = chunk_len == 64 ? ~uint64_t(0) : (uint64_t(1) << chunk_len) - 1;
+    words.bits[chunk] = (m.word & ~prev_word) | (m.punctuation & ~prev_punctuation);
+    lines.bits[chunk] = prev_newline & ~(prev_cr & m.lf) & in_text;
+    prev = m;
+  }
+  if (len) {
+    words.bits[0] |= 1;
+    lines.bits[0] |= 1;
+  }
+
+  for (auto b : { &words, &lines }) {
+    b->rank.clear();
+    uint32_t n = 0;
+    for (size_t i = 0; i < b->bits.size(); i++) {
+      if (i % 8 == 0) b->rank.push_back(n);
+      n += uint32_t(std::popcount(b->bits[i]));
+    }
+    b->rank.push_back(n);
+  }
+}
+
+inline size_t
+text_bits_count(TextBoundaryBits const& b) {
+  return b.rank.empty() ? 0 : b.rank.back();
+}
+
+// The number of bits set before position pos.
+inline size_t
+text_bits_count_before(TextBoundaryBits const& b, size_t pos) {
+  auto word = pos / 64;
+  auto block = word / 8;
+  if (block >= b.rank.size()) return text_bits_count(b);
+  size_t n = b.rank[block];
+  for (auto i = block * 8; i < word; i++) n += size_t(std::popcount(b.bits[i]));
+  if (pos % 64) n += size_t(std::popcount(b.bits[word] & ((uint64_t(1) << (pos % 64)) - 1)));
+  return n;
+}
+
+// The position of the k-th bit set, counting from 0. k < text_bits_count(b)
+inline size_t
+text_bits_select(TextBoundaryBits const& b, size_t k) {
+  auto block = size_t(std::upper_bound(b.rank.begin(), b.rank.end() - 1, uint32_t(k)) - b.rank.begin()) - 1;
+  k -= b.rank[block];
+  for (auto i = block * 8;; i++) {
+    auto bits = b.bits[i];
+    auto n = size_t(std::popcount(bits));
+    if (k < n) {
+      for (; k > 0; k--) bits &= bits - 1;
+      return i * 64 + size_t(std::countr_zero(bits));
+    }
+    k -= n;
+  }
+}
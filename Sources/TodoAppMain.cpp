@@ -3,44 +3,51 @@
 // An experiment in designing an app starting first from screen-reader support, before thinking about the GUI.
 //
 
-// TODO(nil): Implement structural change events, because when content is hidden when pressing the [Done]
-// button we have GetPropertyValue calls being made just after activation on nodes that don't exist yet.
-// Rather than turning those providers into "Null" providers, I need to implement structural change events.
+// Structure change events: the tree is double-buffered, and ui_end compares the new tree with the one of the
+// previous frame (see ui_diff_structure) so that clients hear about nodes that appeared or disappeared, rather than
+// making GetPropertyValue calls on nodes that don't exist anymore, like when content is hidden with the [Done] button.
 //
 // See:
 // - URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcoreapi/nf-uiautomationcoreapi-uiaraisestructurechangedevent)
 // - URL(https://docs.microsoft.com/en-us/windows/win32/api/uiautomationcore/ne-uiautomationcore-structurechangetype)
-// 
-// Some ideas:
-// 0- add the root element in the hierarchy of the Ui tree and merge the AnyElementProvider with the
+//
+// TODO(nil): add the root element in the hierarchy of the Ui tree and merge the AnyElementProvider with the
 // RootProvider. That way I internalize the peculiarities about the root node in the providers, but
 // make everything more uniform in terms of tree manipulation code. I.e. elements at depth 0 are
 // actually at depth 1 and all have a back pointer to the root. The root is always there, so its
 // addition code is straightforward.
 //
-// 1- synthesize structure change events. I imagine I could do that while elements get added to the
-// tree by detecting if they were already there. If they aren't then we can mark them as new, and
-// their parent can be marked as having seen a bulk children added. However how do I remove children?
-// What if the children are not new but reordered?
-// 
-// Another approach would be to double-buffer the tree and somehow compare the old with the new.
+// Reordered children are reported as the few moves that produce the new order, rather than as the removal and addition
+// of all of them, so that sorting a list doesn't make clients read it all again.
 
 #define _CRT_SECURE_NO_WARNINGS
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 
 #include "wyhash.h"
+#include "BinaryLog.h"
+#include "LatencyHistograms.h"
+#include "LogFilter.h"
+#include "RectIndex.h"
+#include "SessionRecording.h"
+#include "SlabPool.h"
+#include "TraceEvents.h"
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <iterator>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <cwchar>
 
 #include <Objbase.h>
 #pragma comment(lib, "Ole32.lib")
@@ -72,8 +79,6 @@
   __pragma(warning(pop))
 
 
-static FILE* g_output_log = fopen("log.txt", "wb");
-//stdout;
 
 void log(char const* fmt, ...);
 
@@ -130,8 +135,7 @@ struct ComOwner {
 
 void
 logv(char const* fmt, va_list args) {
-  std::vfprintf(g_output_log, fmt, args);
-  std::fflush(g_output_log);
+  binary_log_v(fmt, args); // written to log.bin, read it with LogDecoder.
 }
 
 void
@@ -142,6 +146,12 @@ log(char const* fmt, ...) {
   va_end(args);
 }
 
+// Writes the latencies of the provider methods called so far to the log.
+void
+log_latencies(bool reset = false) {
+  latency_histograms_dump([](char const* fmt, auto... args) { ::log(fmt, args...); }, reset);
+}
+
 uint64_t inline
 bits(uint64_t x, uint64_t start, uint64_t num) {
   VERIFY(start + num < 64);
@@ -199,15 +209,17 @@ struct DigitalButton {
   bool released = false;
 };
 
-#define IdFormat "%#x"
+#define IdFormat "%#llx"
 
 struct RootProvider;
+struct AnyElementProvider;
 
 struct Ui {
   /// identifies a node in the ui tree.
   /// 0 => root node
   /// -1 => invalid node.
-  using Id = std::uint32_t;
+  /// 64 bits, because with 32 bits hash collisions become likely past ~100k nodes.
+  using Id = std::uint64_t;
 
   HWND hwnd;
   ComOwner<RootProvider> root_provider;
@@ -233,20 +245,127 @@ struct Ui {
   };
 
   int depth_for_adding_nodes = 0;
+  std::vector<size_t> open_node_stack; // [depth] => index of the last node added at that depth, i.e. the open container for depth + 1.
 
   // Nodes with their properties as separate arrays, APL-style.
   // Elements are ordered in depth-first traversal.
   std::vector<Id>           node_ids; // in presentation order.
-  std::vector<std::wstring> node_names;
+  std::vector<size_t>       node_text_offset; // where the text of this node starts in `text`.
+  std::vector<size_t>       node_text_len;
   std::vector<Type>         node_type;
-  std::vector<Id>           node_parent;
+  std::vector<Id>           node_parent; // ids, as exposed to UIA clients.
   std::vector<int>          node_depth;
   std::vector<RECT>         node_rect;
 
+  // The text of all nodes, concatenated in presentation order. Rebuilt each frame without allocating once it has reached its capacity.
+  std::vector<wchar_t>      text;
+
+  // Structure, as indices into the node arrays. size_t(-1) => none.
+  std::vector<size_t>       node_parent_index; // size_t(-1) => root.
+  std::vector<size_t>       node_subtree_end; // one past the index of the last descendant of this node.
+  std::vector<size_t>       node_prev_sibling;
+  std::vector<size_t>       node_last_child;
+  size_t                    root_last_child = size_t(-1);
+
+  RectIndex<RECT> rect_index; // over node_rect, for hit-testing.
+
+  // Open-addressing table from node id to its index in the node arrays.
+  // Filled by ui_named_element, which also relies on it to reject duplicate ids.
+  // Cleared by ui_begin in O(1) by bumping the generation: slots stamped with an older one are empty.
+  // The fields of a slot are kept together, so that a probe touches a single cache line.
+  struct IdIndex {
+    struct Slot {
+      Id       key;
+      uint32_t index;
+      uint32_t generation;
+    };
+    std::vector<Slot> slots;
+    uint32_t generation = 1;
+    size_t count = 0;
+  } index_by_id;
+
+  // Subtrees described between ui_memo_begin and ui_memo_end, in the order they began, i.e. nested ones after the one
+  // that contains them.
+  struct Memos {
+    std::vector<Id>       ids;
+    std::vector<uint64_t> versions;
+    std::vector<int>      depth;
+    std::vector<size_t>   first_node;
+    std::vector<size_t>   num_nodes;
+    std::vector<size_t>   text_offset;
+    std::vector<size_t>   text_len;
+    std::vector<bool>     reused; // copied from the previous frame, rather than described.
+    std::vector<bool>     has_buttons;
+    std::unordered_map<Id, size_t> index_by_id;
+  } memos;
+  std::vector<size_t> open_memo_stack; // indices into memos.
+
+  // The tree of the previous frame, which ui_end compares with the new one to tell clients how the structure changed,
+  // and from which memoized subtrees are copied.
+  // ui_begin swaps it with the current tree rather than copying, so that both keep their capacity.
+  struct {
+    std::vector<Id>       node_ids;
+    std::vector<size_t>   node_text_offset;
+    std::vector<size_t>   node_text_len;
+    std::vector<Type>     node_type;
+    std::vector<Id>       node_parent;
+    std::vector<int>      node_depth;
+    std::vector<RECT>     node_rect;
+    std::vector<wchar_t>  text;
+    std::vector<size_t>   node_parent_index;
+    std::vector<size_t>   node_subtree_end;
+    std::vector<size_t>   node_prev_sibling;
+    std::vector<size_t>   node_last_child;
+    IdIndex               index_by_id;
+    Memos                 memos;
+  } previous;
+
+  // The structure changes found by ui_end, in the order they must be raised: removals, additions then reorders.
+  enum class StructureChange {
+    kChildAdded,          // id: the new child.
+    kChildRemoved,        // id: the parent, child: the removed child.
+    kChildrenInvalidated, // id: the parent, too much changed below it to be worth describing.
+    kChildrenBulkAdded,   // id: the parent.
+    kChildrenBulkRemoved, // id: the parent.
+    kChildrenReordered,   // id: the parent.
+    kChildMoved,          // id: the parent, child: the child that moved among its siblings.
+  };
+  struct {
+    std::vector<StructureChange> type;
+    std::vector<Id> id; // 0 => root
+    std::vector<Id> child;
+  } structure_changes;
+
+  // Scratch space for the comparison of the two trees, kept to not allocate each frame.
+  struct {
+    std::vector<size_t>   old_index_of_new; // size_t(-1) => added.
+    std::vector<size_t>   new_index_of_old; // size_t(-1) => removed.
+    std::vector<uint32_t> num_added; // [parent index + 1], 0 is the root.
+    std::vector<uint32_t> num_removed;
+    std::vector<size_t>   last_child_old_index;
+    std::vector<bool>     reordered;
+    std::vector<uint32_t> num_moved; // [parent index + 1]
+    std::vector<bool>     moved; // [new index]
+    std::vector<size_t>   siblings; // new indices of the kept children of a reordered parent.
+    std::vector<size_t>   sibling_old_indices;
+    std::vector<size_t>   lis_tails;
+    std::vector<size_t>   lis_prev;
+    std::vector<bool>     in_lis;
+  } diff;
+
+  struct {
+    size_t finger_hits = 0;
+    size_t finger_misses = 0;
+  } index_stats;
+
   struct {
     std::vector<Id> ids;
     std::vector<DigitalButton> state;
   } buttons;
+
+  // One provider per node, handed out AddRef'd to UIA clients so that walking the tree does not allocate.
+  // The cache holds a reference, which ui_end releases once the node has disappeared.
+  std::unordered_map<Id, AnyElementProvider*> providers;
 };
 
 Ui g_ui;
@@ -256,6 +375,61 @@ valid_id(Ui::Id id) {
   return 0 < id && id < Ui::Id(-1);
 }
 
+void
+ui_index_clear(Ui::IdIndex& table) {
+  table.count = 0;
+  table.generation++;
+  if (table.generation == 0) {
+    // wrapped around: old stamps could now look current.
+    for (auto& slot : table.slots) slot.generation = 0;
+    table.generation = 1;
+  }
+}
+
+// returns false when the id was already present, in which case the table is left untouched.
+bool
+ui_index_insert(Ui::IdIndex& table, Ui::Id id, size_t index) {
+  VERIFY(index < uint32_t(-1));
+  if (2 * (table.count + 1) > table.slots.size()) {
+    // grow, keeping the load factor under 1/2 so that probe sequences stay short.
+    auto old_slots = std::move(table.slots);
+    auto capacity = std::max(size_t(64), 2 * old_slots.size());
+    table.slots.assign(capacity, {});
+    table.count = 0;
+    for (const auto& old : old_slots) {
+      if (old.generation == table.generation) ui_index_insert(table, old.key, old.index);
+    }
+  }
+
+  // ids are taken from wyhash outputs, so their low bits are already well distributed.
+  auto mask = table.slots.size() - 1;
+  auto slot = size_t(id) & mask;
+  for (; table.slots[slot].generation == table.generation; slot = (slot + 1) & mask) {
+    if (table.slots[slot].key == id) return false;
+  }
+  table.count++;
+  table.slots[slot] = { .key = id, .index = uint32_t(index), .generation = table.generation };
+  return true;
+}
+
+// returns size_t(-1) when the id is not in the table.
+size_t
+ui_index_find(const Ui::IdIndex& table, Ui::Id id) {
+  if (table.slots.empty()) return size_t(-1);
+
+  auto mask = table.slots.size() - 1;
+  for (auto slot = size_t(id) & mask; table.slots[slot].generation == table.generation; slot = (slot + 1) & mask) {
+    if (table.slots[slot].key == id) return table.slots[slot].index;
+  }
+  return size_t(-1);
+}
+
+// returns size_t(-1) when the id is not in the tree.
+size_t
+ui_find_index(const Ui& ui, Ui::Id id) {
+  return ui_index_find(ui.index_by_id, id);
+}
+
 size_t
 ui_get_index(Ui::Id id) {
   VERIFY(valid_id(id));
@@ -271,18 +445,18 @@ ui_get_index(Ui::Id id) {
   };
 
   if (cache_hit(id, 0)) {
+    g_ui.index_stats.finger_hits++;
     return fingers.index[0];
   }
   else if (cache_hit(id, 1)) {
+    g_ui.index_stats.finger_hits++;
     return fingers.index[1];
   }
 
-  log("ui_get_index finger cache miss, for id " IdFormat "(cached ids: " IdFormat " " IdFormat ")\n", id, fingers.id[0], fingers.id[1]);
+  g_ui.index_stats.finger_misses++;
+  LOG_TRACE(LogCategory_Tree, "ui_get_index finger cache miss, for id " IdFormat "(cached ids: " IdFormat " " IdFormat ")\n", id, fingers.id[0], fingers.id[1]);
 
-  size_t index;
-  for (index = 0; index < g_ui.node_ids.size(); index++) {
-    if (g_ui.node_ids[index] == id) break;
-  }
+  auto index = ui_find_index(g_ui, id);
   VERIFY(index < g_ui.node_ids.size()); // is this a case that needs instead to be legitimately handled, like if we have elements that disappear?
   fingers.id[next & 1] = id;
   fingers.index[next & 1] = index;
@@ -291,6 +465,11 @@ ui_get_index(Ui::Id id) {
   return index;
 }
 
+std::wstring_view
+ui_node_text(const Ui& ui, size_t index) {
+  return { ui.text.data() + ui.node_text_offset[index], ui.node_text_len[index] };
+}
+
 char const*
 type_desc(Ui::Type type) {
 COMPLETE_SWITCH_BEGIN
@@ -358,10 +537,17 @@ ui_down(int key) {
   return ui_down(UiVirtualKeyId(key));
 }
 
+// Without a window, as when replaying a session, client coordinates are used as screen coordinates.
 POINT
-ui_point_from_screen_point(const Ui& ui, double x, double y) {
+ui_client_origin_on_screen(const Ui& ui) {
   POINT LeftTop = { .x = 0, .y = 0 };
-  VERIFY(::ClientToScreen(ui.hwnd, &LeftTop));
+  if (ui.hwnd) VERIFY(::ClientToScreen(ui.hwnd, &LeftTop));
+  return LeftTop;
+}
+
+POINT
+ui_point_from_screen_point(const Ui& ui, double x, double y) {
+  auto LeftTop = ui_client_origin_on_screen(ui);
 
   return {
     .x = LONG(std::round(x - LeftTop.x)),
@@ -369,134 +555,295 @@ ui_point_from_screen_point(const Ui& ui, double x, double y) {
   };
 }
 
+// Returns the deepest node whose rect contains the point (the last one in presentation order, among equals),
+// or 0 when there is none.
 Ui::Id
 ui_search_deepest_node_containing(POINT pt) {
-  auto depth = 0;
-  Ui::Id id = 0;
-  for (size_t i = 0; i < g_ui.node_rect.size(); i++) {
-    auto d = g_ui.node_depth[i];
-    if (d < depth) continue;
+  auto& ui = g_ui;
+  rect_index_update(ui.rect_index, ui.node_rect, ui.node_depth);
+  auto found = rect_index_search_deepest(ui.rect_index, [pt](RECT r) { return contains(r, pt); });
+  return found == size_t(-1) ? 0 : ui.node_ids[found];
+}
 
-    auto r = g_ui.node_rect[i];
-    if (!contains(r, pt)) continue;
+// Navigation, in constant time thanks to the structure columns.
 
-    depth = d;
-    id = g_ui.node_ids[i];
-  }
-  return id;
+Ui::Id
+ui_id_at(const Ui& ui, size_t index) {
+  return index == size_t(-1) ? Ui::Id(-1) : ui.node_ids[index];
 }
 
 Ui::Id
 ui_prev_sibling(const Ui& ui, Ui::Id id) {
   VERIFY(valid_id(id));
   auto index = ui_get_index(id);
-  if (index == 0) return -1;
-  auto rf = std::make_reverse_iterator(ui.node_depth.begin() + index - 1);
-  auto rl = ui.node_depth.rend();
-  auto pos = std::find(rf, rl, ui.node_depth[index]);
-  if (pos == rl) return -1;
-  return ui.node_ids[std::distance(ui.node_depth.begin(), pos.base())];
+  return ui_id_at(ui, ui.node_prev_sibling[index]);
 }
 
 Ui::Id
 ui_next_sibling(const Ui& ui, Ui::Id id) {
   VERIFY(valid_id(id));
   auto index = ui_get_index(id);
-  if (index + 1 == ui.node_depth.size()) return -1;
-
-  auto f = ui.node_depth.begin();
-  auto l = ui.node_depth.end();
-  auto pos = std::find(f + index + 1, l, ui.node_depth[index]);
-  if (pos == ui.node_depth.end()) return -1;
-  return ui.node_ids[std::distance(f, pos)];
+  auto next = ui.node_subtree_end[index];
+  if (next >= ui.node_ids.size() || ui.node_depth[next] != ui.node_depth[index]) return -1;
+  return ui.node_ids[next];
 }
 
 Ui::Id
 ui_first_child(const Ui& ui, Ui::Id id) {
   VERIFY(valid_id(id));
   auto index = ui_get_index(id);
-  if (index + 1 == ui.node_depth.size()) return -1;
-
-  auto f = ui.node_depth.begin();
-  auto l = ui.node_depth.end();
-  auto pos = std::find(f + index + 1, l, ui.node_depth[index] + 1);
-  if (pos == ui.node_depth.end()) return -1;
-  return ui.node_ids[std::distance(f, pos)];
+  if (index + 1 >= ui.node_subtree_end[index]) return -1;
+  return ui.node_ids[index + 1];
 }
 
 Ui::Id
 ui_last_child(const Ui& ui, Ui::Id id) {
   VERIFY(valid_id(id));
   auto index = ui_get_index(id);
-  if (index + 1 == ui.node_depth.size()) return -1;
-
-  auto f = ui.node_depth.begin();
-  auto l = ui.node_depth.end();
-  l = std::find(f + index + 1, l, ui.node_depth[index]);
-  auto rf = std::make_reverse_iterator(l);
-  auto rl = std::make_reverse_iterator(f + index + 1);
-  auto pos = std::find(rf, rl, ui.node_depth[index] + 1);
-  if (pos == rl) return -1;
-  return ui.node_ids[std::distance(f, pos.base())];
+  return ui_id_at(ui, ui.node_last_child[index]);
 }
 
 // Describing the UI tree
 
 void
 ui_begin() {
+  TRACE_SPAN("ui", "ui_begin");
   auto& ui = g_ui;
-  
-  // for now we're recreating the structure each time, which doesn't allow detecting structural changes, which will be necessary later on.
-  /* remove buttons that no longer exist */ {
-    std::vector<Ui::Id> live_nodes = ui.node_ids;
-    std::sort(live_nodes.begin(), live_nodes.end());
 
-    std::vector<std::pair<Ui::Id, size_t>> button_nodes;
+  /* remove buttons that no longer exist */ {
+    size_t num_kept = 0;
     for (size_t i = 0; i < ui.buttons.ids.size(); i++) {
-      button_nodes.push_back({ ui.buttons.ids[i], i });
-    }
-    std::sort(button_nodes.begin(), button_nodes.end(), [](const auto& a, const auto& b) {
-      return a.first < b.first;
-    });
-
-    std::vector<std::pair<Ui::Id, size_t>> buttons_to_remove;
-    struct LessThan {
-      bool operator()(const std::pair<Ui::Id, size_t> a, const Ui::Id& b) {
-        return a.first < b;
-      }
-      bool operator()(const Ui::Id& a, const std::pair<Ui::Id, size_t> b) {
-        return a < b.first;
-      }
-    };
-
-    std::set_difference(button_nodes.begin(), button_nodes.end(), live_nodes.begin(), live_nodes.end(), std::back_inserter(buttons_to_remove), LessThan());
-    for (auto [id, index] : buttons_to_remove) {
-      VERIFY(ui.buttons.ids[index] == id);
-      ui.buttons.ids.erase(ui.buttons.ids.begin() + index);
-      ui.buttons.state.erase(ui.buttons.state.begin() + index);
+      if (ui_find_index(ui, ui.buttons.ids[i]) == size_t(-1)) continue;
+      ui.buttons.ids[num_kept] = ui.buttons.ids[i];
+      ui.buttons.state[num_kept] = ui.buttons.state[i];
+      num_kept++;
     }
+    ui.buttons.ids.resize(num_kept);
+    ui.buttons.state.resize(num_kept);
   }
 
+  // The tree we are about to replace becomes the previous one, for ui_end to compare against.
+  auto& prev = ui.previous;
+  std::swap(prev.node_ids, ui.node_ids);
+  std::swap(prev.node_text_offset, ui.node_text_offset);
+  std::swap(prev.node_text_len, ui.node_text_len);
+  std::swap(prev.node_type, ui.node_type);
+  std::swap(prev.node_parent, ui.node_parent);
+  std::swap(prev.node_depth, ui.node_depth);
+  std::swap(prev.node_rect, ui.node_rect);
+  std::swap(prev.text, ui.text);
+  std::swap(prev.node_parent_index, ui.node_parent_index);
+  std::swap(prev.node_subtree_end, ui.node_subtree_end);
+  std::swap(prev.node_prev_sibling, ui.node_prev_sibling);
+  std::swap(prev.node_last_child, ui.node_last_child);
+  std::swap(prev.index_by_id, ui.index_by_id);
+  std::swap(prev.memos, ui.memos);
+
   ui.node_ids.clear();
-  ui.node_names.clear();
+  ui.node_text_offset.clear();
+  ui.node_text_len.clear();
+  ui.text.clear();
   ui.node_type.clear();
   ui.node_depth.clear();
   ui.node_parent.clear();
   ui.node_rect.clear();
+  ui.rect_index.dirty = true;
+  ui.node_parent_index.clear();
+  ui.node_subtree_end.clear();
+  ui.node_prev_sibling.clear();
+  ui.node_last_child.clear();
+  ui.root_last_child = size_t(-1);
+  ui.open_node_stack.clear();
+  ui_index_clear(ui.index_by_id);
+
+  auto& memos = ui.memos;
+  memos.ids.clear();
+  memos.versions.clear();
+  memos.depth.clear();
+  memos.first_node.clear();
+  memos.num_nodes.clear();
+  memos.text_offset.clear();
+  memos.text_len.clear();
+  memos.reused.clear();
+  memos.has_buttons.clear();
+  memos.index_by_id.clear();
+  ui.open_memo_stack.clear();
 }
 
 void ui_uia_raise_events_for_updates(const Ui& ui);
+void ui_uia_release_providers(Ui& ui, bool only_for_removed_nodes);
+
+// Marks in `in_lis` a longest strictly increasing subsequence of `values`. O(n log n), by patience sorting.
+void
+longest_increasing_subsequence(const std::vector<size_t>& values, std::vector<size_t>& tails, std::vector<size_t>& prev, std::vector<bool>& in_lis) {
+  // tails[k]: the index of the smallest value that ends an increasing subsequence of length k + 1.
+  tails.clear();
+  prev.assign(values.size(), size_t(-1));
+  for (size_t i = 0; i < values.size(); i++) {
+    auto pos = std::lower_bound(tails.begin(), tails.end(), values[i], [&](size_t t, size_t v) { return values[t] < v; });
+    if (pos != tails.begin()) prev[i] = *(pos - 1);
+    if (pos == tails.end()) tails.push_back(i);
+    else *pos = i;
+  }
+  in_lis.assign(values.size(), false);
+  for (auto i = tails.empty() ? size_t(-1) : tails.back(); i != size_t(-1); i = prev[i]) {
+    in_lis[i] = true;
+  }
+}
+
+// The children of a reordered parent that are not in the longest increasing subsequence of their old indices are the
+// fewest that must move for the old order to become the new one, like keyed reconciliation in virtual DOMs.
+void
+ui_diff_find_moved_children(Ui& ui, size_t slot) {
+  auto& diff = ui.diff;
+  diff.siblings.clear();
+  diff.sibling_old_indices.clear();
+  auto end = slot == 0 ? ui.node_ids.size() : ui.node_subtree_end[slot - 1];
+  for (auto i = slot; i < end; i = ui.node_subtree_end[i]) { // the first child of the node at slot - 1 is at slot.
+    if (diff.old_index_of_new[i] == size_t(-1)) continue;
+    diff.siblings.push_back(i);
+    diff.sibling_old_indices.push_back(diff.old_index_of_new[i]);
+  }
+  longest_increasing_subsequence(diff.sibling_old_indices, diff.lis_tails, diff.lis_prev, diff.in_lis);
+  for (size_t k = 0; k < diff.siblings.size(); k++) {
+    if (diff.in_lis[k]) continue;
+    diff.moved[diff.siblings[k]] = true;
+    diff.num_moved[slot]++;
+  }
+}
+
+// Compares the tree with the one of the previous frame, to fill ui.structure_changes.
+//
+// Linear in the size of both trees, plus O(k log k) for each parent whose k kept children changed order. Nodes are matched by id, and since the id of a node is derived from the id of its
+// parent, a node and its match also have matching parents. While the trees agree, which is the common case, nodes are
+// matched in lockstep without looking up their ids.
+void
+ui_diff_structure(Ui& ui) {
+  TRACE_SPAN("ui", "ui_diff_structure");
+  constexpr uint32_t kMaxChildChangesPerParent = 4; // past that, one bulk change for the parent.
+  constexpr uint32_t kMaxMovesPerParent = 32; // past that, ChildrenReordered, and clients read all the children again.
+  constexpr uint32_t kBulkRaised = uint32_t(-1);
+  constexpr size_t kMaxStructureChanges = 256; // past that, clients had better read the whole tree again.
+
+  const auto& prev = ui.previous;
+  auto& diff = ui.diff;
+  auto& changes = ui.structure_changes;
+  changes.type.clear();
+  changes.id.clear();
+  changes.child.clear();
+  const auto add_change = [&](Ui::StructureChange type, Ui::Id id, Ui::Id child = 0) {
+    changes.type.push_back(type);
+    changes.id.push_back(id);
+    changes.child.push_back(child);
+  };
+
+  const auto num_new = ui.node_ids.size();
+  const auto num_old = prev.node_ids.size();
+  diff.old_index_of_new.assign(num_new, size_t(-1));
+  diff.new_index_of_old.assign(num_old, size_t(-1));
+  for (size_t i = 0, j = 0; i < num_new; i++) {
+    auto id = ui.node_ids[i];
+    auto old = j < num_old && prev.node_ids[j] == id ? j : ui_index_find(prev.index_by_id, id);
+    if (old == size_t(-1)) continue;
+    diff.old_index_of_new[i] = old;
+    diff.new_index_of_old[old] = i;
+    j = old + 1;
+  }
+
+  // Changes are counted per parent that is in both trees, at its new index + 1, so that the root is at 0.
+  // Children of added or removed nodes don't count, they come and go with them.
+  diff.num_added.assign(num_new + 1, 0);
+  diff.num_removed.assign(num_new + 1, 0);
+  diff.last_child_old_index.assign(num_new + 1, 0);
+  diff.reordered.assign(num_new + 1, false);
+  for (size_t i = 0; i < num_new; i++) {
+    auto parent = ui.node_parent_index[i];
+    auto slot = parent + 1;
+    auto old = diff.old_index_of_new[i];
+    if (old == size_t(-1)) {
+      if (parent == size_t(-1) || diff.old_index_of_new[parent] != size_t(-1)) diff.num_added[slot]++;
+    }
+    else {
+      // Kept children keep their order as long as their old indices keep increasing.
+      if (old < diff.last_child_old_index[slot]) diff.reordered[slot] = true;
+      diff.last_child_old_index[slot] = old;
+    }
+  }
+  const auto removed_slot = [&](size_t old) {
+    // size_t(-1) => not counted.
+    if (diff.new_index_of_old[old] != size_t(-1)) return size_t(-1);
+    auto old_parent = prev.node_parent_index[old];
+    if (old_parent == size_t(-1)) return size_t(0);
+    auto parent = diff.new_index_of_old[old_parent];
+    return parent == size_t(-1) ? size_t(-1) : parent + 1;
+  };
+  for (size_t j = 0; j < num_old; j++) {
+    auto slot = removed_slot(j);
+    if (slot != size_t(-1)) diff.num_removed[slot]++;
+  }
+  diff.num_moved.assign(num_new + 1, 0);
+  diff.moved.assign(num_new, false);
+  for (size_t slot = 0; slot <= num_new; slot++) {
+    if (diff.reordered[slot]) ui_diff_find_moved_children(ui, slot);
+  }
+
+  size_t num_changes = 0;
+  for (size_t slot = 0; slot <= num_new; slot++) {
+    num_changes += diff.num_added[slot] > kMaxChildChangesPerParent ? 1 : diff.num_added[slot];
+    num_changes += diff.num_removed[slot] > kMaxChildChangesPerParent ? 1 : diff.num_removed[slot];
+    num_changes += diff.num_moved[slot] > kMaxMovesPerParent ? 1 : diff.num_moved[slot];
+  }
+  if (num_changes > kMaxStructureChanges) {
+    add_change(Ui::StructureChange::kChildrenInvalidated, 0);
+    return;
+  }
+
+  const auto parent_id = [&](size_t slot) { return slot == 0 ? Ui::Id(0) : ui.node_ids[slot - 1]; };
+  for (size_t j = 0; j < num_old; j++) {
+    auto slot = removed_slot(j);
+    if (slot == size_t(-1) || diff.num_removed[slot] == kBulkRaised) continue;
+    if (diff.num_removed[slot] > kMaxChildChangesPerParent) {
+      add_change(Ui::StructureChange::kChildrenBulkRemoved, parent_id(slot));
+      diff.num_removed[slot] = kBulkRaised;
+      continue;
+    }
+    add_change(Ui::StructureChange::kChildRemoved, parent_id(slot), prev.node_ids[j]);
+  }
+  for (size_t i = 0; i < num_new; i++) {
+    auto parent = ui.node_parent_index[i];
+    auto slot = parent + 1;
+    if (diff.old_index_of_new[i] != size_t(-1) || (parent != size_t(-1) && diff.old_index_of_new[parent] == size_t(-1))) continue;
+    if (diff.num_added[slot] == kBulkRaised) continue;
+    if (diff.num_added[slot] > kMaxChildChangesPerParent) {
+      add_change(Ui::StructureChange::kChildrenBulkAdded, parent_id(slot));
+      diff.num_added[slot] = kBulkRaised;
+      continue;
+    }
+    add_change(Ui::StructureChange::kChildAdded, ui.node_ids[i]);
+  }
+  for (size_t i = 0; i < num_new; i++) {
+    auto slot = ui.node_parent_index[i] + 1;
+    if (diff.moved[i] && diff.num_moved[slot] <= kMaxMovesPerParent) {
+      add_change(Ui::StructureChange::kChildMoved, parent_id(slot), ui.node_ids[i]);
+    }
+  }
+  for (size_t slot = 0; slot <= num_new; slot++) {
+    if (diff.num_moved[slot] > kMaxMovesPerParent) add_change(Ui::StructureChange::kChildrenReordered, parent_id(slot));
+  }
+}
 
 void
 ui_end() {
+  TRACE_SPAN("ui", "ui_end");
   // Global input handlers, such as for focus changes:
   auto& ui = g_ui;
-  VERIFY(ui.focus.id == 0 || std::ranges::end(ui.node_ids) != std::ranges::find(ui.node_ids, ui.focus.id));
+  VERIFY(ui.focus.id == 0 || ui_find_index(ui, ui.focus.id) != size_t(-1));
 
   auto& inputs = ui.inputs;
   bool focus_next = false;
   bool focus_prev = false;
   if (inputs.updated) {
+    TRACE_SPAN("ui", "focus");
     focus_next = ui_on_press(VK_DOWN)
       || (!inputs.shift_key.is_down && ui_on_press({ VK_TAB }));
     focus_prev = ui_on_press(VK_UP)
@@ -505,7 +852,7 @@ ui_end() {
     if (!ui.focus.id && !ui.node_ids.empty() && (focus_next || focus_prev)) {
       ui_update_focus(ui, ui.node_ids[0]);
     } else if (focus_next) {
-      log("User wants to focus the next element (keyboard)\n");
+      LOG_INFO(LogCategory_Input, "User wants to focus the next element (keyboard)\n");
       VERIFY(!ui.focus.updated); // focus has already been updated?
       auto index = ui_get_index(ui.focus.id);
       if (index + 1 < ui.node_ids.size()) {
@@ -513,7 +860,7 @@ ui_end() {
         ui_update_focus(ui, ui.node_ids[index]);
       }
     } else if (focus_prev) {
-      log("User wants to focus the previous element (keyboard)\n");
+      LOG_INFO(LogCategory_Input, "User wants to focus the previous element (keyboard)\n");
       VERIFY(!ui.focus.updated); // focus has already been updated?
       auto index = ui_get_index(ui.focus.id);
       if (index > 0) {
@@ -523,7 +870,9 @@ ui_end() {
     }
   }
 
+  ui_diff_structure(ui);
   ui_uia_raise_events_for_updates(ui);
+  ui_uia_release_providers(ui, true);
 
   // reset button triggers:
   for (auto& state : ui.buttons.state) {
@@ -535,18 +884,15 @@ ui_end() {
   inputs.activated_buttons.clear();
   inputs.updated = false;
   VERIFY(g_ui.depth_for_adding_nodes == 0); // Unbalanced?
+  VERIFY(g_ui.open_memo_stack.empty()); // ui_memo_end missing?
 }
 
 size_t
 ui_search_parent_index_for_adding(const Ui& ui) {
-  auto index = ui.node_ids.size();
   auto depth = ui.depth_for_adding_nodes;
-  auto parent_depth = depth - 1;
-  auto parent_pos = std::find(ui.node_depth.rbegin(), ui.node_depth.rend(), parent_depth);
-  VERIFY(parent_pos != ui.node_depth.rend());
-  auto relative_index = std::distance(ui.node_depth.rbegin(), parent_pos);
-  auto parent_index = index - 1 - relative_index;
-  return parent_index;
+  auto parent_depth = size_t(depth - 1); // huge for a negative depth, which the VERIFY catches.
+  VERIFY(parent_depth < ui.open_node_stack.size()); // no node was added at the parent depth?
+  return ui.open_node_stack[parent_depth];
 }
 
 Ui::Id
@@ -556,32 +902,47 @@ ui_named_element(wchar_t const* name, Ui::Type type, wchar_t const* text) {
   auto depth = ui.depth_for_adding_nodes;
 
   Ui::Id parent_id = -1;
+  size_t parent_index = size_t(-1);
   if (depth == 0) {
     parent_id = 0;
   }
   else {
-    auto parent_index = ui_search_parent_index_for_adding(ui);
+    parent_index = ui_search_parent_index_for_adding(ui);
     parent_id = g_ui.node_ids[parent_index];
   }
+  ui.open_node_stack.resize(depth + 1);
+  ui.open_node_stack[depth] = index;
 
   auto num_bytes = wcslen(name) * sizeof name[0];
   auto genid = hash(num_bytes, name);
   genid = wyhash64(genid, parent_id);
 
-  auto id = Ui::Id(bits(genid, 0, 32));
+  auto id = Ui::Id(genid);
 
   VERIFY(valid_id(id));
-  VERIFY(ui.node_ids.end() == std::find(ui.node_ids.begin(), ui.node_ids.end(), id));
+  VERIFY(ui_index_insert(ui.index_by_id, id, index)); // duplicate id: either a hash collision or two siblings with the same name.
+  auto node_text = text ? text : name;
+  auto node_text_len = wcslen(node_text);
   ui.node_ids.push_back(id);
-  ui.node_names.push_back(text ? text : name);
+  ui.node_text_offset.push_back(ui.text.size());
+  ui.node_text_len.push_back(node_text_len);
+  ui.text.insert(ui.text.end(), node_text, node_text + node_text_len);
   ui.node_type.push_back(type);
   ui.node_depth.push_back(depth);
   ui.node_parent.push_back(parent_id);
+  ui.node_parent_index.push_back(parent_index);
   ui.node_rect.push_back({});
+  ui.node_subtree_end.push_back(index + 1); // extended by ui_pane_end for panes.
+  ui.node_last_child.push_back(size_t(-1));
+
+  auto& parent_last_child = parent_index == size_t(-1) ? ui.root_last_child : ui.node_last_child[parent_index];
+  ui.node_prev_sibling.push_back(parent_last_child);
+  parent_last_child = index;
 
   // TODO(nil): debug/hack
   ui.node_rect[index].right = 200;
   ui.node_rect[index].bottom = 200;
+  ui.rect_index.dirty = true;
   return id;
 }
 
@@ -633,23 +994,160 @@ ui_pane_end(Ui::Id pane) {
   VERIFY(pane == g_ui.node_ids[pane_index]);
   g_ui.depth_for_adding_nodes--;
   VERIFY(g_ui.depth_for_adding_nodes == g_ui.node_depth[pane_index]);
+  g_ui.node_subtree_end[pane_index] = g_ui.node_ids.size();
+}
+
+// Memoization: the rows of a subtree whose content hasn't changed are copied from the previous frame, without running
+// the code that describes it or hashing its names again. For large static sections such as help text or documents.
+//
+// if (ui_memo_begin(L"Help", help_version)) {
+//   ... describe the subtree ...
+// }
+// ui_memo_end();
+//
+// The key identifies the memo among its siblings, like the name of a node, and the caller bumps the version whenever
+// the content of the subtree changes. Subtrees with buttons are described again on frames with inputs, since
+// ui_button must run to report their activation.
+
+void
+ui_memo_push(Ui::Memos& memos, Ui::Id id, uint64_t version, int depth, size_t first_node, size_t text_offset) {
+  memos.ids.push_back(id);
+  memos.versions.push_back(version);
+  memos.depth.push_back(depth);
+  memos.first_node.push_back(first_node);
+  memos.num_nodes.push_back(0);
+  memos.text_offset.push_back(text_offset);
+  memos.text_len.push_back(0);
+  memos.reused.push_back(false);
+  memos.has_buttons.push_back(false);
+  VERIFY(memos.index_by_id.emplace(id, memos.ids.size() - 1).second); // two memos with the same key and parent?
+}
+
+// Appends the rows of the previous frame's memo, and the memos nested in it, shifted to their new place.
+void
+ui_memo_reuse(Ui& ui, size_t prev_memo) {
+  const auto& prev = ui.previous;
+  const auto first = prev.memos.first_node[prev_memo];
+  const auto last = first + prev.memos.num_nodes[prev_memo];
+  const auto depth = ui.depth_for_adding_nodes;
+  const auto parent_index = depth == 0 ? size_t(-1) : ui_search_parent_index_for_adding(ui);
+  auto& parent_last_child = parent_index == size_t(-1) ? ui.root_last_child : ui.node_last_child[parent_index];
+
+  // Unsigned arithmetic wraps around, so that these also work to shift rows towards the start.
+  const auto index_shift = ui.node_ids.size() - first;
+  const auto text_shift = ui.text.size() - prev.memos.text_offset[prev_memo];
+  const auto shift = [&](size_t index) { return index == size_t(-1) ? index : index + index_shift; };
+
+  auto text_first = prev.text.begin() + prev.memos.text_offset[prev_memo];
+  ui.text.insert(ui.text.end(), text_first, text_first + prev.memos.text_len[prev_memo]);
+
+  // Column by column, the unchanged ones with a single copy.
+  const auto dest = ui.node_ids.size();
+  const auto copy = [&](auto& column, const auto& prev_column) {
+    column.insert(column.end(), prev_column.begin() + first, prev_column.begin() + last);
+  };
+  const auto copy_shifted = [&](auto& column, const auto& prev_column, size_t column_shift) {
+    column.resize(dest + (last - first));
+    std::transform(prev_column.begin() + first, prev_column.begin() + last, column.begin() + dest, [&](size_t x) {
+      return x == size_t(-1) ? x : x + column_shift;
+    });
+  };
+  copy(ui.node_ids, prev.node_ids);
+  copy_shifted(ui.node_text_offset, prev.node_text_offset, text_shift);
+  copy(ui.node_text_len, prev.node_text_len);
+  copy(ui.node_type, prev.node_type);
+  copy(ui.node_depth, prev.node_depth);
+  copy(ui.node_parent, prev.node_parent);
+  copy(ui.node_rect, prev.node_rect);
+  copy_shifted(ui.node_subtree_end, prev.node_subtree_end, index_shift);
+  copy_shifted(ui.node_last_child, prev.node_last_child, index_shift);
+  copy_shifted(ui.node_parent_index, prev.node_parent_index, index_shift);
+  copy_shifted(ui.node_prev_sibling, prev.node_prev_sibling, index_shift);
+  for (auto k = first; k < last; k++) {
+    VERIFY(ui_index_insert(ui.index_by_id, prev.node_ids[k], k + index_shift)); // duplicate id: a sibling of the memo has the name of one of its nodes?
+  }
+
+  // The top-level nodes of the memo hang from the current parent, after its current last child.
+  ui.open_node_stack.resize(depth + 1);
+  for (auto index = dest; index < ui.node_ids.size(); index = ui.node_subtree_end[index]) {
+    VERIFY(ui.node_depth[index] == depth);
+    ui.node_parent_index[index] = parent_index;
+    ui.node_prev_sibling[index] = index == dest ? parent_last_child : ui.node_prev_sibling[index];
+    parent_last_child = index;
+    ui.open_node_stack[depth] = index;
+  }
+  ui.rect_index.dirty = true;
+
+  for (auto m = prev_memo + 1; m < prev.memos.ids.size() && prev.memos.first_node[m] < last; m++) {
+    ui_memo_push(ui.memos, prev.memos.ids[m], prev.memos.versions[m], prev.memos.depth[m],
+      shift(prev.memos.first_node[m]), prev.memos.text_offset[m] + text_shift);
+    ui.memos.num_nodes.back() = prev.memos.num_nodes[m];
+    ui.memos.text_len.back() = prev.memos.text_len[m];
+    ui.memos.reused.back() = true;
+    ui.memos.has_buttons.back() = prev.memos.has_buttons[m];
+  }
+}
+
+// Returns true when the subtree must be described, false when it was copied from the previous frame.
+// Call ui_memo_end in both cases.
+bool
+ui_memo_begin(wchar_t const* key, uint64_t version) {
+  auto& ui = g_ui;
+  auto depth = ui.depth_for_adding_nodes;
+  Ui::Id parent_id = depth == 0 ? 0 : ui.node_ids[ui_search_parent_index_for_adding(ui)];
+  auto id = Ui::Id(wyhash64(hash(wcslen(key) * sizeof key[0], key), parent_id));
+
+  auto memo = ui.memos.ids.size();
+  ui_memo_push(ui.memos, id, version, depth, ui.node_ids.size(), ui.text.size());
+  ui.open_memo_stack.push_back(memo);
+
+  const auto& prev_memos = ui.previous.memos;
+  auto pos = prev_memos.index_by_id.find(id);
+  if (pos == prev_memos.index_by_id.end()) return true;
+  auto prev_memo = pos->second;
+  if (prev_memos.versions[prev_memo] != version) return true;
+  if (prev_memos.has_buttons[prev_memo] && ui.inputs.updated) return true;
+
+  TRACE_SPAN("ui", "ui_memo_reuse");
+  ui_memo_reuse(ui, prev_memo);
+  ui.memos.reused[memo] = true;
+  ui.memos.has_buttons[memo] = prev_memos.has_buttons[prev_memo];
+  return false;
+}
+
+void
+ui_memo_end() {
+  auto& ui = g_ui;
+  auto& memos = ui.memos;
+  VERIFY(!ui.open_memo_stack.empty()); // no ui_memo_begin?
+  auto memo = ui.open_memo_stack.back();
+  ui.open_memo_stack.pop_back();
+  VERIFY(ui.depth_for_adding_nodes == memos.depth[memo]); // Unbalanced?
+
+  memos.num_nodes[memo] = ui.node_ids.size() - memos.first_node[memo];
+  memos.text_len[memo] = ui.text.size() - memos.text_offset[memo];
+  if (!memos.reused[memo]) {
+    auto first = ui.node_type.begin() + memos.first_node[memo];
+    memos.has_buttons[memo] = std::find(first, ui.node_type.end(), Ui::Type::kButton) != ui.node_type.end();
+  }
 }
 
 void
 ui_log_structure() {
+  if (!LOG_ENABLED(LogCategory_Tree, LogLevel_Info)) return;
   log("UI Tree:\n");
   for (size_t i = 0; i < g_ui.node_ids.size(); i++) {
     unsigned long long id = g_ui.node_ids[i];
     int depth = g_ui.node_depth[i];
     auto type = g_ui.node_type[i];
-    const auto& name = g_ui.node_names[i];
+    auto name = ui_node_text(g_ui, i);
     log("%*s", 2 + 4 * int(depth), "");
     log("node: type(%s)", type_desc(type));
     log(" " IdFormat, id);
     if (g_ui.focus.id == id) {
       log("*");
     }
-    log(" (%ls)\n", name.data());
+    log(" (%.*ls)\n", int(name.size()), name.data());
   }
   log("\n");
 }
@@ -669,13 +1167,14 @@ void main_update();
 // Some horrible macros to make defining COM objects more tolerable. I'll find
 // an alternative some other day.
 
-#define LOG_DEFINE_METHOD(cls_)          \
-  void log(char const* fmt, ...) {       \
-    ::log("this(%p) " #cls_ "::", this);  \
-    std::va_list args;                   \
-    va_start(args, fmt);                 \
-    ::logv(fmt, args);                   \
-    va_end(args);                        \
+#define LOG_DEFINE_METHOD(cls_, category_)                  \
+  static constexpr LogCategory log_category = category_;    \
+  void log(char const* fmt, ...) {                          \
+    ::log("this(%p) " #cls_ "::", this);                    \
+    std::va_list args;                                      \
+    va_start(args, fmt);                                    \
+    ::logv(fmt, args);                                      \
+    va_end(args);                                           \
   }
 
 #define IUNKNOWN_DEFS \
@@ -689,8 +1188,7 @@ void main_update();
 
 UiaRect
 ui_screen_rect(const Ui& ui, Ui::Id id) {
-  POINT LeftTop = { .x = 0, .y = 0 };
-  VERIFY(::ClientToScreen(ui.hwnd, &LeftTop));
+  auto LeftTop = ui_client_origin_on_screen(ui);
   auto r = ui.node_rect[ui_get_index(id)];
   return {
     .left = double(LeftTop.x + r.left),
@@ -703,14 +1201,21 @@ ui_screen_rect(const Ui& ui, Ui::Id id) {
 IRawElementProviderFragment*
 create_element_provider(Ui::Id id);
 
+std::array<int, 2>
+ui_uia_runtime_id(Ui::Id id) {
+  return { int(UiaAppendRuntimeId), int(bits(id, 0, 32)) };
+}
+
 struct RootProvider : public IRawElementProviderSimple
   , public IRawElementProviderFragmentRoot
   , public IRawElementProviderFragment {
   // IRawElementProviderFragmentRoot
   HRESULT STDMETHODCALLTYPE ElementProviderFromPoint(double x, double y, IRawElementProviderFragment** pRetVal) override {
-    log("%s\n", __func__);
+    MEASURE_LATENCY("RootProvider::ElementProviderFromPoint");
+    LOG_TRACE(log_category, "%s\n", __func__);
     COM_REQUIRE_PTR(pRetVal);
     auto pt = ui_point_from_screen_point(g_ui, x, y);
+    session_record_call(SessionCall::kElementProviderFromPoint, 0, pt.x, pt.y);
     auto id = ui_search_deepest_node_containing(pt);
     if (id) {
       *pRetVal = create_element_provider(id);
@@ -723,6 +1228,8 @@ struct RootProvider : public IRawElementProviderSimple
   }
 
   HRESULT STDMETHODCALLTYPE GetFocus(IRawElementProviderFragment** pRetVal) {
+    MEASURE_LATENCY("RootProvider::GetFocus");
+    session_record_call(SessionCall::kGetFocus, 0);
     COM_REQUIRE_PTR(pRetVal);
     if (g_ui.focus.id) {
       *pRetVal = create_element_provider(g_ui.focus.id);
@@ -732,11 +1239,12 @@ struct RootProvider : public IRawElementProviderSimple
 
   // IRawElementProviderFragment
   HRESULT STDMETHODCALLTYPE get_BoundingRectangle(UiaRect* pRetVal) override {
+    MEASURE_LATENCY("RootProvider::get_BoundingRectangle");
+    session_record_call(SessionCall::kGetBoundingRectangle, 0);
     COM_REQUIRE_PTR(pRetVal);
-    RECT ClientRect;
-    VERIFY(::GetClientRect(g_ui.hwnd, &ClientRect));
-    POINT LeftTop = { .x = ClientRect.left, .y = ClientRect.top };
-    VERIFY(::ClientToScreen(g_ui.hwnd, &LeftTop));
+    RECT ClientRect = {};
+    if (g_ui.hwnd) VERIFY(::GetClientRect(g_ui.hwnd, &ClientRect));
+    auto LeftTop = ui_client_origin_on_screen(g_ui);
     pRetVal->left = double(LeftTop.x);
     pRetVal->top = double(LeftTop.y);
     pRetVal->width = double(ClientRect.right) - ClientRect.left;
@@ -744,41 +1252,35 @@ struct RootProvider : public IRawElementProviderSimple
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE get_FragmentRoot(IRawElementProviderFragmentRoot** pRetVal) override {
+    MEASURE_LATENCY("RootProvider::get_FragmentRoot");
     COM_REQUIRE_PTR(pRetVal);
     this->AddRef();
     *pRetVal = this;
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE GetEmbeddedFragmentRoots(SAFEARRAY** pRetVal) override {
+    MEASURE_LATENCY("RootProvider::GetEmbeddedFragmentRoots");
     COM_REQUIRE_PTR(pRetVal);
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE GetRuntimeId(SAFEARRAY** pRetVal) override {
+    MEASURE_LATENCY("RootProvider::GetRuntimeId");
+    session_record_call(SessionCall::kGetRuntimeId, 0);
     COM_REQUIRE_PTR(pRetVal);
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE Navigate(NavigateDirection direction, IRawElementProviderFragment** pRetVal) override {
+    MEASURE_LATENCY("RootProvider::Navigate");
+    session_record_call(SessionCall::kNavigate, 0, direction);
     COM_REQUIRE_PTR(pRetVal);
     Ui::Id found_id = -1;
-    const auto find_at_depth = [](auto First, auto Last, int depth) -> Ui::Id {
-      auto first_pos = std::find(First, Last, 0);
-      if (first_pos == Last) return -1;
-      auto index = std::distance(First, first_pos);
-      return g_ui.node_ids[std::distance(First, first_pos)];
-    };
 COMPLETE_SWITCH_BEGIN
       switch (direction) {
       case NavigateDirection_FirstChild: {
-        auto f = g_ui.node_depth.begin();
-        auto l = g_ui.node_depth.end();
-        auto pos = std::find(f, l, 0);
-        found_id = pos == l ? -1 : g_ui.node_ids[std::distance(g_ui.node_depth.begin(), pos)];
+        found_id = g_ui.node_ids.empty() ? -1 : g_ui.node_ids[0];
       } break;
       case NavigateDirection_LastChild: {
-        auto f = g_ui.node_depth.rbegin();
-        auto l = g_ui.node_depth.rend();
-        auto pos = std::find(f, l, 0);
-        found_id = pos == l ? -1 : g_ui.node_ids[std::distance(g_ui.node_depth.begin(), pos.base())];
+        found_id = ui_id_at(g_ui, g_ui.root_last_child);
       } break;
 
       case NavigateDirection_Parent: break; // nothing to return, per spec
@@ -792,26 +1294,34 @@ COMPLETE_SWITCH_END
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE SetFocus() override {
+    MEASURE_LATENCY("RootProvider::SetFocus");
+    session_record_call(SessionCall::kSetFocus, 0);
     return S_OK;
   }
 
   // IRawElementProviderSimple
   HRESULT STDMETHODCALLTYPE get_HostRawElementProvider(IRawElementProviderSimple** pRetVal) override {
+    MEASURE_LATENCY("RootProvider::get_HostRawElementProvider");
     return UiaHostProviderFromHwnd(g_ui.hwnd, pRetVal);
   }
   HRESULT STDMETHODCALLTYPE get_ProviderOptions(ProviderOptions* pRetVal) override {
+    MEASURE_LATENCY("RootProvider::get_ProviderOptions");
     return ProviderOptions_ServerSideProvider | ProviderOptions_UseComThreading;
   }
   HRESULT STDMETHODCALLTYPE GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal) override {
+    MEASURE_LATENCY("RootProvider::GetPatternProvider");
+    session_record_call(SessionCall::kGetPatternProvider, 0, patternId);
     COM_REQUIRE_PTR(pRetVal);
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE GetPropertyValue(PROPERTYID propertyId, VARIANT* pRetVal) override {
+    MEASURE_LATENCY("RootProvider::GetPropertyValue");
+    session_record_call(SessionCall::kGetPropertyValue, 0, propertyId);
     COM_REQUIRE_PTR(pRetVal);
     return S_OK;
   }
 
-  LOG_DEFINE_METHOD(RootProvider)
+  LOG_DEFINE_METHOD(RootProvider, LogCategory_Providers)
   IUNKNOWN_DEFS;
 };
 
@@ -820,6 +1330,8 @@ struct AnyElementProvider : public IRawElementProviderSimple, public IRawElement
 
   // IInvokeProvider
   HRESULT STDMETHODCALLTYPE Invoke() override {
+    MEASURE_LATENCY("AnyElementProvider::Invoke");
+    session_record_call(SessionCall::kInvoke, id);
     VERIFY(g_ui.node_type[ui_get_index(id)] == Ui::Type::kButton);
     ui_update_button_activate(g_ui, id);
     main_update(); // TODO(nil): TAG(UIThread): or post a message so it is pulled from the main ui thread?
@@ -828,6 +1340,8 @@ struct AnyElementProvider : public IRawElementProviderSimple, public IRawElement
 
   // IRawElementProviderFragment
   HRESULT STDMETHODCALLTYPE get_BoundingRectangle(UiaRect* pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::get_BoundingRectangle");
+    session_record_call(SessionCall::kGetBoundingRectangle, id);
     COM_REQUIRE_PTR(pRetVal);
     auto ScreenRect = ui_screen_rect(g_ui, id);
     *pRetVal = ScreenRect;
@@ -835,17 +1349,21 @@ struct AnyElementProvider : public IRawElementProviderSimple, public IRawElement
   }
 
   HRESULT STDMETHODCALLTYPE get_FragmentRoot(IRawElementProviderFragmentRoot** pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::get_FragmentRoot");
     COM_REQUIRE_PTR(pRetVal);
     return g_ui.root_provider.QueryInterface<IRawElementProviderFragmentRoot>(pRetVal);
   }
 
   HRESULT STDMETHODCALLTYPE GetEmbeddedFragmentRoots(SAFEARRAY** pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::GetEmbeddedFragmentRoots");
     COM_REQUIRE_PTR(pRetVal);
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE GetRuntimeId(SAFEARRAY** pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::GetRuntimeId");
+    session_record_call(SessionCall::kGetRuntimeId, id);
     COM_REQUIRE_PTR(pRetVal);
-    std::array ids{ int(UiaAppendRuntimeId), int(id) };
+    auto ids = ui_uia_runtime_id(id);
     auto psa = ::SafeArrayCreateVector(VT_I4, 0, LONG(ids.size()));
     if (!psa) return E_OUTOFMEMORY;
 
@@ -856,6 +1374,8 @@ struct AnyElementProvider : public IRawElementProviderSimple, public IRawElement
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE Navigate(NavigateDirection direction, IRawElementProviderFragment** pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::Navigate");
+    session_record_call(SessionCall::kNavigate, id, direction);
     COM_REQUIRE_PTR(pRetVal);
     Ui::Id found_id = -1;
 
@@ -896,6 +1416,8 @@ COMPLETE_SWITCH_END
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE SetFocus() override {
+    MEASURE_LATENCY("AnyElementProvider::SetFocus");
+    session_record_call(SessionCall::kSetFocus, id);
     ui_update_focus(g_ui, id);
     main_update(); // TODO(nil): TAG(UIThread): or post a message so it is pulled from the main ui thread?
     return S_OK;
@@ -903,13 +1425,17 @@ COMPLETE_SWITCH_END
 
   // IRawElementProviderSimple
   HRESULT STDMETHODCALLTYPE get_HostRawElementProvider(IRawElementProviderSimple** pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::get_HostRawElementProvider");
     COM_REQUIRE_PTR(pRetVal);
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE get_ProviderOptions(ProviderOptions* pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::get_ProviderOptions");
     return ProviderOptions_ServerSideProvider | ProviderOptions_UseComThreading;
   }
   HRESULT STDMETHODCALLTYPE GetPatternProvider(PATTERNID patternId, IUnknown** pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::GetPatternProvider");
+    session_record_call(SessionCall::kGetPatternProvider, id, patternId);
     COM_REQUIRE_PTR(pRetVal);
 
     auto this_index = ui_get_index(id);
@@ -923,12 +1449,15 @@ COMPLETE_SWITCH_END
     return S_OK;
   }
   HRESULT STDMETHODCALLTYPE GetPropertyValue(PROPERTYID propertyId, VARIANT* pRetVal) override {
+    MEASURE_LATENCY("AnyElementProvider::GetPropertyValue");
+    session_record_call(SessionCall::kGetPropertyValue, id, propertyId);
     COM_REQUIRE_PTR(pRetVal);
     auto this_index = ui_get_index(id);
     switch (propertyId) {
     case UIA_NamePropertyId: {
+      auto name = ui_node_text(g_ui, this_index);
       pRetVal->vt = VT_BSTR;
-      pRetVal->bstrVal = ::SysAllocString(g_ui.node_names[this_index].data());
+      pRetVal->bstrVal = ::SysAllocStringLen(name.data(), UINT(name.size()));
     } break;
     case UIA_IsKeyboardFocusablePropertyId: {
       pRetVal->vt = VT_BOOL;
@@ -954,14 +1483,36 @@ COMPLETE_SWITCH_END
     return S_OK;
   }
 
-  LOG_DEFINE_METHOD(AnyElementProvider)
-  IUNKNOWN_DEFS;
+  LOG_DEFINE_METHOD(AnyElementProvider, LogCategory_Providers)
+
+  ULONG STDMETHODCALLTYPE AddRef() override { return ++reference_count; }
+  ULONG STDMETHODCALLTYPE Release() override {
+    VERIFY(reference_count > 0);
+    if (--reference_count == 0) {
+      delete this;
+      return 0;
+    }
+    return reference_count;
+  }
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
+
+  ULONG reference_count = 1;
+
+  static void* operator new(size_t size) {
+    VERIFY(size == sizeof(AnyElementProvider));
+    return pool.allocate();
+  }
+  static void operator delete(void* p) { pool.deallocate(p); }
+  static SlabPool<AnyElementProvider> pool;
 
   Ui::Id id;
 };
 
+SlabPool<AnyElementProvider> AnyElementProvider::pool;
+
 HRESULT
 RootProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("RootProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IRawElementProviderSimple) return { "IRawElementProviderSimple", static_cast<IRawElementProviderSimple*>(this) };
@@ -979,29 +1530,27 @@ RootProvider::QueryInterface(REFIID riid, void** ppvObject) {
   }
 
   COM_REQUIRE_PTR(ppvObject);
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  if (false) {
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
     log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
   }
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (false) {
-      if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
-    }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  if (false) {
-    log("  supported_interface %s\n", result.first);
-  }
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
 HRESULT
 AnyElementProvider::QueryInterface(REFIID riid, void** ppvObject) {
+  MEASURE_LATENCY("AnyElementProvider::QueryInterface");
   auto result = [&]() -> std::pair<char const*, void*> {
     // supported interfaces:
     if (riid == IID_IRawElementProviderSimple) return { "IRawElementProviderSimple", static_cast<IRawElementProviderSimple*>(this) };
@@ -1019,42 +1568,127 @@ AnyElementProvider::QueryInterface(REFIID riid, void** ppvObject) {
   }
 
   COM_REQUIRE_PTR(ppvObject);
-  LPOLESTR riid_string;
-  VERIFYHR(::StringFromIID(riid, &riid_string));
-  if (false) {
+  if (LOG_ENABLED(log_category, LogLevel_Trace)) {
+    LPOLESTR riid_string;
+    VERIFYHR(::StringFromIID(riid, &riid_string));
     log("%s %u (%ls)\n", __func__, riid.Data1, riid_string);
+    ::CoTaskMemFree(riid_string);
   }
 
   *ppvObject = result.second; // it's important to also assign it a value even if E_NOTINTERFACE
   if (!result.second) {
-    if (false) {
-      if (result.first) { log("  missing %s interface (not supported)\n", result.first); }
-    }
+    if (result.first) { LOG_TRACE(log_category, "  missing %s interface (not supported)\n", result.first); }
     return E_NOINTERFACE;
   }
 
   AddRef();
-  if (false) {
-    log("  supported_interface %s\n", result.first);
-  }
+  LOG_TRACE(log_category, "  supported_interface %s\n", result.first);
   return S_OK;
 }
 
 IRawElementProviderFragment*
 create_element_provider(Ui::Id id) {
-  return new AnyElementProvider(id);
+  auto& cache = g_ui.providers;
+  auto [pos, inserted] = cache.try_emplace(id, nullptr);
+  if (inserted) {
+    pos->second = new AnyElementProvider(id); // the reference held by the cache.
+  }
+  pos->second->AddRef();
+  return pos->second;
+}
+
+/// Drops the references of the cache, for nodes that have disappeared from the tree or for all of them.
+/// Clients may still hold on to these providers, in which case they stay alive until released.
+void
+ui_uia_release_providers(Ui& ui, bool only_for_removed_nodes) {
+  TRACE_SPAN("uia", "ui_uia_release_providers");
+  auto& cache = ui.providers;
+  for (auto pos = cache.begin(); pos != cache.end();) {
+    if (only_for_removed_nodes && ui_find_index(ui, pos->first) != size_t(-1)) {
+      ++pos;
+      continue;
+    }
+    pos->second->Release();
+    pos = cache.erase(pos);
+  }
+}
+
+
+char const*
+structure_change_desc(Ui::StructureChange type) {
+COMPLETE_SWITCH_BEGIN
+  switch (type) {
+  case Ui::StructureChange::kChildAdded: return "child added";
+  case Ui::StructureChange::kChildRemoved: return "child removed";
+  case Ui::StructureChange::kChildrenInvalidated: return "children invalidated";
+  case Ui::StructureChange::kChildrenBulkAdded: return "children bulk added";
+  case Ui::StructureChange::kChildrenBulkRemoved: return "children bulk removed";
+  case Ui::StructureChange::kChildrenReordered: return "children reordered";
+  case Ui::StructureChange::kChildMoved: return "child moved";
+  }
+COMPLETE_SWITCH_END
+  VERIFY(0);
+  return "(unknown)";
 }
 
+// Raised on the element that changed: the new child for kChildAdded, the parent otherwise.
+void
+ui_uia_raise_structure_changed(Ui::StructureChange type, Ui::Id id, Ui::Id child) {
+  if (type == Ui::StructureChange::kChildMoved) {
+    // UIA has no moves: the child leaves its old place and is added at its new one.
+    ui_uia_raise_structure_changed(Ui::StructureChange::kChildRemoved, id, child);
+    ui_uia_raise_structure_changed(Ui::StructureChange::kChildAdded, child, 0);
+    return;
+  }
+
+  ComOwner<IRawElementProviderSimple> sp;
+  if (id == 0) {
+    if (!g_ui.root_provider) return; // no client has asked for the tree yet.
+    VERIFYHR(g_ui.root_provider.QueryInterface(sp.Slot()));
+  }
+  else {
+    ComOwner p = create_element_provider(id);
+    VERIFYHR(p.QueryInterface(sp.Slot()));
+  }
+
+  StructureChangeType uia_type = StructureChangeType_ChildrenInvalidated;
+COMPLETE_SWITCH_BEGIN
+  switch (type) {
+  case Ui::StructureChange::kChildAdded: uia_type = StructureChangeType_ChildAdded; break;
+  case Ui::StructureChange::kChildRemoved: uia_type = StructureChangeType_ChildRemoved; break;
+  case Ui::StructureChange::kChildrenInvalidated: uia_type = StructureChangeType_ChildrenInvalidated; break;
+  case Ui::StructureChange::kChildrenBulkAdded: uia_type = StructureChangeType_ChildrenBulkAdded; break;
+  case Ui::StructureChange::kChildrenBulkRemoved: uia_type = StructureChangeType_ChildrenBulkRemoved; break;
+  case Ui::StructureChange::kChildrenReordered: uia_type = StructureChangeType_ChildrenReordered; break;
+  case Ui::StructureChange::kChildMoved: VERIFY(0); break;
+  }
+COMPLETE_SWITCH_END
+
+  // The runtime id of the removed child, or of the element itself. The root has none of its own. (it comes from the window)
+  auto runtime_id_of = type == Ui::StructureChange::kChildRemoved ? child : id;
+  auto runtime_id = ui_uia_runtime_id(runtime_id_of);
+  VERIFYHR(::UiaRaiseStructureChangedEvent(sp, uia_type, runtime_id_of ? runtime_id.data() : nullptr, runtime_id_of ? int(runtime_id.size()) : 0));
+  LOG_INFO(LogCategory_Events, "raised structure changed (%s) for " IdFormat "\n", structure_change_desc(type), id);
+}
 
 void
 ui_uia_raise_events_for_updates(const Ui& ui) {
+  TRACE_SPAN("uia", "ui_uia_raise_events_for_updates");
+  if (!ui.hwnd) return; // replaying a session: no window, no clients.
   if (!::UiaClientsAreListening()) return;
 
+  // Before the focus moves onto new nodes, so that clients know about them.
+  const auto& changes = ui.structure_changes;
+  for (size_t i = 0; i < changes.type.size(); i++) {
+    ui_uia_raise_structure_changed(changes.type[i], changes.id[i], changes.child[i]);
+  }
+
   if (ui.focus.updated) {
     ComOwner p = create_element_provider(g_ui.focus.id);
     ComOwner<IRawElementProviderSimple> sp;
     VERIFYHR(p.QueryInterface(sp.Slot()));
     VERIFYHR(UiaRaiseAutomationEvent(sp, UIA_AutomationFocusChangedEventId));
+    LOG_INFO(LogCategory_Events, "raised focus changed for " IdFormat "\n", g_ui.focus.id);
   }
 
   for (size_t i = 0; i < ui.buttons.state.size(); i++) {
@@ -1066,6 +1700,7 @@ ui_uia_raise_events_for_updates(const Ui& ui) {
       ComOwner<IRawElementProviderSimple> sp;
       VERIFYHR(p.QueryInterface(sp.Slot()));
       UiaRaiseAutomationEvent(sp, UIA_Invoke_InvokedEventId);
+      LOG_INFO(LogCategory_Events, "raised invoked for " IdFormat "\n", id);
     }
   }
 }
@@ -1091,12 +1726,14 @@ INT_PTR about_dlgproc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
 
 void
 main_update() {
+  TRACE_SPAN("frame", "main_update");
   // Ui State:
   static auto show_content = false;
 
   auto content_need_refresh = true; // The loop is not necessary if we explicitely have two phases: event handling and content display. (as long as we ensure that ids are stable across the two phases, like for instance for a button that could change label when toggled)
   while (content_need_refresh) {
     content_need_refresh = false;
+    TRACE_SPAN("ui", "rebuild");
     ui_begin();
     if (auto pane = ui_pane_begin(L"Main")) {
       auto show_content_button = ui_button(L"Content Toggle", show_content ? L"Hide Content" : L"Show Content");
@@ -1114,7 +1751,7 @@ main_update() {
       }
       ui_text_paragraph(L"You may close this app with the next button.");
       if (ui_button(L"Close application.").activated) {
-        log("User requested to close the application by pressing the button.\n");
+        LOG_INFO(LogCategory_Input, "User requested to close the application by pressing the button.\n");
         ::SendMessage(g_ui.hwnd, WM_CLOSE, 0, 0); // TAG(UIThread) A thread cannot use DestroyWindow to destroy a window created by a different thread
         //VERIFY(::DestroyWindow(g_ui.hwnd));
       }
@@ -1125,6 +1762,29 @@ main_update() {
   ui_log_structure();
 }
 
+// For a WM_KEYDOWN or WM_KEYUP of `vk`. keys: the keyboard state, as returned by GetKeyboardState.
+void
+main_on_key(bool down, int vk, BYTE const keys[256]) {
+  session_record_keys(down, uint8_t(vk), keys);
+  auto& dest = g_ui.inputs;
+  for (size_t i = 0; i < 256; i++) {
+    ui_update(&dest.keys_per_vk[i], bit(keys[i], 7));
+  }
+  ui_update(&dest.shift_key, bit(keys[VK_SHIFT], 7));
+  VERIFY(ui_down(vk) == down);
+
+  g_ui.inputs.updated = true;
+  main_update();
+}
+
+// When a client first asks for our root.
+void
+main_on_root_requested() {
+  session_record_call(SessionCall::kGetObject, 0);
+  g_ui.root_provider = new RootProvider;
+  main_update();
+}
+
 LRESULT CALLBACK
 main_window_proc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ WPARAM wParam, _In_ LPARAM lParam) {
   switch (uMsg) {
@@ -1140,38 +1800,74 @@ main_window_proc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ WPARAM wParam, _In_ LPARAM
   } break;
 
   case WM_GETOBJECT: {
+    TRACE_SPAN("input", "WM_GETOBJECT");
     if (UiaRootObjectId == (DWORD)lParam) {
       if (!g_ui.root_provider) {
-        g_ui.root_provider = new RootProvider;
-        main_update();
+        main_on_root_requested();
       }
       return ::UiaReturnRawElementProvider(hwnd, wParam, lParam, g_ui.root_provider.ptr);
     }
   } break;
   case WM_KEYDOWN: // fallthrough
   case WM_KEYUP: {
+    TRACE_SPAN("input", uMsg == WM_KEYDOWN ? "WM_KEYDOWN" : "WM_KEYUP");
     BYTE keys[256];
     VERIFY(::GetKeyboardState(keys));
-    auto& dest = g_ui.inputs;
-    for (size_t i = 0; i < std::size(keys); i++) {
-      ui_update(&dest.keys_per_vk[i], bit(keys[i], 7));
-    }
-    ui_update(&dest.shift_key, bit(keys[VK_SHIFT], 7));
-
-    auto this_key = LOWORD(wParam);
-    VERIFY(ui_down(this_key) == (uMsg == WM_KEYDOWN));
-    VERIFY((uMsg == WM_KEYDOWN) || ((uMsg == WM_KEYUP) && !ui_down(this_key)));
-
-    g_ui.inputs.updated = true;
-    main_update();
+    main_on_key(uMsg == WM_KEYDOWN, LOWORD(wParam), keys);
   } break;
   }
 
   return DefWindowProcW(hwnd, uMsg, wParam, lParam);
 }
 
+void ui_benchmark();
+void main_replay(char const* path);
+
+// For `--name=<path>`, or `--name` alone which stands for default_path. Empty when the option is absent.
+std::string
+command_line_path(wchar_t const* cmdline, wchar_t const* name, char const* default_path) {
+  auto option = cmdline ? std::wcsstr(cmdline, name) : nullptr;
+  if (!option) return {};
+  option += std::wcslen(name);
+  if (*option != L'=') return default_path;
+  option++;
+  auto size = int(std::wcscspn(option, L" \t"));
+  std::string path(::WideCharToMultiByte(CP_ACP, 0, option, size, nullptr, 0, nullptr, nullptr), '\0');
+  ::WideCharToMultiByte(CP_ACP, 0, option, size, path.data(), int(path.size()), nullptr, nullptr);
+  return path;
+}
+
+// Writes out what is left in the log and the trace before the process goes down.
+LONG WINAPI
+on_unhandled_exception(EXCEPTION_POINTERS*) {
+  binary_log_flush();
+  if (g_trace.enabled) trace_write("trace.json");
+  return EXCEPTION_CONTINUE_SEARCH;
+}
+
 int __stdcall
 wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nShowCmd) {
+  ::SetUnhandledExceptionFilter(on_unhandled_exception);
+  if (!log_levels_parse_command_line(lpCmdLine)) {
+    log("Ignoring some --log options. Expected --log=<category>:<level>.\n");
+  }
+  if (lpCmdLine && std::wcsstr(lpCmdLine, L"--trace")) {
+    trace_start(); // written to trace.json at exit.
+  }
+  if (lpCmdLine && std::wcsstr(lpCmdLine, L"--benchmark")) {
+    ui_benchmark();
+    return 0;
+  }
+  if (auto path = command_line_path(lpCmdLine, L"--replay", "session.rec"); !path.empty()) {
+    main_replay(path.c_str()); // without a window or COM.
+    return 0;
+  }
+  if (auto path = command_line_path(lpCmdLine, L"--record", "session.rec"); !path.empty()) {
+    if (!session_record_start(path.c_str())) {
+      log("Could not create %s, the session will not be recorded.\n", path.c_str());
+    }
+  }
+
   ComScope com;
 
   WNDCLASSW cls = { .lpfnWndProc = main_window_proc, .lpszMenuName = MAKEINTRESOURCEW(IDR_MENU1), .lpszClassName = L"TodoAppMainClass", };
@@ -1195,7 +1891,481 @@ wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR
   }
 
 end:
+  log("end: ui_get_index finger hits: %zu misses: %zu\n", g_ui.index_stats.finger_hits, g_ui.index_stats.finger_misses);
+  log("end: element providers allocated: %zu, live: %zu\n", AnyElementProvider::pool.num_allocations, AnyElementProvider::pool.num_live);
+  ui_uia_release_providers(g_ui, false);
+  log("end: element providers live after releasing the cache: %zu\n", AnyElementProvider::pool.num_live);
+  log_latencies();
+  if (g_trace.enabled) {
+    VERIFY(trace_write("trace.json"));
+  }
+  if (g_session_recorder.file) {
+    log("end: %zu records in the session recording\n", g_session_recorder.num_records);
+    VERIFY(session_record_stop());
+  }
   return 0;
 }
 
-#pragma endregion TodoApp
\ No newline at end of file
+#pragma endregion TodoApp
+
+/// Replays of sessions recorded with `TodoApp.exe --record`, run with `TodoApp.exe --replay`. Results go to the log.
+#pragma region Replay
+
+// Calls the provider method of a recorded call. Returns false when the element or the interface isn't there anymore,
+// which only happens when the replayed ui diverges from the recorded one.
+bool
+main_replay_call(const SessionRecord& r) {
+  if (r.call == SessionCall::kGetObject) {
+    if (!g_ui.root_provider) main_on_root_requested();
+    return true;
+  }
+
+  // Called directly rather than through QueryInterface, to only measure what the client called.
+  ComOwner<IRawElementProviderFragment> element;
+  IRawElementProviderFragment* fragment = nullptr;
+  IRawElementProviderSimple* simple = nullptr;
+  if (r.id == 0) {
+    if (!g_ui.root_provider) return false;
+    fragment = g_ui.root_provider.ptr;
+    simple = g_ui.root_provider.ptr;
+  }
+  else {
+    if (ui_find_index(g_ui, r.id) == size_t(-1)) return false;
+    element = ComOwner(create_element_provider(r.id));
+    fragment = element.ptr;
+    simple = static_cast<AnyElementProvider*>(element.ptr);
+  }
+
+COMPLETE_SWITCH_BEGIN
+  switch (r.call) {
+  case SessionCall::kGetObject: break;
+  case SessionCall::kElementProviderFromPoint: // fallthrough
+  case SessionCall::kGetFocus: {
+    if (r.id != 0) return false;
+    ComOwner<IRawElementProviderFragment> found;
+    if (r.call == SessionCall::kGetFocus) {
+      VERIFYHR(g_ui.root_provider.ptr->GetFocus(found.Slot()));
+    }
+    else {
+      // Without a window, screen coordinates are client coordinates.
+      VERIFYHR(g_ui.root_provider.ptr->ElementProviderFromPoint(double(r.args[0]), double(r.args[1]), found.Slot()));
+    }
+  } break;
+  case SessionCall::kGetBoundingRectangle: {
+    UiaRect rect;
+    VERIFYHR(fragment->get_BoundingRectangle(&rect));
+  } break;
+  case SessionCall::kGetRuntimeId: {
+    SAFEARRAY* runtime_id = nullptr;
+    VERIFYHR(fragment->GetRuntimeId(&runtime_id));
+    if (runtime_id) VERIFYHR(::SafeArrayDestroy(runtime_id));
+  } break;
+  case SessionCall::kNavigate: {
+    ComOwner<IRawElementProviderFragment> found;
+    VERIFYHR(fragment->Navigate(NavigateDirection(r.args[0]), found.Slot()));
+  } break;
+  case SessionCall::kGetPatternProvider: {
+    ComOwner<IUnknown> pattern;
+    VERIFYHR(simple->GetPatternProvider(PATTERNID(r.args[0]), pattern.Slot()));
+  } break;
+  case SessionCall::kGetPropertyValue: {
+    VARIANT value;
+    VERIFYHR(simple->GetPropertyValue(PROPERTYID(r.args[0]), &value));
+    VERIFYHR(::VariantClear(&value));
+  } break;
+  case SessionCall::kSetFocus: {
+    VERIFYHR(fragment->SetFocus());
+  } break;
+  case SessionCall::kInvoke: {
+    if (r.id == 0 || g_ui.node_type[ui_get_index(r.id)] != Ui::Type::kButton) return false;
+    VERIFYHR(static_cast<AnyElementProvider*>(element.ptr)->Invoke());
+  } break;
+  case SessionCall::kCount: VERIFY(0); break;
+  }
+COMPLETE_SWITCH_END
+  return true;
+}
+
+// Feeds a recorded session back into the ui, as fast as possible, and logs how long the frames took.
+void
+main_replay(char const* path) {
+  SessionReader reader;
+  if (!session_reader_open(reader, path)) {
+    log("replay: could not read a session from %s\n", path);
+    return;
+  }
+  latency_histograms_dump([](char const*, auto...) {}, true); // only keep what the replay measures.
+
+  size_t num_keys = 0, num_calls = 0, num_skipped_calls = 0;
+  main_update(); // the first frame, which the window gets before any input.
+  auto t0 = std::chrono::steady_clock::now();
+  SessionRecord r;
+  while (session_reader_next(reader, &r)) {
+    switch (r.kind) {
+    case SessionRecordKind::kKeys: {
+      MEASURE_LATENCY("replay::key frame");
+      main_on_key(r.down, r.vk, r.keys);
+      num_keys++;
+    } break;
+    case SessionRecordKind::kCall: {
+      if (main_replay_call(r)) num_calls++;
+      else num_skipped_calls++;
+    } break;
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  if (reader.pos != reader.data.size()) {
+    log("replay: %s is truncated, stopped at byte %zu of %zu\n", path, reader.pos, reader.data.size());
+  }
+  log("replay: %s: %zu key events, %zu provider calls (%zu skipped), %.3f s of session replayed in %.3f ms\n", path,
+    num_keys, num_calls, num_skipped_calls, double(reader.time_us) / 1e6,
+    std::chrono::duration<double, std::milli>(t1 - t0).count());
+  log_latencies();
+  ui_uia_release_providers(g_ui, false);
+  if (g_trace.enabled) {
+    VERIFY(trace_write("trace.json"));
+  }
+}
+
+#pragma endregion Replay
+
+/// Benchmarks, run with `TodoApp.exe --benchmark`. Results go to the log.
+#pragma region Benchmarks
+
+void
+ui_benchmark_rebuild() {
+  // Rebuilds the whole tree each frame, like main_update does on every input event.
+  struct Shape {
+    char const* name;
+    int num_sections; // 0 => all items are direct children of the main pane.
+  };
+  const Shape shapes[] = { { "wide", 0 }, { "sectioned", 100 } };
+  const int num_nodes_per_frame[] = { 1'000, 10'000, 100'000 };
+
+  wchar_t name[64];
+  log("benchmark: tree rebuild\n");
+  for (auto shape : shapes) {
+    for (auto num_nodes : num_nodes_per_frame) {
+      const auto describe = [&]() {
+        ui_begin();
+        auto pane = ui_pane_begin(L"Main");
+        auto num_items = num_nodes - 1 - shape.num_sections;
+        if (shape.num_sections == 0) {
+          for (int i = 0; i < num_items; i++) {
+            std::swprintf(name, std::size(name), L"Item %d", i);
+            ui_text_paragraph(name);
+          }
+        }
+        else {
+          for (int s = 0; s < shape.num_sections; s++) {
+            std::swprintf(name, std::size(name), L"Section %d", s);
+            auto section = ui_pane_begin(name);
+            for (int i = s; i < num_items; i += shape.num_sections) {
+              std::swprintf(name, std::size(name), L"Item %d", i);
+              ui_text_paragraph(name);
+            }
+            ui_pane_end(section);
+          }
+        }
+        ui_pane_end(pane);
+        ui_end();
+      };
+
+      describe(); // warm-up, so that the arrays have reached their capacity.
+      VERIFY(g_ui.node_ids.size() == size_t(num_nodes));
+
+      const auto num_frames = std::max(3, 1'000'000 / num_nodes);
+      auto t0 = std::chrono::steady_clock::now();
+      for (int frame = 0; frame < num_frames; frame++) {
+        describe();
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      auto ms_per_frame = std::chrono::duration<double, std::milli>(t1 - t0).count() / num_frames;
+      log("  %-9s %7d nodes: %9.3f ms/frame (%.1f ns/node)\n", shape.name, num_nodes, ms_per_frame, 1e6 * ms_per_frame / num_nodes);
+    }
+  }
+
+  ui_begin();
+  ui_end();
+}
+
+void
+ui_benchmark_provider_walk() {
+  // A client walking the whole tree, between frames that rebuild it, as screen readers do to build their own view.
+  wchar_t name[64];
+  const auto describe = [&](int num_sections, int num_items_per_section) {
+    ui_begin();
+    auto pane = ui_pane_begin(L"Main");
+    for (int s = 0; s < num_sections; s++) {
+      std::swprintf(name, std::size(name), L"Section %d", s);
+      auto section = ui_pane_begin(name);
+      for (int i = 0; i < num_items_per_section; i++) {
+        std::swprintf(name, std::size(name), L"Item %d", i);
+        ui_text_paragraph(name);
+      }
+      ui_pane_end(section);
+    }
+    ui_pane_end(pane);
+    ui_end();
+  };
+
+  const auto walk = [](IRawElementProviderFragment* node, auto& walk) -> size_t {
+    size_t num_visited = 1;
+    IRawElementProviderFragment* child = nullptr;
+    VERIFYHR(node->Navigate(NavigateDirection_FirstChild, &child));
+    while (child) {
+      num_visited += walk(child, walk);
+      IRawElementProviderFragment* next = nullptr;
+      VERIFYHR(child->Navigate(NavigateDirection_NextSibling, &next));
+      child->Release();
+      child = next;
+    }
+    return num_visited;
+  };
+
+  log("benchmark: provider tree walk\n");
+  describe(100, 99);
+  auto& pool = AnyElementProvider::pool;
+  for (int pass = 0; pass < 3; pass++) {
+    auto num_allocations = pool.num_allocations;
+    auto t0 = std::chrono::steady_clock::now();
+    ComOwner root = create_element_provider(g_ui.node_ids[0]);
+    auto num_visited = walk(root, walk);
+    auto t1 = std::chrono::steady_clock::now();
+    VERIFY(num_visited == g_ui.node_ids.size());
+    auto num_allocated = pool.num_allocations - num_allocations;
+    VERIFY(pass == 0 || num_allocated == 0); // steady state.
+    log("  pass %d: %zu nodes, %zu providers allocated, %.1f ns/node\n", pass, num_visited, num_allocated,
+      std::chrono::duration<double, std::nano>(t1 - t0).count() / num_visited);
+    describe(100, 99);
+  }
+
+  // Removed nodes give their providers back.
+  describe(50, 99);
+  VERIFY(pool.num_live == g_ui.node_ids.size());
+  ui_begin();
+  ui_end();
+  VERIFY(pool.num_live == 0);
+  log_latencies(true);
+}
+
+void
+ui_benchmark_latency_overhead() {
+  const int num_calls = 10'000'000;
+  volatile int sink = 0;
+  const auto time_calls = [&](auto f) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_calls; i++) f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / num_calls;
+  };
+  auto bare = time_calls([&]() { sink = sink + 1; });
+  auto measured = time_calls([&]() { MEASURE_LATENCY("benchmark::measured"); sink = sink + 1; });
+  log("benchmark: latency measurement overhead: %.1f ns/call\n", measured - bare);
+  latency_histograms_dump([](char const*, auto...) {}, true); // drop the benchmark's own histogram.
+}
+
+void
+ui_benchmark_structure_diff() {
+  // Frames alternating between two versions of a 100k nodes tree, so that each frame has the same changes to find.
+  struct Edit {
+    char const* name;
+    int removed_section; // -1 => none.
+    int added_item; // -1 => none.
+    bool swap_first_items;
+    bool rename_all;
+  };
+  const Edit edits[] = {
+    { "none", -1, -1, false, false },
+    { "one item added", -1, 5, false, false },
+    { "one section removed", 42, -1, false, false },
+    { "two items swapped", -1, -1, true, false },
+    { "all renamed", -1, -1, false, true },
+  };
+  const int num_sections = 100;
+  const int num_items_per_section = 998;
+
+  wchar_t name[64];
+  const auto describe = [&](const Edit& edit, bool edited) {
+    ui_begin();
+    auto pane = ui_pane_begin(L"Main");
+    for (int s = 0; s < num_sections; s++) {
+      if (edited && s == edit.removed_section) continue;
+      std::swprintf(name, std::size(name), L"Section %d", s);
+      auto section = ui_pane_begin(name);
+      for (int i = 0; i < num_items_per_section; i++) {
+        auto item = edited && edit.swap_first_items && i < 2 ? 1 - i : i;
+        std::swprintf(name, std::size(name), edited && edit.rename_all ? L"Renamed %d" : L"Item %d", item);
+        ui_text_paragraph(name);
+        if (edited && s == 0 && i == edit.added_item) ui_text_paragraph(L"Added");
+      }
+      ui_pane_end(section);
+    }
+    ui_pane_end(pane);
+    ui_end();
+  };
+
+  log("benchmark: structure diff\n");
+  for (const auto& edit : edits) {
+    describe(edit, false);
+    describe(edit, true); // warm-up
+    describe(edit, false);
+    const int num_frames = 20;
+    double diff_ms = 0.0;
+    size_t num_changes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < num_frames; frame++) {
+      describe(edit, frame % 2 == 0);
+      num_changes += g_ui.structure_changes.type.size();
+      // Once more, only the comparison.
+      auto d0 = std::chrono::steady_clock::now();
+      ui_diff_structure(g_ui);
+      diff_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - d0).count();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    log("  %-20s %6zu nodes: %7.3f ms/frame, of which diff %6.3f ms, %zu changes/frame\n", edit.name, g_ui.node_ids.size(),
+      (std::chrono::duration<double, std::milli>(t1 - t0).count() - diff_ms) / num_frames, diff_ms / num_frames,
+      num_changes / num_frames);
+  }
+
+  ui_begin();
+  ui_end();
+}
+
+void
+ui_benchmark_resort() {
+  // A todo list of 50k items sorted again after some change, where only the moved items should be reported.
+  const int num_items = 50'000;
+  std::vector<int> order(num_items), sorted(num_items);
+  for (int i = 0; i < num_items; i++) sorted[i] = i;
+
+  struct Resort {
+    char const* name;
+    void (*apply)(std::vector<int>& order);
+  };
+  const Resort resorts[] = {
+    { "one item moved", [](std::vector<int>& order) { std::rotate(order.begin() + 100, order.begin() + 101, order.end() - 100); } },
+    { "four swaps", [](std::vector<int>& order) {
+      for (int k = 1; k <= 4; k++) std::swap(order[k * 1000], order[k * 1000 + 500]);
+    } },
+    { "reversed", [](std::vector<int>& order) { std::reverse(order.begin(), order.end()); } },
+    { "shuffled", [](std::vector<int>& order) {
+      uint64_t seed = 42;
+      for (size_t i = order.size() - 1; i > 0; i--) std::swap(order[i], order[wyrand(&seed) % (i + 1)]);
+    } },
+  };
+
+  wchar_t name[64];
+  const auto describe = [&](const std::vector<int>& items) {
+    ui_begin();
+    auto pane = ui_pane_begin(L"Todo");
+    for (auto item : items) {
+      std::swprintf(name, std::size(name), L"Todo item %d", item);
+      ui_text_paragraph(name);
+    }
+    ui_pane_end(pane);
+    ui_end();
+  };
+
+  log("benchmark: re-sorting %d todo items\n", num_items);
+  for (const auto& resort : resorts) {
+    order = sorted;
+    resort.apply(order);
+    describe(sorted);
+    describe(order);
+    size_t num_moved = 0;
+    for (auto n : g_ui.diff.num_moved) num_moved += n;
+    auto num_changes = g_ui.structure_changes.type.size();
+
+    const int num_frames = 20;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < num_frames; frame++) {
+      ui_diff_structure(g_ui);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    log("  %-16s: %6zu moved, %zu changes, diff %.3f ms\n", resort.name, num_moved, num_changes,
+      std::chrono::duration<double, std::milli>(t1 - t0).count() / num_frames);
+  }
+
+  ui_begin();
+  ui_end();
+}
+
+void
+ui_benchmark_memo() {
+  // A frame where only a button label changes, next to a long static document.
+  const int num_sections = 100;
+  const int num_paragraphs_per_section = 999;
+  wchar_t name[64];
+  const auto describe = [&](bool memoize, int frame) {
+    ui_begin();
+    auto pane = ui_pane_begin(L"Main");
+    ui_button(L"Toggle", frame % 2 ? L"Hide" : L"Show");
+    if (!memoize || ui_memo_begin(L"Document", 1)) {
+      auto document = ui_pane_begin(L"Document");
+      for (int s = 0; s < num_sections; s++) {
+        std::swprintf(name, std::size(name), L"Section %d", s);
+        auto section = ui_pane_begin(name);
+        for (int i = 0; i < num_paragraphs_per_section; i++) {
+          std::swprintf(name, std::size(name), L"Paragraph %d of section %d", i, s);
+          ui_text_paragraph(name);
+        }
+        ui_pane_end(section);
+      }
+      ui_pane_end(document);
+    }
+    if (memoize) ui_memo_end();
+    ui_text_paragraph(L"After the document");
+    ui_pane_end(pane);
+    ui_end();
+  };
+
+  log("benchmark: memoized subtree\n");
+  double ms_per_frame[2] = {};
+  for (bool memoize : { false, true }) {
+    describe(memoize, 0); // warm-up
+    const int num_frames = 20;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < num_frames; frame++) {
+      describe(memoize, frame);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    ms_per_frame[memoize] = std::chrono::duration<double, std::milli>(t1 - t0).count() / num_frames;
+    log("  %-12s %zu nodes: %8.3f ms/frame\n", memoize ? "memoized" : "described", g_ui.node_ids.size(), ms_per_frame[memoize]);
+  }
+
+  // The copied rows must be those that describing would have produced.
+  describe(true, 1);
+  describe(true, 2);
+  const auto memoized_ids = g_ui.node_ids;
+  const auto memoized_parents = g_ui.node_parent_index;
+  const auto memoized_subtree_ends = g_ui.node_subtree_end;
+  const auto memoized_prev_siblings = g_ui.node_prev_sibling;
+  const auto memoized_last_children = g_ui.node_last_child;
+  std::vector<std::wstring> memoized_texts;
+  for (size_t i = 0; i < g_ui.node_ids.size(); i++) memoized_texts.emplace_back(ui_node_text(g_ui, i));
+  describe(false, 2);
+  VERIFY(g_ui.node_ids == memoized_ids);
+  VERIFY(g_ui.node_parent_index == memoized_parents);
+  VERIFY(g_ui.node_subtree_end == memoized_subtree_ends);
+  VERIFY(g_ui.node_prev_sibling == memoized_prev_siblings);
+  VERIFY(g_ui.node_last_child == memoized_last_children);
+  for (size_t i = 0; i < g_ui.node_ids.size(); i++) {
+    VERIFY(ui_node_text(g_ui, i) == memoized_texts[i]);
+  }
+
+  ui_begin();
+  ui_end();
+}
+
+void
+ui_benchmark() {
+  ui_benchmark_rebuild();
+  ui_benchmark_provider_walk();
+  ui_benchmark_structure_diff();
+  ui_benchmark_resort();
+  ui_benchmark_memo();
+  ui_benchmark_latency_overhead();
+}
+
+#pragma endregion Benchmarks
\ No newline at end of file
@@ -0,0 +1,96 @@
+// # Trace events
+//
+// Records nested spans of time, such as a frame, the rebuild of the ui tree or a provider call, to see where the time
+// goes between a key press and what the screen reader announces.
+//
+// Put TRACE_SPAN("category", "name") at the top of a block. Nothing is recorded until trace_start is called, and then
+// every span is kept in memory until trace_write writes them out in the Chrome trace event format. The JSON file can be
+// loaded in chrome://tracing or ui.perfetto.dev.
+//
+// Blocks measured with MEASURE_LATENCY also show up in the trace, under the "uia" category.
+//
+// Like the latency histograms, the trace isn't thread-safe: spans must be recorded from the ui thread.
+
+#pragma once
+
+#include "LatencyHistograms.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+struct TraceEvent {
+  char const* category;
+  char const* name;
+  uint64_t start_ticks;
+  uint64_t end_ticks;
+};
+
+struct Trace {
+  static constexpr size_t kMaxEvents = 1 << 20; // ~32MiB, after which events are dropped.
+
+  bool enabled = false;
+  uint64_t start_ticks = 0;
+  std::vector<TraceEvent> events;
+  size_t num_dropped_events = 0;
+};
+
+inline Trace g_trace;
+
+inline void
+trace_record(char const* category, char const* name, uint64_t start_ticks, uint64_t end_ticks) {
+  if (g_trace.events.size() == Trace::kMaxEvents) {
+    g_trace.num_dropped_events++;
+    return;
+  }
+  g_trace.events.push_back({ category, name, start_ticks, end_ticks });
+}
+
+inline void
+trace_start() {
+  g_trace.enabled = true;
+  g_trace.start_ticks = latency_clock_ticks();
+  g_latency_scope_hook = [](char const* name, uint64_t start_ticks, uint64_t end_ticks) {
+    trace_record("uia", name, start_ticks, end_ticks);
+  };
+}
+
+// Returns false if the file could not be written.
+inline bool
+trace_write(char const* path) {
+  auto f = std::fopen(path, "wb");
+  if (!f) return false;
+
+  auto ns_per_tick = latency_ns_per_tick();
+  auto us_since_start = [&](uint64_t ticks) { return double(ticks - g_trace.start_ticks) * ns_per_tick / 1000.0; };
+  std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  std::fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"ui thread\"}}");
+  for (auto const& e : g_trace.events) {
+    // Complete events ("X") nest according to their timestamps.
+    std::fprintf(f, ",\n{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+      e.category, e.name, us_since_start(e.start_ticks), double(e.end_ticks - e.start_ticks) * ns_per_tick / 1000.0);
+  }
+  if (g_trace.num_dropped_events) {
+    std::fprintf(f, ",\n{\"name\":\"dropped events\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{\"count\":%zu}}",
+      us_since_start(g_trace.events.back().end_ticks), g_trace.num_dropped_events);
+  }
+  std::fprintf(f, "\n]}\n");
+  return std::fclose(f) == 0;
+}
+
+struct TraceScope {
+  char const* category;
+  char const* name;
+  uint64_t start = g_trace.enabled ? latency_clock_ticks() : 0;
+
+  TraceScope(char const* category, char const* name) : category(category), name(name) {}
+  ~TraceScope() {
+    if (start) trace_record(category, name, start, latency_clock_ticks());
+  }
+  TraceScope(TraceScope const&) = delete;
+  TraceScope& operator=(TraceScope const&) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(category_, name_) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(category_, name_)
@@ -0,0 +1,52 @@
+// # Benchmark tree
+//
+// The ui tree that UiCoreBenchmark measures and ScreenReaderSimulator drives: panes of documents of paragraphs, laid
+// out in columns so that hit-testing has something to find. Both tools build the same tree, so that their numbers can
+// be compared.
+
+#pragma once
+
+#include "UiCore.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <iterator>
+
+constexpr int32_t kNumDocumentsPerPane = 100;
+constexpr int32_t kNumParagraphsPerDocument = 99;
+constexpr int32_t kPaneWidth = 200;
+constexpr int32_t kLineHeight = 10;
+constexpr int32_t kDocumentHeight = kNumParagraphsPerDocument * kLineHeight;
+constexpr int32_t kPaneHeight = kNumDocumentsPerPane * kDocumentHeight;
+
+// How many panes a tree of num_nodes nodes has, the last one being partial.
+inline size_t
+ui_benchmark_num_panes(size_t num_nodes) {
+  return num_nodes == 0 ? 0 : 1 + (num_nodes - 1) / (1 + kNumDocumentsPerPane * (1 + kNumParagraphsPerDocument));
+}
+
+// Panes of documents of paragraphs, until there are num_nodes nodes.
+inline void
+ui_benchmark_build_tree(size_t num_nodes) {
+  g_ui = {};
+  wchar_t name[64];
+  for (int32_t p = 0; g_ui.node_ids.size() < num_nodes; p++) {
+    auto left = p * kPaneWidth;
+    std::swprintf(name, std::size(name), L"Pane %d", p);
+    ui_set_rect(ui_pane(name), { .left = left, .top = 0, .right = left + kPaneWidth, .bottom = kPaneHeight });
+    g_ui.depth_for_adding_element++;
+    for (int32_t d = 0; d < kNumDocumentsPerPane && g_ui.node_ids.size() < num_nodes; d++) {
+      std::swprintf(name, std::size(name), L"Document %d", d);
+      ui_set_rect(ui_document(name), { .left = left + 10, .top = d * kDocumentHeight, .right = left + kPaneWidth - 10, .bottom = (d + 1) * kDocumentHeight });
+      g_ui.depth_for_adding_element++;
+      for (int32_t t = 0; t < kNumParagraphsPerDocument && g_ui.node_ids.size() < num_nodes; t++) {
+        std::swprintf(name, std::size(name), L"Paragraph %d", t);
+        auto top = d * kDocumentHeight + t * kLineHeight;
+        ui_set_rect(ui_text_paragraph(name), { .left = left + 20, .top = top, .right = left + kPaneWidth - 20, .bottom = top + kLineHeight });
+      }
+      g_ui.depth_for_adding_element--;
+    }
+    g_ui.depth_for_adding_element--;
+  }
+}
@@ -0,0 +1,1135 @@
+#include "UiCore.h"
+
+#include "wyhash.h"
+#include "BinaryLog.h"
+#include "GraphemeBreak.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <string>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+// 1. Utils
+
+void
+verify_failed(char const* file, int line, char const* expr) {
+#if defined(_WIN32)
+  auto LastError = GetLastError(); auto LastErrorAsHRESULT = HRESULT_FROM_WIN32(LastError);
+  ::log("%s:%d: VERIFY(%s) failed. (GetLastError() returns %#x)\n", file, line, expr, LastErrorAsHRESULT);
+  if (::IsDebuggerPresent()) { ::DebugBreak(); }
+#else
+  ::log("%s:%d: VERIFY(%s) failed.\n", file, line, expr);
+#endif
+  std::exit(1);
+}
+
+void
+logv(char const* fmt, va_list args) {
+    binary_log_v(fmt, args); // written to log.bin, read it with LogDecoder.
+}
+
+void
+log(char const* fmt, ...) {
+  std::va_list args;
+  va_start(args, fmt);
+  ::logv(fmt, args);
+  va_end(args);
+}
+
+uint64_t
+hash(size_t num_bytes, void const* bytes) {
+  return wyhash(bytes, num_bytes, 0, _wyp);
+}
+
+// 2. The tree
+
+UiTree g_ui;
+UiEvents g_ui_events;
+
+bool
+valid_id(UiTree::Id id) {
+  return 0 < id && id < UiTree::Id(-1);
+}
+
+bool
+exists_id(UiTree::Id id) {
+  return valid_id(id) && ui_find_index(id) != size_t(-1);
+}
+
+std::wstring_view
+ui_node_name(size_t index) {
+  return { g_ui.text.data() + g_ui.node_name_offset[index], g_ui.node_name_len[index] };
+}
+
+// Adds `delta` to the name length of the node at `index` in the Fenwick tree.
+void
+ui_text_len_tree_add(size_t index, std::ptrdiff_t delta) {
+  auto& tree = g_ui.text_len_tree;
+  for (auto i = index + 1; i < tree.size(); i += i & (~i + 1)) {
+    tree[i] += size_t(delta); // wraps around for negative deltas, like the sums themselves.
+  }
+}
+
+// Appends the name length of a new last node to the Fenwick tree.
+void
+ui_text_len_tree_push(size_t len) {
+  auto& tree = g_ui.text_len_tree;
+  if (tree.empty()) tree.push_back(0); // unused slot, the tree is 1-based.
+  auto i = tree.size();
+  // tree[i] covers the nodes (i - lowbit(i), i], i.e. our own length plus the sub-ranges ending just before us.
+  auto sum = len;
+  for (auto j = i - 1, stop = i - (i & (~i + 1)); j > stop; j -= j & (~j + 1)) {
+    sum += tree[j];
+  }
+  tree.push_back(sum);
+}
+
+// The offset within the text of the whole tree where the name of the node at `index` starts,
+// i.e. the sum of the name lengths of the nodes before it. `index` may be node_ids.size(), for the total length.
+size_t
+ui_node_text_offset(size_t index) {
+  auto& tree = g_ui.text_len_tree;
+  VERIFY(index < std::max(tree.size(), size_t(1)));
+  size_t sum = 0;
+  for (auto i = index; i > 0; i -= i & (~i + 1)) {
+    sum += tree[i];
+  }
+  return sum;
+}
+
+// The length of the text within the node at `index`, including its descendants.
+size_t
+ui_node_text_len(size_t index) {
+  return ui_node_text_offset(g_ui.node_subtree_end[index]) - ui_node_text_offset(index);
+}
+
+// The offset of a point within the text of the whole tree.
+size_t
+ui_text_offset(TextPoint point) {
+  return ui_node_text_offset(ui_get_index(point.id)) + point.offset;
+}
+
+// The index of the last node starting at or before the offset, by descending the Fenwick tree.
+// So it's the node whose name contains the character at the offset, or the last node for the end of the text.
+size_t
+ui_text_node_at(size_t offset) {
+  auto& tree = g_ui.text_len_tree;
+  auto n = g_ui.node_ids.size();
+  VERIFY(n > 0);
+  VERIFY(offset <= ui_node_text_offset(n));
+
+  // Find the largest count of nodes whose names fit before `offset`.
+  size_t count = 0;
+  auto remaining = offset;
+  auto step = size_t(1);
+  while (step * 2 <= n) step *= 2;
+  for (; step > 0; step /= 2) {
+    if (count + step <= n && tree[count + step] <= remaining) {
+      count += step;
+      remaining -= tree[count];
+    }
+  }
+  return std::min(count, n - 1); // at the very end, we're at the end of the last node.
+}
+
+// Inverse of ui_text_offset. A point between two elements is at the beginning of the latter.
+TextPoint
+ui_text_point(size_t offset) {
+  auto index = ui_text_node_at(offset);
+  return { .id = g_ui.node_ids[index], .offset = static_cast<int>(offset - ui_node_text_offset(index)) };
+}
+
+// returns size_t(-1) when the parent is the root.
+size_t
+ui_get_parent_index(UiTree::Id id) {
+  return g_ui.node_parent_index[ui_get_index(id)];
+}
+
+// Navigation within the tree, in constant time thanks to the structure columns.
+// All return size_t(-1) when there is no such node.
+
+size_t
+ui_next_sibling_index(size_t index) {
+  auto next = g_ui.node_subtree_end[index];
+  if (next < g_ui.node_ids.size() && g_ui.node_depth[next] == g_ui.node_depth[index]) return next;
+  return size_t(-1);
+}
+
+size_t
+ui_prev_sibling_index(size_t index) {
+  return g_ui.node_prev_sibling[index];
+}
+
+size_t
+ui_first_child_index(size_t index) {
+  return index + 1 < g_ui.node_subtree_end[index] ? index + 1 : size_t(-1);
+}
+
+size_t
+ui_last_child_index(size_t index) {
+  return g_ui.node_last_child[index];
+}
+
+bool
+ui_is_ancestor(UiTree::Id candidate_ancestor_id, UiTree::Id of_id) {
+  if (candidate_ancestor_id == 0) return true; // the root encloses everything.
+
+  auto index = ui_get_index(of_id);
+  for (auto i = g_ui.node_parent_index[index]; i != size_t(-1); i = g_ui.node_parent_index[i]) {
+    if (g_ui.node_ids[i] == candidate_ancestor_id) return true;
+  }
+
+  return false;
+}
+
+// returns false when the id was already present, in which case the table is left untouched.
+bool
+ui_index_insert(UiTree::Id id, size_t index) {
+  auto& table = g_ui.index_by_id;
+  if (2 * (table.count + 1) > table.keys.size()) {
+    // grow, keeping the load factor under 1/2 so that probe sequences stay short.
+    auto old_keys = std::move(table.keys);
+    auto old_indices = std::move(table.indices);
+    auto capacity = std::max(size_t(64), 2 * old_keys.size());
+    table.keys.assign(capacity, 0);
+    table.indices.assign(capacity, 0);
+    table.count = 0;
+    for (size_t i = 0; i < old_keys.size(); i++) {
+      if (old_keys[i]) ui_index_insert(old_keys[i], old_indices[i]);
+    }
+  }
+
+  // ids are wyhash outputs, so their low bits are already well distributed.
+  auto mask = table.keys.size() - 1;
+  auto slot = size_t(id) & mask;
+  for (; table.keys[slot]; slot = (slot + 1) & mask) {
+    if (table.keys[slot] == id) return false;
+  }
+  table.count++;
+  table.keys[slot] = id;
+  table.indices[slot] = index;
+  return true;
+}
+
+// returns size_t(-1) when the id is not in the tree.
+size_t
+ui_find_index(UiTree::Id id) {
+  const auto& table = g_ui.index_by_id;
+  if (table.keys.empty()) return size_t(-1);
+
+  auto mask = table.keys.size() - 1;
+  for (auto slot = size_t(id) & mask; table.keys[slot]; slot = (slot + 1) & mask) {
+    if (table.keys[slot] == id) return table.indices[slot];
+  }
+  return size_t(-1);
+}
+
+UiTree::Id
+ui_named_element(wchar_t const* name, UiTree::Type type) {
+  auto index = g_ui.node_ids.size();
+  auto depth = g_ui.depth_for_adding_element;
+
+  UiTree::Id parent_id = -1;
+  size_t parent_index = size_t(-1);
+  if (depth == 0) {
+    parent_id = 0;
+  }
+  else {
+    auto parent_depth = size_t(depth - 1); // huge for a negative depth, which the VERIFY catches.
+    VERIFY(parent_depth < g_ui.open_element_stack.size()); // no element was added at the parent depth?
+    parent_index = g_ui.open_element_stack[parent_depth];
+    parent_id = g_ui.node_ids[parent_index];
+  }
+  g_ui.open_element_stack.resize(depth + 1);
+  g_ui.open_element_stack[depth] = index;
+
+  auto num_bytes = wcslen(name) * sizeof name[0];
+  auto id = hash(num_bytes, name);
+  id = wyhash64(id, parent_id);
+
+  VERIFY(valid_id(id));
+  VERIFY(ui_index_insert(id, index)); // duplicate id: either a hash collision or two siblings with the same name.
+  auto node_len = wcslen(name);
+  g_ui.node_ids.push_back(id);
+  g_ui.node_name_offset.push_back(g_ui.text.size());
+  g_ui.node_name_capacity.push_back(node_len);
+  g_ui.text.insert(g_ui.text.end(), name, name + node_len);
+  g_ui.node_name_len.push_back(node_len);
+  ui_text_len_tree_push(node_len);
+  g_ui.node_type.push_back(type);
+  g_ui.node_depth.push_back(depth);
+  g_ui.node_parent.push_back(parent_id);
+  g_ui.node_parent_index.push_back(parent_index);
+  g_ui.node_rect.push_back({});
+  g_ui.node_subtree_end.push_back(index + 1);
+  g_ui.node_last_child.push_back(size_t(-1));
+
+  auto& parent_last_child = parent_index == size_t(-1) ? g_ui.root_last_child : g_ui.node_last_child[parent_index];
+  g_ui.node_prev_sibling.push_back(parent_last_child);
+  parent_last_child = index;
+
+  if (type == UiTree::Type::kDocument) g_ui.document_indices.push_back(index);
+  if (type == UiTree::Type::kText) g_ui.paragraph_indices.push_back(index);
+
+  for (auto i = parent_index; i != size_t(-1); i = g_ui.node_parent_index[i]) {
+    g_ui.node_subtree_end[i] = index + 1;
+  }
+  return id;
+}
+
+UiTree::Id
+ui_document(wchar_t const* text) {
+    return ui_named_element(text, UiTree::Type::kDocument);
+}
+
+UiTree::Id
+ui_text_paragraph(wchar_t const* text) {
+    return ui_named_element(text, UiTree::Type::kText);
+}
+
+UiTree::Id
+ui_button(wchar_t const* text, std::function<void()> action) {
+  auto id = ui_named_element(text, UiTree::Type::kButton);
+  VERIFY(g_ui.actions.insert_or_assign(id, action).second);
+  return id;
+}
+
+UiTree::Id
+ui_pane(wchar_t const* text) {
+  return ui_named_element(text, UiTree::Type::kPane);
+}
+
+void
+ui_set_rect(UiTree::Id id, UiRect rect) {
+  auto i = ui_get_index(id);
+  g_ui.node_rect.resize(std::max(g_ui.node_rect.size(), i + 1));
+  g_ui.node_rect[i] = rect;
+  g_ui.rect_index.dirty = true;
+}
+
+bool
+rect_contains(UiRect const r, double x, double y) {
+  if (y < r.top) return false;
+  if (y >= r.bottom) return false;
+  if (x < r.left) return false;
+  if (x >= r.right) return false;
+  return true;
+}
+
+void
+ui_rect_index_update() {
+  rect_index_update(g_ui.rect_index, g_ui.node_rect, g_ui.node_depth);
+}
+
+// Returns the index of the deepest node whose rect contains the point (the last one in presentation order, among equals),
+// or size_t(-1) when there is none.
+size_t
+ui_search_deepest_node_containing(double x, double y) {
+  ui_rect_index_update();
+  return rect_index_search_deepest(g_ui.rect_index, [x, y](UiRect r) { return rect_contains(r, x, y); });
+}
+
+void ui_text_index_update(size_t index, size_t old_len);
+
+// Replaces the name of an existing element, e.g. to update a paragraph of a live document.
+// Costs O(log n) for the text lengths and offsets, plus the copy of the new name.
+void
+ui_set_text(UiTree::Id id, wchar_t const* text) {
+  auto index = ui_get_index(id);
+  auto len = wcslen(text);
+  auto old_len = g_ui.node_name_len[index];
+
+  if (len > g_ui.node_name_capacity[index]) {
+    // Relocate the name to the end of the storage, with room to grow for names that keep being appended to.
+    g_ui.text_unused += g_ui.node_name_capacity[index];
+    auto capacity = std::max(len, 2 * g_ui.node_name_capacity[index]);
+    g_ui.node_name_offset[index] = g_ui.text.size();
+    g_ui.node_name_capacity[index] = capacity;
+    g_ui.text.resize(g_ui.text.size() + capacity);
+  }
+  std::copy_n(text, len, g_ui.text.data() + g_ui.node_name_offset[index]);
+  g_ui.node_name_len[index] = len;
+  ui_text_len_tree_add(index, std::ptrdiff_t(len) - std::ptrdiff_t(old_len));
+  g_ui.text_boundaries.erase(id);
+  ui_text_index_update(index, old_len);
+
+  if (g_ui.text_unused > g_ui.text.size() / 2) {
+    // Compact the storage back into presentation order once the relocated names left too much behind.
+    std::vector<wchar_t> text;
+    text.reserve(g_ui.text.size() - g_ui.text_unused);
+    for (size_t i = 0; i < g_ui.node_ids.size(); i++) {
+      auto offset = g_ui.node_name_offset[i];
+      g_ui.node_name_offset[i] = text.size();
+      text.insert(text.end(), g_ui.text.begin() + offset, g_ui.text.begin() + offset + g_ui.node_name_capacity[i]);
+    }
+    g_ui.text = std::move(text);
+    g_ui.text_unused = 0;
+  }
+
+  if (g_ui_events.text_changed) g_ui_events.text_changed(id);
+}
+
+size_t
+ui_get_index(UiTree::Id id) {
+  VERIFY(valid_id(id));
+  static struct {
+    UiTree::Id id[2];
+    size_t index[2];
+  } fingers = {};
+  static int next = 0;
+
+  // The tree may have been rebuilt since the fingers were set, so a hit must still point at the same node.
+  const auto cache_hit = [](UiTree::Id id, int i) {
+    auto index = fingers.index[i];
+    return id == fingers.id[i] && index < g_ui.node_ids.size() && g_ui.node_ids[index] == id;
+  };
+
+  if (cache_hit(id, 0)) {
+    g_ui.index_stats.finger_hits++;
+    return fingers.index[0];
+  }
+  else if (cache_hit(id, 1)) {
+    g_ui.index_stats.finger_hits++;
+    return fingers.index[1];
+  }
+
+  g_ui.index_stats.finger_misses++;
+  LOG_TRACE(LogCategory_Tree, "ui_get_index finger cache miss, for id %#llx (cached ids: %#llx %#llx)\n", id, fingers.id[0], fingers.id[1]);
+
+  auto index = ui_find_index(id);
+  VERIFY(index < g_ui.node_ids.size()); // is this a case that needs instead to be legitimately handled, like if we have elements that disappear?
+  fingers.id[next & 1] = id;
+  fingers.index[next & 1] = index;
+  next++;
+
+  return index;
+}
+
+// TODO(nil): embed in single describe function.
+void
+ui_focus_next() {
+  auto index = ui_get_index(g_ui.focused_id);
+  if (index >= g_ui.node_ids.size() - 1) return;
+  
+  index++;
+  ui_set_focus_to(g_ui.node_ids[index]);
+}
+
+void
+ui_focus_prev() {
+  auto index = ui_get_index(g_ui.focused_id);
+  if (index <= 0) return;
+  
+  index--;
+  ui_set_focus_to(g_ui.node_ids[index]);
+}
+
+void
+ui_activate() {
+  if (g_ui.focused_id) ui_activate(g_ui.focused_id);
+}
+
+void
+ui_set_focus_to(UiTree::Id id) {
+    if (id == g_ui.focused_id) {
+        LOG_TRACE(LogCategory_Events, "redundant ui_set_focus_to\n");
+        return;
+    }
+    LOG_INFO(LogCategory_Events, "changing focus from %#llx to %#llx\n", g_ui.focused_id, id);
+    g_ui.focused_id = id;
+    if (g_ui_events.focus_changed) g_ui_events.focus_changed(id);
+}
+
+bool
+ui_activate(UiTree::Id id) {
+  LOG_INFO(LogCategory_Events, "activating %#llx\n", id);
+  auto action_pos = g_ui.actions.find(id);
+  if (action_pos == g_ui.actions.end()) return false;
+
+  auto fn = action_pos->second;
+  fn();
+
+  if (g_ui_events.invoked) g_ui_events.invoked(id);
+  return true;
+}
+
+// 3. Text ranges
+//
+// The operations of UIA's text pattern, see AnyElementTextRangeProvider for the references.
+
+// See TextBoundaryScanner.h for what words and lines are.
+UiTree::TextBoundaries const&
+ui_text_boundaries(size_t index) {
+  auto [pos, inserted] = g_ui.text_boundaries.try_emplace(g_ui.node_ids[index]);
+  auto& boundaries = pos->second;
+  if (!inserted) return boundaries;
+
+  auto name = ui_node_name(index);
+  VERIFY(name.size() < uint32_t(-1));
+  text_scan_boundaries(name.data(), name.size(), boundaries.words, boundaries.lines);
+  return boundaries;
+}
+
+// Paragraphs and documents are nodes, their boundaries are where each of them starts and ends.
+int
+ui_text_move_offset_by_nodes(std::vector<size_t> const& units, size_t* offset, int count) {
+  int moved = 0;
+  const auto unit_end = [](size_t index) { return ui_node_text_offset(index) + ui_node_text_len(index); };
+  for (; count > 0; count--, moved++) {
+    // The last unit starting at or before the offset ends after it, or the next one starts after it.
+    auto it = std::upper_bound(units.begin(), units.end(), *offset, [](size_t offset, size_t index) {
+      return offset < ui_node_text_offset(index);
+    });
+    if (it != units.begin() && unit_end(*(it - 1)) > *offset) *offset = unit_end(*(it - 1));
+    else if (it != units.end()) *offset = ui_node_text_offset(*it);
+    else break;
+  }
+  for (; count < 0; count++, moved--) {
+    // The last unit starting before the offset ends before it, or starts before it.
+    auto it = std::lower_bound(units.begin(), units.end(), *offset, [](size_t index, size_t offset) {
+      return ui_node_text_offset(index) < offset;
+    });
+    if (it == units.begin()) break;
+    auto end = unit_end(*(it - 1));
+    *offset = end < *offset ? end : ui_node_text_offset(*(it - 1));
+  }
+  return moved;
+}
+
+int
+ui_text_move_offset(UiTextUnit unit, size_t* offset, int count) {
+  auto total_len = ui_node_text_offset(g_ui.node_ids.size());
+  VERIFY(*offset <= total_len);
+
+  std::vector<size_t> const* unit_indices = nullptr;
+  switch (unit) {
+  case UiTextUnit::kCharacter: break;
+  case UiTextUnit::kFormat: break; // we don't have format/attributes, so we use the next largest unit.
+  case UiTextUnit::kWord: break;
+  case UiTextUnit::kLine: break;
+  case UiTextUnit::kParagraph: unit_indices = &g_ui.paragraph_indices; break;
+  case UiTextUnit::kPage: // we don't have pages, so we use the next largest unit.
+  case UiTextUnit::kDocument: unit_indices = &g_ui.document_indices; break;
+  }
+  if (unit_indices) return ui_text_move_offset_by_nodes(*unit_indices, offset, count);
+
+  // Within a name, a lookup in its boundaries, however many units we move. Characters are grapheme clusters, found
+  // as we go.
+  int moved = 0;
+  while (count > 0 && *offset < total_len) {
+    auto index = ui_text_node_at(*offset); // has a name, since there is text at the offset.
+    auto name_offset = ui_node_text_offset(index);
+    if (unit == UiTextUnit::kCharacter) {
+      auto name = ui_node_name(index);
+      auto i = *offset - name_offset;
+      auto n = int(grapheme_move_forward(name.data(), name.size(), &i, size_t(count)));
+      *offset = name_offset + i;
+      moved += n;
+      count -= n;
+      continue;
+    }
+    auto const& b = unit == UiTextUnit::kLine ? ui_text_boundaries(index).lines : ui_text_boundaries(index).words;
+    auto k = text_bits_count_before(b, *offset - name_offset + 1);
+    auto num_after = text_bits_count(b) - k;
+    if (size_t(count) <= num_after) {
+      *offset = name_offset + text_bits_select(b, k + count - 1);
+      moved += count;
+      break;
+    }
+    // The end of the name is the next boundary: the start of the next name, or the end of the text.
+    *offset = name_offset + g_ui.node_name_len[index];
+    moved += int(num_after) + 1;
+    count -= int(num_after) + 1;
+  }
+  while (count < 0 && *offset > 0) {
+    auto index = ui_text_node_at(*offset - 1);
+    auto name_offset = ui_node_text_offset(index);
+    if (unit == UiTextUnit::kCharacter) {
+      auto name = ui_node_name(index);
+      auto i = *offset - name_offset;
+      auto n = int(grapheme_move_backward(name.data(), &i, size_t(-count)));
+      *offset = name_offset + i;
+      moved -= n;
+      count += n;
+      continue;
+    }
+    auto const& b = unit == UiTextUnit::kLine ? ui_text_boundaries(index).lines : ui_text_boundaries(index).words;
+    auto num_before = text_bits_count_before(b, *offset - name_offset);
+    if (size_t(-count) <= num_before) {
+      *offset = name_offset + text_bits_select(b, num_before + count);
+      moved += count;
+      break;
+    }
+    *offset = name_offset; // the first boundary.
+    moved -= int(num_before);
+    count += int(num_before);
+  }
+  return moved;
+}
+
+// The start of the unit that contains the character at the offset.
+size_t
+ui_text_unit_start(UiTextUnit unit, size_t offset) {
+  if (offset == ui_node_text_offset(g_ui.node_ids.size())) return offset;
+  auto start = offset + 1;
+  ui_text_move_offset(unit, &start, -1);
+  return start;
+}
+
+// Moves a range by `count` units, and makes it span the unit it lands on. (or stay degenerate)
+// Returns false for values that aren't units of UIA.
+bool
+ui_text_range_move(TextRange& range, UiTextUnit unit, int count, int* moved) {
+  *moved = 0;
+
+  if (unit == UiTextUnit::kCharacter || unit == UiTextUnit::kWord || unit == UiTextUnit::kLine || unit == UiTextUnit::kFormat) {
+    auto total_len = ui_node_text_offset(g_ui.node_ids.size());
+    auto degenerate = range.start == range.end;
+    auto offset = ui_text_unit_start(unit, ui_text_offset(range.start));
+    *moved = ui_text_move_offset(unit, &offset, count);
+    if (!degenerate && offset == total_len && *moved > 0) {
+      *moved += ui_text_move_offset(unit, &offset, -1); // no unit starts at the end of the text, we stay on the last one.
+    }
+    auto end = offset;
+    if (!degenerate) ui_text_move_offset(unit, &end, 1);
+    range = { ui_text_point(offset), ui_text_point(end) };
+    return true;
+  }
+
+  if (range.start == range.end) return true;
+  
+  // For a non-degenerate (non-empty) text range, ITextRangeProvider::Move should normalize and move the text range by performing the following steps.
+  // 
+  // 1. Collapse the text range to a degenerate(empty) range at the starting endpoint.
+  auto start_offset = ui_text_offset(range.start);
+
+  std::vector<size_t> const* unit_indices = nullptr;
+  switch (unit) {
+  case UiTextUnit::kPage: // we don't have pages, so we use the next largest unit.
+  case UiTextUnit::kDocument: unit_indices = &g_ui.document_indices; break;
+  case UiTextUnit::kParagraph: unit_indices = &g_ui.paragraph_indices; break;
+  default: break; // the other units of UIA were moved through ui_text_move_offset, above.
+  }
+  if (!unit_indices) return false; // not a unit of UIA.
+  if (unit_indices->empty()) return true;
+
+  // 2. If necessary, move the resulting text range backward in the document to the beginning of the requested unit boundary.
+  //
+  // The units are in presentation order, so their text offsets are sorted and we find the unit starting at or before our offset.
+  auto const& units = *unit_indices;
+  auto it = std::upper_bound(units.begin(), units.end(), start_offset, [](size_t offset, size_t index) {
+    return offset < ui_node_text_offset(index);
+  });
+  auto unit_pos = std::ptrdiff_t(it - units.begin()) - 1; // -1 => before the first unit.
+  auto inside_unit = unit_pos >= 0 && start_offset < ui_node_text_offset(units[unit_pos]) + ui_node_text_len(units[unit_pos]);
+  if (!inside_unit && count <= 0) unit_pos++; // between two units, moving backward starts from the boundary of the next one.
+
+  // 3. Move the text range forward or backward in the document by the requested number of text unit boundaries.
+  auto new_pos = std::clamp(unit_pos + std::ptrdiff_t(count), std::ptrdiff_t(0), std::ptrdiff_t(units.size()) - 1);
+  auto index = units[new_pos];
+
+  // 4. Expand the text range from the degenerate state by moving the ending endpoint forward by one requested text unit boundary.
+  range.start = TextPoint{ .id = g_ui.node_ids[index], .offset = 0 };
+  range.end = TextPoint{ .id = g_ui.node_ids[index], .offset = static_cast<int>(ui_node_text_len(index)) };
+  *moved = static_cast<int>(new_pos - unit_pos);
+  return true;
+}
+
+void
+ui_text_range_expand_to_enclosing_unit(TextRange& range, UiTextUnit unit) {
+  if (unit == UiTextUnit::kCharacter || unit == UiTextUnit::kWord || unit == UiTextUnit::kLine || unit == UiTextUnit::kFormat) {
+    auto offset = ui_text_offset(range.start);
+    auto start = ui_text_unit_start(unit, offset);
+    if (start == ui_node_text_offset(g_ui.node_ids.size())) ui_text_move_offset(unit, &start, -1); // the last unit.
+    auto end = start;
+    ui_text_move_offset(unit, &end, 1);
+    range = { ui_text_point(start), ui_text_point(end) };
+    return;
+  }
+
+  // TODO(nil): implement this for paragraphs and documents.
+
+  // We'll implement a simpler version of this, by letting it expand it always to the full element..
+  auto new_start = TextPoint{ .id = range.start.id, .offset = 0 };
+  auto new_end = TextPoint{ .id = range.end.id, .offset = static_cast<int>(g_ui.node_name_len[ui_get_index(range.end.id)]) };
+
+  range.start = new_start;
+  range.end = new_end;
+}
+
+void
+ui_text_range_move_endpoint_by_range(TextRange& range, bool start, TextPoint point) {
+  (start ? range.start : range.end) = point;
+
+  // If the endpoint being moved crosses the other endpoint of the same text range, that other endpoint is also moved, resulting in a degenerate (empty) range.
+  if (ui_text_offset(range.end) < ui_text_offset(range.start)) {
+    range.start = point;
+    range.end = point;
+  }
+}
+
+// If the endpoint crosses the other endpoint, the range becomes degenerate there.
+void
+ui_text_range_move_endpoint_by_unit(TextRange& range, bool start, UiTextUnit unit, int count, int* moved) {
+  auto offset = ui_text_offset(start ? range.start : range.end);
+  *moved = ui_text_move_offset(unit, &offset, count);
+  ui_text_range_move_endpoint_by_range(range, start, ui_text_point(offset));
+}
+
+// The number of characters in the range, 0 when its endpoints are reversed.
+size_t
+ui_text_range_len(TextRange range) {
+  auto total_len = ui_node_text_offset(g_ui.node_ids.size());
+  auto first = std::min(ui_text_offset(range.start), total_len);
+  auto last = std::min(ui_text_offset(range.end), total_len);
+  return last > first ? last - first : 0;
+}
+
+// Copies the first `len` characters of the range. (at most ui_text_range_len)
+void
+ui_text_range_copy(TextRange range, size_t len, wchar_t* dest) {
+  VERIFY(len <= ui_text_range_len(range));
+  if (len == 0) return;
+
+  // Concatenate the names found in the range, starting with the node at its start.
+  auto point = ui_text_point(ui_text_offset(range.start));
+  auto index = ui_get_index(point.id);
+  auto name_offset = size_t(point.offset);
+  for (size_t copied = 0; copied < len; index++, name_offset = 0) {
+    auto name = ui_node_name(index);
+    auto n = std::min(name.size() - std::min(name_offset, name.size()), len - copied);
+    std::copy_n(name.data() + name_offset, n, dest + copied);
+    copied += n;
+  }
+}
+
+// Folds the letters of the scripts with one lower case letter per upper case letter: Latin, Greek and Cyrillic.
+wchar_t
+ui_fold_case(wchar_t c) {
+  if (c < 0x80) return L'A' <= c && c <= L'Z' ? wchar_t(c + 32) : c;
+  if (c < 0x100) return 0xc0 <= c && c <= 0xde && c != 0xd7 ? wchar_t(c + 32) : c;
+  if (c < 0x180) {
+    if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149 || c == 0x17f) return c; // dotted I, dotless i, kra, 'n, long s
+    if (c == 0x178) return 0xff; // Y with diaeresis
+    auto upper_is_even = c < 0x139 || (0x14a <= c && c < 0x179);
+    return (c % 2 == 0) == upper_is_even ? wchar_t(c + 1) : c;
+  }
+  if (0x391 <= c && c <= 0x3ab && c != 0x3a2) return wchar_t(c + 32);
+  if (c == 0x3c2) return 0x3c3; // final sigma
+  if (0x400 <= c && c <= 0x40f) return wchar_t(c + 80);
+  if (0x410 <= c && c <= 0x42f) return wchar_t(c + 32);
+  return c;
+}
+
+// The names of the nodes, in order, are one text to a Knuth-Morris-Pratt automaton, fed one code unit at a time
+// forward, or backward with the text reversed. Unlike Boyer-Moore-Horspool, it never looks back at code units it has
+// seen, so that we don't need to keep the end of the previous names around, and runs in time linear in the length of
+// the text. When the automaton is in its initial state, we skip to the next occurrence of the first code unit.
+struct UiTextMatcher {
+  std::wstring pattern; // folded when ignoring case, reversed when backward.
+  std::vector<uint32_t> fail; // fail[k]: the length of the longest proper prefix of pattern[0..k] that is also a suffix of it.
+  bool backward;
+  bool ignore_case;
+};
+
+UiTextMatcher
+ui_text_matcher(std::wstring_view search_text, bool backward, bool ignore_case) {
+  UiTextMatcher matcher = { .pattern = std::wstring(search_text), .fail = {}, .backward = backward, .ignore_case = ignore_case };
+  auto& pattern = matcher.pattern;
+  if (ignore_case) std::transform(pattern.begin(), pattern.end(), pattern.begin(), ui_fold_case);
+  if (backward) std::reverse(pattern.begin(), pattern.end());
+  auto m = pattern.size();
+  matcher.fail.resize(m);
+  for (size_t k = 1, n = 0; k < m; k++) {
+    while (n > 0 && pattern[k] != pattern[n]) n = matcher.fail[n - 1];
+    if (pattern[k] == pattern[n]) n++;
+    matcher.fail[k] = uint32_t(n);
+  }
+  return matcher;
+}
+
+// The offset of the first match within [start, end), or of the last one when backward. size_t(-1) => none.
+size_t
+ui_text_matcher_scan(UiTextMatcher const& matcher, size_t start, size_t end) {
+  auto const& pattern = matcher.pattern;
+  auto const& fail = matcher.fail;
+  auto const ignore_case = matcher.ignore_case;
+  auto m = pattern.size();
+  if (end < start || end - start < m) return size_t(-1);
+
+  size_t state = 0; // the number of code units of the pattern that match.
+  const auto feed = [&](wchar_t c) {
+    if (ignore_case) c = ui_fold_case(c);
+    while (state > 0 && pattern[state] != c) state = fail[state - 1];
+    if (pattern[state] == c) state++;
+    return state == m;
+  };
+  const auto first = pattern[0];
+  const auto is_first = [&](wchar_t c) { return (ignore_case ? ui_fold_case(c) : c) == first; };
+
+  if (!matcher.backward) {
+    auto index = ui_text_node_at(start);
+    auto name_offset = ui_node_text_offset(index);
+    for (auto offset = start; offset < end; name_offset += g_ui.node_name_len[index], index++) {
+      auto name = ui_node_name(index);
+      auto i = offset - name_offset;
+      auto last = std::min(name.size(), end - name_offset);
+      while (i < last) {
+        if (state == 0) {
+          i = size_t((ignore_case ? std::find_if(name.begin() + i, name.begin() + last, is_first)
+                                  : std::find(name.begin() + i, name.begin() + last, first)) - name.begin());
+          if (i == last) break;
+        }
+        if (feed(name[i++])) return name_offset + i - m;
+      }
+      offset = name_offset + last;
+    }
+  }
+  else {
+    auto index = ui_text_node_at(end - 1);
+    auto name_offset = ui_node_text_offset(index);
+    for (auto offset = end; offset > start; index--, name_offset -= g_ui.node_name_len[index]) {
+      auto name = ui_node_name(index);
+      auto i = offset - name_offset;
+      auto first_i = start > name_offset ? start - name_offset : 0;
+      while (i > first_i) {
+        if (state == 0) {
+          auto it = ignore_case ? std::find_if(name.rbegin() + (name.size() - i), name.rend() - first_i, is_first)
+                                : std::find(name.rbegin() + (name.size() - i), name.rend() - first_i, first);
+          i = size_t(name.rend() - it);
+          if (i == first_i) break;
+        }
+        if (feed(name[--i])) return name_offset + i;
+      }
+      offset = name_offset + first_i;
+      if (index == 0) break;
+    }
+  }
+  return size_t(-1);
+}
+
+// 21 bits for each code unit of the trigram, case folded.
+uint64_t
+ui_text_trigram(wchar_t const* c) {
+  const auto bits = [](wchar_t x) { return uint64_t(uint32_t(ui_fold_case(x)) & 0x1fffff); };
+  return (bits(c[0]) << 42) | (bits(c[1]) << 21) | bits(c[2]);
+}
+
+// Runs off the ui thread, on a copy of the text: the names of nodes [0, name_ends.size()) one after the other.
+std::unique_ptr<UiTree::TextIndex>
+ui_text_index_build_from(std::vector<wchar_t> text, std::vector<size_t> name_ends) {
+  auto t0 = std::chrono::steady_clock::now();
+  auto index = std::make_unique<UiTree::TextIndex>();
+  index->num_nodes = name_ends.size();
+  size_t pos = 0;
+  for (size_t node = 0; node < name_ends.size(); node++) {
+    for (; pos < name_ends[node] && pos + 3 <= text.size(); pos++) {
+      auto& nodes = index->postings[ui_text_trigram(text.data() + pos)].nodes;
+      if (nodes.empty() || nodes.back() != node) nodes.push_back(uint32_t(node));
+    }
+    pos = name_ends[node];
+  }
+  for (auto& [trigram, postings] : index->postings) {
+    postings.num_sorted = postings.nodes.size();
+    index->num_postings += postings.nodes.size();
+  }
+  index->build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  return index;
+}
+
+void
+ui_text_index_build() {
+  if (g_ui.text_index_building.valid()) return;
+  auto num_nodes = g_ui.node_ids.size();
+  VERIFY(num_nodes < uint32_t(-1));
+  std::vector<wchar_t> text;
+  std::vector<size_t> name_ends(num_nodes);
+  text.reserve(ui_node_text_offset(num_nodes));
+  for (size_t i = 0; i < num_nodes; i++) {
+    auto name = ui_node_name(i);
+    text.insert(text.end(), name.begin(), name.end());
+    name_ends[i] = text.size();
+  }
+  g_ui.text_index_pending.clear();
+  g_ui.text_index_building = std::async(std::launch::async, ui_text_index_build_from, std::move(text), std::move(name_ends));
+}
+
+// Adds the node to the postings of a trigram, unless it was the last node added.
+void
+ui_text_index_post(UiTree::TextIndex& index, wchar_t const* trigram, size_t node) {
+  auto& postings = index.postings[ui_text_trigram(trigram)];
+  if (postings.nodes.empty() || postings.nodes.back() != node) {
+    postings.nodes.push_back(uint32_t(node));
+    index.num_postings++;
+  }
+}
+
+// Adds the node to the postings of the trigrams that start in its name.
+void
+ui_text_index_add(UiTree::TextIndex& index, size_t node) {
+  if (node >= index.num_nodes) return;
+  auto name = ui_node_name(node);
+  for (size_t i = 0; i + 3 <= name.size(); i++) ui_text_index_post(index, name.data() + i, node);
+
+  // The last two trigrams read into the next names.
+  auto name_end = ui_node_text_offset(node) + name.size();
+  auto num_after = std::min(ui_node_text_offset(g_ui.node_ids.size()) - name_end, size_t(2));
+  auto num_spanning = std::min(name.size(), num_after);
+  if (num_spanning == 0) return;
+  wchar_t buffer[4];
+  ui_text_range_copy({ ui_text_point(name_end - num_spanning), ui_text_point(name_end + num_after) }, num_spanning + num_after, buffer);
+  for (size_t i = 0; i + 3 <= num_spanning + num_after; i++) ui_text_index_post(index, buffer + i, node);
+}
+
+// The name of the node at index changed from old_len code units.
+void
+ui_text_index_update(size_t index, size_t old_len) {
+  if (g_ui.text_index_building.valid()) g_ui.text_index_pending.push_back(index);
+  if (!g_ui.text_index) return;
+  auto& text_index = *g_ui.text_index;
+
+  // The trigrams that start in the two code units before the name read into it, and belong to the nodes before it.
+  // Their old postings are stale.
+  auto name_offset = ui_node_text_offset(index);
+  auto num_before = std::min(name_offset, size_t(2));
+  auto num_after = std::min(ui_node_text_offset(g_ui.node_ids.size()) - name_offset, size_t(2));
+  if (num_before + num_after >= 3) {
+    wchar_t buffer[4];
+    ui_text_range_copy({ ui_text_point(name_offset - num_before), ui_text_point(name_offset + num_after) }, num_before + num_after, buffer);
+    for (size_t i = 0; i < num_before && i + 3 <= num_before + num_after; i++) {
+      auto node = ui_text_node_at(name_offset - num_before + i);
+      if (node >= text_index.num_nodes) continue;
+      ui_text_index_post(text_index, buffer + i, node);
+      text_index.num_stale++;
+    }
+  }
+  ui_text_index_add(text_index, index);
+  text_index.num_stale += old_len;
+  if (text_index.num_stale > text_index.num_postings / 2) ui_text_index_build();
+}
+
+bool
+ui_text_index_poll() {
+  auto& building = g_ui.text_index_building;
+  if (building.valid() && building.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+    g_ui.text_index = building.get();
+    auto& text_index = *g_ui.text_index;
+    for (auto index : g_ui.text_index_pending) ui_text_index_add(text_index, index);
+    g_ui.text_index_pending.clear();
+    LOG_INFO(LogCategory_Tree, "text index: %zu nodes, %zu trigrams, %zu postings, built in %.1f ms\n", text_index.num_nodes,
+      text_index.postings.size(), text_index.num_postings, text_index.build_ms);
+  }
+  return g_ui.text_index != nullptr;
+}
+
+// Like ui_text_matcher_scan, but only reads the text around the nodes where the rarest trigram of the pattern starts,
+// and the nodes that aren't indexed.
+size_t
+ui_text_index_find(UiTree::TextIndex& text_index, UiTextMatcher const& matcher, size_t start, size_t end) {
+  auto m = matcher.pattern.size();
+  std::wstring pattern = matcher.pattern;
+  if (matcher.backward) std::reverse(pattern.begin(), pattern.end());
+
+  UiTree::TextIndex::Postings* rarest = nullptr;
+  size_t k = 0; // where its trigram is in the pattern.
+  for (size_t j = 0; j + 3 <= m; j++) {
+    auto it = text_index.postings.find(ui_text_trigram(pattern.data() + j));
+    if (it == text_index.postings.end()) { rarest = nullptr; break; }
+    if (!rarest || it->second.nodes.size() < rarest->nodes.size()) {
+      rarest = &it->second;
+      k = j;
+    }
+  }
+  std::vector<uint32_t> none;
+  auto& nodes = rarest ? rarest->nodes : none;
+  if (rarest && rarest->num_sorted < nodes.size()) {
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    rarest->num_sorted = nodes.size();
+  }
+
+  // The matches with the trigram in node n start within [start of n - k, end of n - k), and are m long. Windows that
+  // overlap are merged, so that no text is read twice.
+  auto num_nodes = g_ui.node_ids.size();
+  auto first = std::lower_bound(nodes.begin(), nodes.end(), uint32_t(ui_text_node_at(start > m ? start - m : 0)));
+  auto last = std::upper_bound(first, nodes.end(), uint32_t(end > 0 ? ui_text_node_at(end - 1) : 0));
+  auto indexed_end = text_index.num_nodes < num_nodes ? ui_node_text_offset(text_index.num_nodes) : size_t(-1);
+  const auto window = [&](uint32_t n) {
+    auto name_offset = ui_node_text_offset(n);
+    auto window_start = name_offset > k ? name_offset - k : 0;
+    auto window_end = name_offset + g_ui.node_name_len[n] + m - 1 - k;
+    return std::pair{ std::max(window_start, start), std::min(window_end, end) };
+  };
+  std::pair<size_t, size_t> unindexed = { indexed_end == size_t(-1) ? end : std::max(start, indexed_end > m ? indexed_end - (m - 1) : 0), end };
+  std::pair<size_t, size_t> merged = { 0, 0 };
+  size_t found = size_t(-1);
+  const auto flush = [&]() {
+    if (merged.first < merged.second) found = ui_text_matcher_scan(matcher, merged.first, merged.second);
+    merged = { 0, 0 };
+    return found != size_t(-1);
+  };
+  const auto scan = [&](std::pair<size_t, size_t> w) {
+    if (w.first >= w.second) return false;
+    if (merged.first < merged.second && w.first <= merged.second && merged.first <= w.second) {
+      merged = { std::min(merged.first, w.first), std::max(merged.second, w.second) };
+      return false;
+    }
+    if (flush()) return true;
+    merged = w;
+    return false;
+  };
+
+  if (!matcher.backward) {
+    for (auto it = first; it != last; it++) {
+      if (scan(window(*it))) return found;
+    }
+    if (scan(unindexed)) return found;
+  }
+  else {
+    if (scan(unindexed)) return found;
+    for (auto it = last; it != first;) {
+      if (scan(window(*--it))) return found;
+    }
+  }
+  flush();
+  return found;
+}
+
+// Finds the first occurrence of the text in the range, or the last one when searching backward, including those that
+// span several names. Uses g_ui.text_index when there is one.
+//
+// Returns false when the text could not be found in the range.
+bool
+ui_text_range_find(TextRange range, std::wstring_view search_text, bool backward, bool ignore_case, TextRange* found) {
+  auto start = ui_text_offset(range.start);
+  auto end = ui_text_offset(range.end);
+  auto m = search_text.size();
+  if (m == 0 || end < start || end - start < m) return false;
+
+  auto matcher = ui_text_matcher(search_text, backward, ignore_case);
+  auto pos = m >= 3 && ui_text_index_poll() ? ui_text_index_find(*g_ui.text_index, matcher, start, end)
+                                            : ui_text_matcher_scan(matcher, start, end);
+  if (pos == size_t(-1)) return false;
+  *found = { ui_text_point(pos), ui_text_point(pos + m) };
+  return true;
+}
+
+// The index of the deepest node that contains the whole range, or size_t(-1) when only the root does.
+size_t
+ui_text_range_enclosing_index(TextRange range) {
+  auto i = ui_get_index(range.start.id);
+  if (range.start.id == range.end.id) return i;
+
+  auto j = ui_get_index(range.end.id);
+  
+  while (g_ui.node_depth[i] > g_ui.node_depth[j]) {
+    i = g_ui.node_parent_index[i];
+  }
+  while (g_ui.node_depth[j] > g_ui.node_depth[i]) {
+    j = g_ui.node_parent_index[j];
+  }
+  VERIFY(g_ui.node_depth[i] == g_ui.node_depth[j]);
+  while (i != j && i != size_t(-1)) {
+    i = g_ui.node_parent_index[i];
+    j = g_ui.node_parent_index[j];
+  }
+  if (i == size_t(-1)) return i; // the range spans several top-level elements, so it's enclosed by the root.
+
+  auto enclosing_id = g_ui.node_ids[i];
+  VERIFY(enclosing_id == range.start.id || ui_is_ancestor(enclosing_id, range.start.id));
+  VERIFY(enclosing_id == range.end.id || ui_is_ancestor(enclosing_id, range.end.id));
+  return i;
+}
+
+// 4. Providers
+
+UiTree::Id
+ui_navigate(UiTree::Id id, UiNavigateDirection direction) {
+  if (id == 0) {
+    if (g_ui.node_ids.empty()) return UiTree::Id(-1);
+    size_t i = size_t(-1);
+    switch (direction) {
+    case UiNavigateDirection::kFirstChild: i = 0; break;
+    case UiNavigateDirection::kLastChild: i = g_ui.root_last_child; break;
+    default: break;
+    }
+    if (i == size_t(-1)) return UiTree::Id(-1);
+    VERIFY(g_ui.node_parent[i] == 0);
+    return g_ui.node_ids[i];
+  }
+
+  auto index = ui_get_index(id);
+  auto parent = g_ui.node_parent[index];
+  auto i = size_t(-1);
+  switch (direction) {
+  case UiNavigateDirection::kParent: return parent;
+  case UiNavigateDirection::kNextSibling: i = ui_next_sibling_index(index); break;
+  case UiNavigateDirection::kPrevSibling: i = ui_prev_sibling_index(index); break;
+  case UiNavigateDirection::kFirstChild: i = ui_first_child_index(index); break;
+  case UiNavigateDirection::kLastChild: i = ui_last_child_index(index); break;
+  }
+  if (i == size_t(-1)) return UiTree::Id(-1);
+  auto is_child = direction == UiNavigateDirection::kFirstChild || direction == UiNavigateDirection::kLastChild;
+  VERIFY(g_ui.node_parent[i] == (is_child ? id : parent));
+  return g_ui.node_ids[i];
+}
+
+UiPropertyValue
+ui_get_property(UiTree::Id id, UiProperty property) {
+  auto index = ui_get_index(id);
+  auto type = g_ui.node_type[index];
+  VERIFY(type != UiTree::Type::kNone);
+
+  UiPropertyValue value;
+  const auto string = [&](std::wstring_view s) { value.kind = UiPropertyValue::Kind::kString; value.string = s; };
+  const auto boolean = [&](bool b) { value.kind = UiPropertyValue::Kind::kBool; value.boolean = b; };
+  switch (property) {
+  case UiProperty::kName: string(ui_node_name(index)); break;
+  case UiProperty::kControlType: value.kind = UiPropertyValue::Kind::kType; value.type = type; break;
+  case UiProperty::kIsControlElement: boolean(true); break;
+  case UiProperty::kIsContentElement: boolean(true); break;
+  case UiProperty::kIsEnabled: boolean(true); break;
+  case UiProperty::kIsKeyboardFocusable: boolean(true); break;
+  case UiProperty::kLabeledBy: if (type == UiTree::Type::kDocument) string(ui_node_name(index)); break;
+  case UiProperty::kNativeWindowHandle: value.kind = UiPropertyValue::Kind::kInt; value.integer = 0; break;
+  case UiProperty::kProviderDescription: string(L"UU::RootProvider"); break;
+  case UiProperty::kClassName: string(L"UU::RootProvider"); break;
+  case UiProperty::kHasKeyboardFocus: boolean(g_ui.focused_id == id); break;
+  }
+  return value;
+}
+
+UiRect
+ui_get_bounding_rectangle(UiTree::Id id) {
+  return g_ui.node_rect[ui_get_index(id)];
+}
+
+UiTree::Id
+ui_element_from_point(double x, double y) {
+  auto index = ui_search_deepest_node_containing(x, y);
+  return index == size_t(-1) ? 0 : g_ui.node_ids[index];
+}
+
+bool
+ui_get_document_range(UiTree::Id id, TextRange* range) {
+  auto index = ui_get_index(id);
+  if (g_ui.node_type[index] != UiTree::Type::kDocument) return false;
+  *range = { { .id = id, .offset = 0 }, { .id = id, .offset = int(ui_node_text_len(index)) } };
+  return true;
+}
+
+// max_length is -1 for all of the range.
+size_t
+ui_text_range_get_text_len(TextRange range, int max_length) {
+  auto len = ui_text_range_len(range);
+  if (max_length >= 0) len = std::min(len, size_t(max_length));
+  return len;
+}
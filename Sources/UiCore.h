@@ -0,0 +1,316 @@
+// # UiCore
+//
+// The ui tree of SRFirst, without any windowing or accessibility API: building the tree, looking up and navigating
+// nodes, the text of the tree and points/ranges within it, hit-testing and focus.
+//
+// It builds anywhere with a C++20 compiler, so that it can be measured without Windows or a screen reader (see
+// UiCoreBenchmarkMain.cpp). The Win32/UIA layer (SRFirstMain.cpp) adapts it to UI Automation providers, and is told
+// about what changes through g_ui_events.
+
+#pragma once
+
+#include "LogFilter.h"
+#include "RectIndex.h"
+#include "TextBoundaryScanner.h"
+
+#include <compare>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// 1. Utils
+
+#define STRINGIFY_INNER(s) # s
+#define STRINGIFY(s) STRINGIFY_INNER(s)
+#define VERIFY(expr) do { auto r = (expr); if (!bool(r)) { verify_failed(__FILE__, __LINE__, STRINGIFY(expr)); } } while(0)
+
+// Logs the failure then exits. (breaking into the debugger first, if there is one)
+[[noreturn]] void verify_failed(char const* file, int line, char const* expr);
+
+void logv(char const* fmt, va_list args);
+void log(char const* fmt, ...);
+
+uint64_t hash(size_t num_bytes, void const* bytes);
+
+// 2. The tree
+
+// In client coordinates, like a win32 RECT.
+struct UiRect {
+  int32_t left;
+  int32_t top;
+  int32_t right;
+  int32_t bottom;
+};
+
+bool rect_contains(UiRect const r, double x, double y);
+
+struct UiTree {
+  using Id = std::uint64_t;
+  // Id == -1 => invalid_id
+  // Id == 0  => root
+  // ...
+
+  enum class Type {
+    kNone,
+    kText,
+    kDocument,
+    kButton,
+    kPane,
+  };
+
+  // Nodes with their properties as separate arrays, APL-style.
+  std::vector<Id>           node_ids; // in presentation order.
+  std::vector<size_t>       node_name_len;
+  std::vector<Type>         node_type;
+  std::vector<Id>           node_parent; // ids, as exposed to UIA clients.
+  std::vector<int>          node_depth;
+  std::vector<size_t>       node_name_offset; // where the name of this node is stored in `text`.
+  std::vector<size_t>       node_name_capacity; // room for the name at node_name_offset, for ui_set_text to update it in place.
+
+  // Storage for all the node names. They start concatenated in presentation order, but names that outgrow their
+  // capacity in ui_set_text are moved to the end, leaving `text_unused` characters behind until the next compaction.
+  std::vector<wchar_t>      text;
+  size_t                    text_unused = 0;
+
+  // Binary indexed (Fenwick) tree over node_name_len, in presentation order. (1-based)
+  // Gives the offset of a node within the text of the whole tree (see ui_node_text_offset) and the length of
+  // the text within a node including its children (see ui_node_text_len) in O(log n), even as names change.
+  std::vector<size_t>       text_len_tree;
+
+  // Structure, as indices into the node arrays. size_t(-1) => none.
+  std::vector<size_t>       node_parent_index; // size_t(-1) => root.
+  std::vector<size_t>       node_subtree_end; // one past the index of the last descendant of this node.
+  std::vector<size_t>       node_prev_sibling;
+  std::vector<size_t>       node_last_child;
+  size_t                    root_last_child = size_t(-1);
+
+  // Nodes that delimit a TextUnit, in presentation order, to move ranges by counting units.
+  std::vector<size_t>       document_indices;
+  std::vector<size_t>       paragraph_indices;
+
+  // Where the words and lines start within the name of a node, as bitmaps over its code units. Scanned when a range
+  // first moves through the node (see ui_text_boundaries), and dropped when its name changes.
+  struct TextBoundaries {
+    TextBoundaryBits words;
+    TextBoundaryBits lines;
+  };
+  std::unordered_map<Id, TextBoundaries> text_boundaries;
+
+  // Optional index of the nodes where each trigram of the text starts, case folded, so that finding text in a large
+  // tree only reads the text around the nodes that have the rarest trigram of the search. (see ui_text_index_build)
+  //
+  // Trigrams that span names belong to the node where they start. When a name changes, the node is added to the
+  // postings of its new trigrams, and its old postings are left behind: they only cost a look at a node that doesn't
+  // match, until the next rebuild. Nodes added after the build aren't indexed, and are searched in full.
+  struct TextIndex {
+    struct Postings {
+      std::vector<uint32_t> nodes; // node indices.
+      size_t num_sorted = 0; // nodes[0..num_sorted) are sorted and unique, the rest were appended by updates.
+    };
+    std::unordered_map<uint64_t, Postings> postings;
+    size_t num_nodes = 0;
+    size_t num_postings = 0;
+    size_t num_stale = 0; // postings of names that have changed since, an estimate.
+    double build_ms = 0.0;
+  };
+  std::unique_ptr<TextIndex> text_index;
+  std::future<std::unique_ptr<TextIndex>> text_index_building;
+  std::vector<size_t> text_index_pending; // nodes whose names changed during the build.
+
+  std::vector<UiRect> node_rect;
+
+  RectIndex<UiRect> rect_index; // over node_rect, for hit-testing.
+
+  // Open-addressing table from node id to its index in the node arrays, kept in sync by ui_named_element.
+  struct {
+    std::vector<Id>     keys; // 0 => empty slot, since 0 is never a valid node id.
+    std::vector<size_t> indices;
+    size_t count = 0;
+  } index_by_id;
+
+  struct {
+    size_t finger_hits = 0;
+    size_t finger_misses = 0;
+  } index_stats;
+
+  std::unordered_map<Id, std::function<void()>> actions;
+
+  Id focused_id = 0;
+
+  int depth_for_adding_element = 0;
+  std::vector<size_t> open_element_stack; // [depth] => index of the last element added at that depth, i.e. the open container for depth + 1.
+};
+
+bool valid_id(UiTree::Id id);
+bool exists_id(UiTree::Id id);
+
+extern UiTree g_ui;
+
+// What the ui tells its clients about, set by the platform layer. (all optional)
+struct UiEvents {
+  void (*focus_changed)(UiTree::Id id) = nullptr;
+  void (*text_changed)(UiTree::Id id) = nullptr;
+  void (*invoked)(UiTree::Id id) = nullptr;
+};
+
+extern UiEvents g_ui_events;
+
+// Describing the tree, in presentation order. Children are added under the last node added at
+// depth_for_adding_element - 1.
+UiTree::Id ui_named_element(wchar_t const* name, UiTree::Type type);
+UiTree::Id ui_document(wchar_t const* text);
+UiTree::Id ui_text_paragraph(wchar_t const* text);
+UiTree::Id ui_button(wchar_t const* text, std::function<void()> action);
+UiTree::Id ui_pane(wchar_t const* text);
+void ui_set_rect(UiTree::Id id, UiRect rect);
+void ui_set_text(UiTree::Id id, wchar_t const* text);
+
+// Looking up nodes.
+size_t ui_find_index(UiTree::Id id);
+size_t ui_get_index(UiTree::Id id);
+std::wstring_view ui_node_name(size_t index);
+size_t ui_search_deepest_node_containing(double x, double y);
+void ui_rect_index_update(); // done by the search when needed, exposed to measure it.
+
+// Navigation. All return size_t(-1) when there is no such node.
+size_t ui_get_parent_index(UiTree::Id id);
+size_t ui_next_sibling_index(size_t index);
+size_t ui_prev_sibling_index(size_t index);
+size_t ui_first_child_index(size_t index);
+size_t ui_last_child_index(size_t index);
+bool ui_is_ancestor(UiTree::Id candidate_ancestor_id, UiTree::Id of_id);
+
+// Focus and activation.
+void ui_focus_next();
+void ui_focus_prev();
+void ui_set_focus_to(UiTree::Id id);
+void ui_activate();
+bool ui_activate(UiTree::Id);
+
+// 3. Text
+
+// A TextPoint is an offset within the text of an element (including its children.)
+//
+// This representation has two potential termination for a right exclusive range:
+// 
+// Either the same id with offset == length of text in element or
+// the next id with offset = 0
+//
+// Both denote the same position in the text of the whole tree, so we compare points through their global offset (see ui_text_offset),
+// and only ever go from a global offset back to a TextPoint with ui_text_point.
+//
+struct TextPoint;
+
+size_t ui_text_offset(TextPoint point);
+TextPoint ui_text_point(size_t offset);
+
+struct TextPoint {
+  UiTree::Id id = (uint64_t)-1;
+  int offset = 0;
+
+  friend bool operator==(TextPoint const a, TextPoint const b) {
+    return ui_text_offset(a) == ui_text_offset(b);
+  }
+
+  friend std::strong_ordering operator<=>(TextPoint const a, TextPoint const b) {
+    return ui_text_offset(a) <=> ui_text_offset(b);
+  }
+};
+
+struct TextRange {
+  TextPoint start;
+  TextPoint end;
+};
+
+// Same values as UIA's TextUnit.
+enum class UiTextUnit {
+  kCharacter,
+  kFormat,
+  kWord,
+  kLine,
+  kParagraph,
+  kPage,
+  kDocument,
+};
+
+size_t ui_node_text_offset(size_t index);
+size_t ui_node_text_len(size_t index);
+size_t ui_text_node_at(size_t offset);
+
+// Moves an offset within the text of the whole tree across `count` boundaries of the unit, forward when positive.
+// Stops at the start or the end of the text, and returns how many boundaries were crossed. (negative when backward)
+// Characters are grapheme clusters (see GraphemeBreak.h), of one or more code units. Names start new characters, words
+// and lines, so the start of every name is a boundary.
+int ui_text_move_offset(UiTextUnit unit, size_t* offset, int count);
+
+// Operations of the text pattern on ranges.
+bool ui_text_range_move(TextRange& range, UiTextUnit unit, int count, int* moved);
+void ui_text_range_expand_to_enclosing_unit(TextRange& range, UiTextUnit unit);
+void ui_text_range_move_endpoint_by_range(TextRange& range, bool start, TextPoint point);
+void ui_text_range_move_endpoint_by_unit(TextRange& range, bool start, UiTextUnit unit, int count, int* moved);
+size_t ui_text_range_len(TextRange range);
+void ui_text_range_copy(TextRange range, size_t len, wchar_t* dest);
+bool ui_text_range_find(TextRange range, std::wstring_view text, bool backward, bool ignore_case, TextRange* found);
+size_t ui_text_range_enclosing_index(TextRange range);
+
+// Starts building g_ui.text_index in the background, from a copy of the text. Later searches use it once it's done.
+void ui_text_index_build();
+// Takes the index once its build is done. Returns whether there is an index.
+bool ui_text_index_poll();
+
+// 4. Providers
+
+// What the UIA providers answer, without COM: SRFirstMain.cpp marshals the results into VARIANTs and providers, and
+// ScreenReaderSimulatorMain.cpp calls these directly, so that it measures what the providers actually do.
+
+enum class UiNavigateDirection {
+  kParent,
+  kNextSibling,
+  kPrevSibling,
+  kFirstChild,
+  kLastChild,
+};
+
+// From the element `id`, or from the root when it's 0. Returns 0 for the root, and -1 when there is no such element.
+UiTree::Id ui_navigate(UiTree::Id id, UiNavigateDirection direction);
+
+// The properties of elements that we support.
+enum class UiProperty {
+  kName,
+  kControlType,
+  kIsControlElement,
+  kIsContentElement,
+  kIsEnabled,
+  kIsKeyboardFocusable,
+  kLabeledBy,
+  kNativeWindowHandle,
+  kProviderDescription,
+  kClassName,
+  kHasKeyboardFocus,
+};
+
+struct UiPropertyValue {
+  enum class Kind {
+    kEmpty, // not supported for this element.
+    kString,
+    kType,
+    kBool,
+    kInt,
+  } kind = Kind::kEmpty;
+  std::wstring_view string; // valid until the tree changes.
+  UiTree::Type type = UiTree::Type::kNone;
+  bool boolean = false;
+  int32_t integer = 0;
+};
+
+UiPropertyValue ui_get_property(UiTree::Id id, UiProperty property);
+UiRect ui_get_bounding_rectangle(UiTree::Id id); // in client coordinates.
+UiTree::Id ui_element_from_point(double x, double y); // in client coordinates. Returns 0 for the root.
+bool ui_get_document_range(UiTree::Id id, TextRange* range); // false for elements without a text pattern.
+size_t ui_text_range_get_text_len(TextRange range, int max_length); // what GetText returns, to copy with ui_text_range_copy.
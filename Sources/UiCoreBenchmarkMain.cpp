@@ -0,0 +1,700 @@
+// # UiCore Benchmark
+//
+// Measures the ui tree of UiCore.h at sizes from a thousand to ten million nodes, without a window or a screen-reader,
+// so that it runs on any machine. (see CMakeLists.txt for the non-Windows build)
+//
+// Usage: UiCoreBenchmark [max_num_nodes]
+//
+// Results go to the standard output.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "GraphemeBreak.h"
+#include "UiBenchmarkTree.h"
+#include "UiCore.h"
+#include "wyhash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <cwctype>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+double
+ns_between(std::chrono::steady_clock::time_point t0, std::chrono::steady_clock::time_point t1) {
+  return std::chrono::duration<double, std::nano>(t1 - t0).count();
+}
+
+// At most max_count of the indices, evenly spread, for the measurements that would take too long on the largest trees.
+std::vector<size_t>
+sample(std::vector<size_t> const& indices, size_t max_count) {
+  if (indices.size() <= max_count) return indices;
+  std::vector<size_t> result;
+  auto step = double(indices.size()) / double(max_count);
+  for (size_t i = 0; i < max_count; i++) result.push_back(indices[size_t(double(i) * step)]);
+  return result;
+}
+
+void
+ui_benchmark_lookup() {
+  auto num_nodes = g_ui.node_ids.size();
+  auto const num_lookups = std::min(num_nodes, size_t(1000000));
+  uint64_t seed = 42;
+  std::vector<UiTree::Id> ids(num_lookups);
+  for (auto& id : ids) id = g_ui.node_ids[wy2u0k(wyrand(&seed), num_nodes)];
+
+  size_t sum = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (auto id : ids) sum += ui_find_index(id);
+  auto t1 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < num_lookups; i++) sum += ui_get_index(ids[i & ~size_t(3)]); // the same element a few times in a row, like UIA clients do.
+  auto t2 = std::chrono::steady_clock::now();
+  VERIFY(sum != 0);
+
+  std::printf("  lookup:       random ids: %6.1f ns/lookup, repeated ids: %6.1f ns/lookup\n",
+    ns_between(t0, t1) / num_lookups, ns_between(t1, t2) / num_lookups);
+}
+
+enum class Direction {
+  kParent,
+  kNextSibling,
+  kPrevSibling,
+  kFirstChild,
+  kLastChild,
+};
+
+void
+ui_benchmark_navigation() {
+  auto num_nodes = g_ui.node_ids.size();
+
+  // The navigation as it was implemented before the structure columns, by scanning node_depth.
+  const auto navigate_by_scanning = [](size_t index, Direction direction) -> size_t {
+    auto n = g_ui.node_ids.size();
+    auto depth = g_ui.node_depth[index];
+    switch (direction) {
+    case Direction::kParent: {
+      for (auto ri = index; ri > 0; ri--) {
+        if (g_ui.node_depth[ri - 1] == depth - 1) return ri - 1;
+      }
+    } break;
+    case Direction::kNextSibling: {
+      for (auto i = index + 1; i < n && g_ui.node_depth[i] >= depth; i++) {
+        if (g_ui.node_depth[i] == depth) return i;
+      }
+    } break;
+    case Direction::kPrevSibling: {
+      for (auto ri = index; ri > 0 && g_ui.node_depth[ri - 1] >= depth; ri--) {
+        if (g_ui.node_depth[ri - 1] == depth) return ri - 1;
+      }
+    } break;
+    case Direction::kFirstChild: {
+      if (index + 1 < n && g_ui.node_depth[index + 1] == depth + 1) return index + 1;
+    } break;
+    case Direction::kLastChild: {
+      auto last = size_t(-1);
+      for (auto i = index + 1; i < n && g_ui.node_depth[i] >= depth + 1; i++) {
+        if (g_ui.node_depth[i] == depth + 1) last = i;
+      }
+      return last;
+    } break;
+    }
+    return size_t(-1);
+  };
+
+  const auto navigate_by_columns = [](size_t index, Direction direction) -> size_t {
+    switch (direction) {
+    case Direction::kParent: return g_ui.node_parent_index[index];
+    case Direction::kNextSibling: return ui_next_sibling_index(index);
+    case Direction::kPrevSibling: return ui_prev_sibling_index(index);
+    case Direction::kFirstChild: return ui_first_child_index(index);
+    case Direction::kLastChild: return ui_last_child_index(index);
+    }
+    return size_t(-1);
+  };
+
+  struct { Direction direction; char const* name; } directions[] = {
+    { Direction::kParent, "parent" },
+    { Direction::kNextSibling, "next-sibling" },
+    { Direction::kPrevSibling, "prev-sibling" },
+    { Direction::kFirstChild, "first-child" },
+    { Direction::kLastChild, "last-child" },
+  };
+
+  // Most nodes are leaves, for which scanning is cheap. The containers are where scanning costs O(subtree).
+  std::vector<size_t> all_nodes(num_nodes);
+  std::vector<size_t> containers;
+  for (size_t i = 0; i < num_nodes; i++) {
+    all_nodes[i] = i;
+    if (g_ui.node_type[i] != UiTree::Type::kText) containers.push_back(i);
+  }
+  auto scanned_nodes = sample(all_nodes, 1000000);
+  auto scanned_containers = sample(containers, 10000);
+
+  const auto time_ns_per_node = [](auto const& indices, auto&& fn) -> double {
+    size_t sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto i : indices) sum += fn(i);
+    auto t1 = std::chrono::steady_clock::now();
+    VERIFY(sum != 0);
+    return ns_between(t0, t1) / indices.size();
+  };
+
+  std::printf("  navigation:   %zu containers\n", containers.size());
+  for (auto [direction, direction_name] : directions) {
+    for (auto i : scanned_nodes) {
+      VERIFY(navigate_by_columns(i, direction) == navigate_by_scanning(i, direction));
+    }
+    auto scan = [&](size_t i) { return navigate_by_scanning(i, direction); };
+    auto columns = [&](size_t i) { return navigate_by_columns(i, direction); };
+    std::printf("    %-12s all nodes: scanning %10.1f ns/node, columns %6.1f ns/node. containers: scanning %10.1f ns/node, columns %6.1f ns/node\n",
+      direction_name,
+      time_ns_per_node(scanned_nodes, scan), time_ns_per_node(all_nodes, columns),
+      time_ns_per_node(scanned_containers, scan), time_ns_per_node(containers, columns));
+  }
+}
+
+void
+ui_benchmark_text_offsets() {
+  auto num_nodes = g_ui.node_ids.size();
+  auto text_size = ui_node_text_offset(num_nodes);
+  auto const step = std::max(size_t(97), text_size / 1000000); // a sample of the offsets, landing at all positions within the names.
+
+  std::vector<TextPoint> points;
+  for (size_t offset = 0; offset <= text_size; offset += step) points.push_back(ui_text_point(offset));
+  for (size_t i = 0; i < points.size(); i++) VERIFY(ui_text_offset(points[i]) == i * step);
+
+  size_t sum = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t offset = 0; offset <= text_size; offset += step) sum += ui_text_point(offset).offset;
+  auto t1 = std::chrono::steady_clock::now();
+  for (auto point : points) sum += ui_text_offset(point);
+  auto t2 = std::chrono::steady_clock::now();
+  VERIFY(sum != 0);
+
+  std::printf("  text offsets: %zu characters, offset to point: %6.1f ns/point, point to offset: %6.1f ns/point\n",
+    text_size, ns_between(t0, t1) / points.size(), ns_between(t1, t2) / points.size());
+}
+
+void
+ui_benchmark_text_ranges() {
+  auto const& paragraphs = g_ui.paragraph_indices;
+  auto const num_ranges = std::min(paragraphs.size(), size_t(100000));
+  uint64_t seed = 42;
+  std::vector<TextRange> ranges(num_ranges);
+  for (auto& range : ranges) {
+    auto index = paragraphs[wy2u0k(wyrand(&seed), paragraphs.size())];
+    auto id = g_ui.node_ids[index];
+    range = { { .id = id, .offset = 0 }, { .id = id, .offset = int(g_ui.node_name_len[index]) } };
+  }
+
+  // A screen-reader reading paragraph by paragraph: move to the next one, and get its text.
+  size_t sum = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (auto range : ranges) {
+    int moved;
+    VERIFY(ui_text_range_move(range, UiTextUnit::kParagraph, 1, &moved));
+    sum += moved + range.end.offset;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  wchar_t text[64];
+  for (auto range : ranges) {
+    auto len = std::min(ui_text_range_len(range), std::size(text));
+    ui_text_range_copy(range, len, text);
+    sum += len + text[0];
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  for (auto range : ranges) sum += ui_text_range_enclosing_index(range);
+  auto t3 = std::chrono::steady_clock::now();
+
+  // Searching for text that isn't there, from a paragraph to the end of its document.
+  auto const num_searches = std::min(num_ranges, size_t(1000));
+  for (size_t i = 0; i < num_searches; i++) {
+    auto range = ranges[i];
+    auto document_index = g_ui.node_parent_index[ui_get_index(range.start.id)];
+    auto last_index = g_ui.node_subtree_end[document_index] - 1;
+    range.end = { .id = g_ui.node_ids[last_index], .offset = int(g_ui.node_name_len[last_index]) };
+    TextRange found;
+    sum += ui_text_range_find(range, L"Paragraph 100", false, false, &found);
+  }
+  auto t4 = std::chrono::steady_clock::now();
+  VERIFY(sum != 0);
+
+  std::printf("  text ranges:  move: %6.1f ns/range, get text: %6.1f ns/range, enclosing element: %6.1f ns/range, find text: %10.1f ns/search\n",
+    ns_between(t0, t1) / num_ranges, ns_between(t1, t2) / num_ranges, ns_between(t2, t3) / num_ranges, ns_between(t3, t4) / num_searches);
+}
+
+void
+ui_benchmark_hover() {
+  auto num_nodes = g_ui.node_ids.size();
+  auto width = double(ui_benchmark_num_panes(num_nodes) * kPaneWidth);
+
+  // The hit-testing as it was implemented before the rect index.
+  const auto search_by_scanning = [](double x, double y) -> size_t {
+    auto depth = 0;
+    size_t found = size_t(-1);
+    for (size_t i = 0; i < g_ui.node_rect.size(); i++) {
+      auto d = g_ui.node_depth[i];
+      if (d < depth) continue;
+      if (!rect_contains(g_ui.node_rect[i], x, y)) continue;
+      depth = d;
+      found = i;
+    }
+    return found;
+  };
+
+  // The mouse wandering over the window in small steps, or jumping anywhere, sometimes outside of the panes.
+  uint64_t seed = 42;
+  auto const num_points = size_t(1000000);
+  std::vector<std::pair<double, double>> wandering(num_points);
+  std::vector<std::pair<double, double>> jumping(num_points);
+  double mouse_x = 0.0, mouse_y = 0.0;
+  for (size_t i = 0; i < num_points; i++) {
+    mouse_x = std::clamp(mouse_x + double(wy2u0k(wyrand(&seed), 21)) - 10.0, -50.0, width + 50.0);
+    mouse_y = std::clamp(mouse_y + double(wy2u0k(wyrand(&seed), 21)) - 10.0, -50.0, double(kPaneHeight) + 50.0);
+    wandering[i] = { mouse_x, mouse_y };
+    jumping[i] = { double(wy2u0k(wyrand(&seed), uint64_t(width) + 100)) - 50.0, double(wy2u0k(wyrand(&seed), kPaneHeight + 100)) - 50.0 };
+  }
+
+  const auto time_ns_per_point = [](auto const& points, size_t count, auto&& fn) -> double {
+    size_t sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) sum += fn(points[i].first, points[i].second);
+    auto t1 = std::chrono::steady_clock::now();
+    VERIFY(sum != 0);
+    return ns_between(t0, t1) / count;
+  };
+
+  auto t0 = std::chrono::steady_clock::now();
+  ui_rect_index_update();
+  auto t1 = std::chrono::steady_clock::now();
+
+  // Scanning costs O(n) per point, so fewer points as the tree grows.
+  auto const num_scanned = std::clamp(size_t(10000000) / num_nodes, size_t(100), size_t(10000));
+  for (auto points : { &wandering, &jumping }) {
+    for (size_t i = 0; i < num_scanned; i++) {
+      auto [x, y] = (*points)[i];
+      VERIFY(ui_search_deepest_node_containing(x, y) == search_by_scanning(x, y));
+    }
+  }
+
+  std::printf("  hit-testing:  index build: %.1f ns\n", ns_between(t0, t1));
+  std::printf("    wandering: scanning %10.1f ns/point, index %6.1f ns/point. jumping: scanning %10.1f ns/point, index %6.1f ns/point\n",
+    time_ns_per_point(wandering, num_scanned, search_by_scanning), time_ns_per_point(wandering, num_points, ui_search_deepest_node_containing),
+    time_ns_per_point(jumping, num_scanned, search_by_scanning), time_ns_per_point(jumping, num_points, ui_search_deepest_node_containing));
+}
+
+// Changes the tree, so it runs last.
+void
+ui_benchmark_set_text() {
+  auto num_nodes = g_ui.node_ids.size();
+  auto const& paragraphs = g_ui.paragraph_indices;
+
+  // Rewrite random paragraphs, like a log or chat transcript would, with names growing and shrinking.
+  auto const num_updates = size_t(100000);
+  uint64_t seed = 42;
+  std::vector<UiTree::Id> ids(num_updates);
+  std::vector<std::wstring> names(num_updates);
+  for (size_t i = 0; i < num_updates; i++) {
+    ids[i] = g_ui.node_ids[paragraphs[wy2u0k(wyrand(&seed), paragraphs.size())]];
+    names[i] = std::wstring(wy2u0k(wyrand(&seed), 120), L'x');
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < num_updates; i++) ui_set_text(ids[i], names[i].c_str());
+  auto t1 = std::chrono::steady_clock::now();
+  size_t sum = 0;
+  for (auto index : paragraphs) sum += ui_node_text_offset(index);
+  auto t2 = std::chrono::steady_clock::now();
+  VERIFY(sum != 0);
+
+  // What it would cost to recompute all the offsets after an update instead.
+  std::vector<size_t> offsets(num_nodes + 1);
+  for (size_t i = 0; i < num_nodes; i++) offsets[i + 1] = offsets[i] + g_ui.node_name_len[i];
+  auto t3 = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < num_nodes; i++) {
+    VERIFY(ui_node_text_offset(i) == offsets[i]);
+    VERIFY(ui_node_text_len(i) == offsets[g_ui.node_subtree_end[i]] - offsets[i]);
+  }
+  std::unordered_map<UiTree::Id, size_t> last_update;
+  for (size_t i = 0; i < num_updates; i++) last_update[ids[i]] = i;
+  for (auto [id, i] : last_update) {
+    VERIFY(ui_node_name(ui_find_index(id)) == names[i]);
+  }
+
+  std::printf("  set text:     %zu updates: %6.1f ns/update, offset queries: %6.1f ns/query, recomputing all offsets: %10.1f ns\n",
+    num_updates, ns_between(t0, t1) / num_updates, ns_between(t1, t2) / paragraphs.size(), ns_between(t2, t3));
+}
+
+// A book-sized document, of paragraphs of prose split in lines, read by word, line and character.
+void
+ui_benchmark_text_units(size_t num_characters) {
+  g_ui = {};
+  ui_document(L"Book");
+  g_ui.depth_for_adding_element++;
+  static wchar_t const* const kWords[] = { L"the", L"quick", L"brown", L"fox", L"jumps", L"over", L"lazy", L"dogs", L"ui", L"automation" };
+  uint64_t seed = 42;
+  size_t num_words = 1, num_lines = 1; // the name of the document.
+  size_t num_crlfs = 0; // one character each.
+  std::wstring text;
+  for (int p = 0; ui_node_text_offset(g_ui.node_ids.size()) < num_characters; p++) {
+    text.clear();
+    for (size_t i = 0; text.size() < 64 * 1024; i++) {
+      if (i > 0) {
+        auto r = wy2u0k(wyrand(&seed), 16);
+        text += r == 0 ? L"\r\n" : r == 1 ? L"\n" : L" ";
+        num_lines += r <= 1;
+        num_crlfs += r == 0;
+      }
+      text += kWords[wy2u0k(wyrand(&seed), std::size(kWords))];
+      num_words++;
+      if (wy2u0k(wyrand(&seed), 8) == 0) {
+        text += L",";
+        num_words++;
+      }
+    }
+    num_words += text.back() != L','; // ",." is one word.
+    text += L".";
+    num_lines++;
+    wchar_t prefix[32];
+    std::swprintf(prefix, std::size(prefix), L"%d ", p);
+    ui_text_paragraph((prefix + text).c_str());
+    num_words++;
+  }
+  g_ui.depth_for_adding_element--;
+  auto text_size = ui_node_text_offset(g_ui.node_ids.size());
+
+  // From the start to the end of the text, one unit at a time, which builds the boundaries of every name on the way.
+  const auto count_moves = [](UiTextUnit unit, size_t offset, int count) {
+    size_t num_moves = 0;
+    while (ui_text_move_offset(unit, &offset, count) == count) num_moves++;
+    return num_moves;
+  };
+  auto t0 = std::chrono::steady_clock::now();
+  VERIFY(count_moves(UiTextUnit::kWord, 0, 1) == num_words);
+  VERIFY(count_moves(UiTextUnit::kLine, 0, 1) == num_lines);
+  auto t1 = std::chrono::steady_clock::now();
+  VERIFY(count_moves(UiTextUnit::kWord, text_size, -1) == num_words);
+  auto t2 = std::chrono::steady_clock::now();
+  VERIFY(count_moves(UiTextUnit::kLine, text_size, -1) == num_lines);
+  auto t3 = std::chrono::steady_clock::now();
+  VERIFY(count_moves(UiTextUnit::kCharacter, 0, 1) == text_size - num_crlfs);
+  auto t4 = std::chrono::steady_clock::now();
+
+  // A screen-reader reading word by word, and jumping by pages of words.
+  TextRange range = { ui_text_point(0), ui_text_point(0) };
+  ui_text_range_expand_to_enclosing_unit(range, UiTextUnit::kWord);
+  VERIFY(ui_text_range_len(range) == 4); // "Book", which ends with the name of the document.
+  auto const num_reads = size_t(100000);
+  size_t sum = 0;
+  auto t5 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < num_reads; i++) {
+    int moved;
+    VERIFY(ui_text_range_move(range, UiTextUnit::kWord, 1, &moved));
+    sum += moved + ui_text_range_len(range);
+    if (moved == 0) range = { ui_text_point(0), ui_text_point(1) }; // read it again.
+  }
+  auto t6 = std::chrono::steady_clock::now();
+  for (int i = 0, direction = 1; i < int(num_reads / 100); i++) {
+    int moved;
+    ui_text_range_move_endpoint_by_unit(range, direction > 0, UiTextUnit::kWord, direction * 1000, &moved);
+    VERIFY(ui_text_range_move(range, UiTextUnit::kWord, direction * 1000, &moved));
+    sum += ui_text_range_len(range);
+    if (moved != direction * 1000) direction = -direction;
+  }
+  auto t7 = std::chrono::steady_clock::now();
+  VERIFY(sum != 0);
+
+  std::printf("benchmark: %zu characters, %zu words, %zu lines\n", text_size, num_words, num_lines);
+  std::printf("  text units:   first reading by word and line: %6.1f ns/unit, by word: %6.1f ns/word, by line: %6.1f ns/line, by character: %6.1f ns/character\n",
+    ns_between(t0, t1) / (num_words + num_lines), ns_between(t1, t2) / num_words, ns_between(t2, t3) / num_lines, ns_between(t3, t4) / (text_size - num_crlfs));
+  std::printf("  text ranges:  move by word: %6.1f ns/range, move endpoint and range by 1000 words: %6.1f ns/range\n",
+    ns_between(t5, t6) / num_reads, ns_between(t6, t7) / (num_reads / 100));
+
+  // Find text, checked against searching a copy of the whole text. The end of a paragraph and the number of the next
+  // one make for matches across names.
+  std::wstring all(text_size, L'\0');
+  ui_text_range_copy({ ui_text_point(0), ui_text_point(text_size) }, text_size, all.data());
+  std::wstring all_folded = all;
+  for (auto& c : all_folded) c = std::towlower(c);
+  const auto find = [&](TextRange range, std::wstring_view search_text, bool backward, bool ignore_case) {
+    TextRange found;
+    if (!ui_text_range_find(range, search_text, backward, ignore_case, &found)) return std::wstring::npos;
+    VERIFY(ui_text_offset(found.end) - ui_text_offset(found.start) == search_text.size());
+    return ui_text_offset(found.start);
+  };
+  const auto expected = [&](size_t start, size_t end, std::wstring search_text, bool backward, bool ignore_case) {
+    if (ignore_case) for (auto& c : search_text) c = std::towlower(c);
+    auto text = std::wstring_view(ignore_case ? all_folded : all).substr(start, end - start);
+    auto pos = backward ? text.rfind(search_text) : text.find(search_text);
+    return pos == std::wstring::npos ? pos : start + pos;
+  };
+  for (int i = 0; i < 1000; i++) {
+    auto a = wy2u0k(wyrand(&seed), text_size + 1), b = wy2u0k(wyrand(&seed), text_size + 1);
+    auto len = 1 + wy2u0k(wyrand(&seed), 24);
+    auto at = wy2u0k(wyrand(&seed), text_size - len);
+    std::wstring search_text = all.substr(at, len);
+    if (i % 2) for (auto& c : search_text) c = std::towupper(c);
+    bool backward = i % 3 == 0, ignore_case = i % 2 == 1;
+    TextRange range = { ui_text_point(std::min(a, b)), ui_text_point(std::max(a, b)) };
+    VERIFY(find(range, search_text, backward, ignore_case) == expected(std::min(a, b), std::max(a, b), search_text, backward, ignore_case));
+  }
+
+  TextRange whole = { ui_text_point(0), ui_text_point(text_size) };
+  struct Search { std::wstring_view text; bool backward; bool ignore_case; };
+  Search const searches[] = {
+    { L"lazy fox jumps over the zebra", false, false }, // no zebras: from the start to the end.
+    { L"lazy fox jumps over the zebra", true, false },
+    { L"Lazy Fox Jumps Over The Zebra", false, true },
+    { L"Lazy Fox Jumps Over The Zebra", true, true },
+    { L".63 ", false, false }, // across names.
+  };
+  for (auto search : searches) {
+    auto const num_runs = 4;
+    size_t pos = 0;
+    auto t8 = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_runs; i++) pos = find(whole, search.text, search.backward, search.ignore_case);
+    auto t9 = std::chrono::steady_clock::now();
+    VERIFY(pos == expected(0, text_size, std::wstring(search.text), search.backward, search.ignore_case));
+    auto searched = pos == std::wstring::npos ? text_size : search.backward ? text_size - pos : pos + search.text.size();
+    std::printf("  find text:    \"%ls\"%s%s: %s, %6.2f ns/character searched\n", search.text.data(), search.backward ? " backward" : "",
+      search.ignore_case ? " ignoring case" : "", pos == std::wstring::npos ? "not found" : "found", ns_between(t8, t9) / (double(num_runs) * searched));
+  }
+}
+
+// The boundary scanner alone, on prose in English, and in French with its accents and non-breaking spaces.
+void
+ui_benchmark_text_scanner() {
+  static wchar_t const* const kEnglish[] = { L"the", L"quick", L"brown", L"fox", L"jumps", L"over", L"lazy", L"dogs", L"ui", L"automation" };
+  static wchar_t const* const kFrench[] = { L"le", L"renard", L"brun", L"saute", L"par-dessus", L"les", L"chiens", L"\u00e9veill\u00e9s", L"\u00e0", L"c\u00f4t\u00e9" };
+  for (auto words : { kEnglish, kFrench }) {
+    uint64_t seed = 42;
+    std::wstring text;
+    while (text.size() < 4 * 1024 * 1024) {
+      text += words[wy2u0k(wyrand(&seed), std::size(kEnglish))];
+      auto r = wy2u0k(wyrand(&seed), 32);
+      text += r == 0 ? L"\r\n" : r == 1 ? L"\n" : r == 2 ? L", " : r == 3 && words == kFrench ? L"\u00a0: " : L" ";
+    }
+
+    TextBoundaryBits expected_words, expected_lines;
+    text_scan_boundaries(text.data(), text.size(), expected_words, expected_lines, TextScanner::kScalar);
+    std::printf("  text scanner: %s, %zu code units, %zu words, %zu lines\n", words == kEnglish ? "english" : "french", text.size(),
+      text_bits_count(expected_words), text_bits_count(expected_lines));
+    std::pair<TextScanner, char const*> const scanners[] = {
+      { TextScanner::kScalar, "scalar" }, { TextScanner::kSse2, "sse2" }, { TextScanner::kAvx2, "avx2" } };
+    for (auto [scanner, name] : scanners) {
+      if ((scanner == TextScanner::kSse2 && !TEXT_SCANNER_SSE2) || (scanner == TextScanner::kAvx2 && !TEXT_SCANNER_AVX2)) continue;
+      TextBoundaryBits words_bits, lines_bits;
+      auto const num_runs = 10;
+      auto t0 = std::chrono::steady_clock::now();
+      for (int i = 0; i < num_runs; i++) text_scan_boundaries(text.data(), text.size(), words_bits, lines_bits, scanner);
+      auto t1 = std::chrono::steady_clock::now();
+      VERIFY(words_bits.bits == expected_words.bits && lines_bits.bits == expected_lines.bits);
+      VERIFY(words_bits.rank == expected_words.rank && lines_bits.rank == expected_lines.rank);
+      std::printf("    %-6s %6.2f ns/code unit\n", name, ns_between(t0, t1) / (double(num_runs) * text.size()));
+    }
+  }
+}
+
+// Characters of a chat log in many scripts: combining accents, emoji sequences and flags (surrogate pairs on Windows),
+// Hangul jamos, Devanagari and Thai, read forward and backward. The Book of ui_benchmark_text_units is the ascii case.
+void
+ui_benchmark_text_characters(size_t num_characters) {
+  g_ui = {};
+  struct Word { wchar_t const* text; size_t num_characters; };
+  static Word const kWords[] = {
+    { L"caf\u00e9", 4 }, { L"cafe\u0301", 4 }, { L"\u1e69\u0323\u0307", 1 },
+    { L"\U0001F468\u200d\U0001F469\u200d\U0001F467", 1 }, { L"\U0001F44D\U0001F3FD", 1 }, { L"\u2764\ufe0f", 1 },
+    { L"\U0001F1EB\U0001F1F7\U0001F1E9\U0001F1EA", 2 },
+    { L"\u1100\u1161\u11a8", 1 }, { L"\uac00\u11a8\ud55c", 2 },
+    { L"\u0915\u093f\u0924\u093e\u092c", 3 }, { L"\u0e01\u0e33\u0e25\u0e31\u0e07", 3 },
+  };
+  ui_document(L"Chat");
+  g_ui.depth_for_adding_element++;
+  uint64_t seed = 42;
+  size_t expected_num_characters = 4; // the name of the document.
+  std::wstring text;
+  for (int p = 0; ui_node_text_offset(g_ui.node_ids.size()) < num_characters; p++) {
+    text = std::to_wstring(p) + L":";
+    expected_num_characters += text.size();
+    for (int i = 0; i < 1000; i++) {
+      auto const& word = kWords[wy2u0k(wyrand(&seed), std::size(kWords))];
+      text += wy2u0k(wyrand(&seed), 16) == 0 ? L"\r\n" : L" ";
+      text += word.text;
+      expected_num_characters += 1 + word.num_characters;
+    }
+    ui_text_paragraph(text.c_str());
+  }
+  g_ui.depth_for_adding_element--;
+  auto text_size = ui_node_text_offset(g_ui.node_ids.size());
+
+  std::vector<size_t> forward, backward;
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t offset = 0; ui_text_move_offset(UiTextUnit::kCharacter, &offset, 1) == 1;) forward.push_back(offset);
+  auto t1 = std::chrono::steady_clock::now();
+  for (size_t offset = text_size; ui_text_move_offset(UiTextUnit::kCharacter, &offset, -1) == -1;) backward.push_back(offset);
+  auto t2 = std::chrono::steady_clock::now();
+  VERIFY(forward.size() == expected_num_characters && backward.size() == expected_num_characters);
+  VERIFY(std::equal(forward.begin(), forward.end() - 1, backward.rbegin() + 1)); // the same boundaries both ways.
+  size_t num_boundaries = 0; // and as many as the rules give, code point by code point.
+  for (size_t index = 0; index < g_ui.node_ids.size(); index++) {
+    auto name = ui_node_name(index);
+    for (size_t i = 0; i < name.size(); i++) num_boundaries += grapheme_is_boundary(name.data(), name.size(), i);
+  }
+  VERIFY(num_boundaries == expected_num_characters);
+
+  // A screen-reader jumping by pages of characters.
+  size_t offset = 0, num_moved = 0;
+  auto t3 = std::chrono::steady_clock::now();
+  for (int i = 0, count = 1000; i < 10000; i++) {
+    auto moved = ui_text_move_offset(UiTextUnit::kCharacter, &offset, count);
+    num_moved += std::abs(moved);
+    if (moved != count) count = -count;
+  }
+  auto t4 = std::chrono::steady_clock::now();
+  VERIFY(num_moved != 0);
+
+  std::printf("benchmark: %zu code units, %zu characters\n", text_size, expected_num_characters);
+  std::printf("  characters:   forward: %6.1f ns/character, backward: %6.1f ns/character, by 1000: %6.1f ns/character\n",
+    ns_between(t0, t1) / expected_num_characters, ns_between(t1, t2) / expected_num_characters, ns_between(t3, t4) / num_moved);
+}
+
+// Find text in the minutes of a long meeting, of hundreds of thousands of paragraphs, with and without the text index.
+void
+ui_benchmark_text_index(size_t num_paragraphs) {
+  g_ui = {};
+  uint64_t seed = 42;
+  static wchar_t const* const kSyllables[] = { L"ka", L"lo", L"mi", L"ne", L"ru", L"sa", L"to", L"vi", L"den", L"bar", L"gil", L"mor", L"pen", L"tas" };
+  std::vector<std::wstring> vocabulary(2000);
+  for (auto& word : vocabulary) {
+    for (auto n = 1 + wy2u0k(wyrand(&seed), 3); n > 0; n--) word += kSyllables[wy2u0k(wyrand(&seed), std::size(kSyllables))];
+  }
+  ui_document(L"Minutes");
+  g_ui.depth_for_adding_element++;
+  std::wstring text;
+  for (size_t p = 0; p < num_paragraphs; p++) {
+    text = std::to_wstring(p) + L":";
+    for (auto n = 6 + wy2u0k(wyrand(&seed), 5); n > 0; n--) text += L" " + vocabulary[wy2u0k(wyrand(&seed), vocabulary.size())];
+    if (p % 50000 == 25000) text += L" xylophone";
+    text += L".";
+    ui_text_paragraph(text.c_str());
+  }
+  g_ui.depth_for_adding_element--;
+  auto text_size = ui_node_text_offset(g_ui.node_ids.size());
+
+  auto t0 = std::chrono::steady_clock::now();
+  ui_text_index_build();
+  auto t1 = std::chrono::steady_clock::now();
+  g_ui.text_index_building.wait();
+  VERIFY(ui_text_index_poll());
+  auto t2 = std::chrono::steady_clock::now();
+  auto const& index = *g_ui.text_index;
+  size_t num_bytes = index.postings.bucket_count() * sizeof(void*);
+  for (auto const& [trigram, postings] : index.postings) {
+    num_bytes += sizeof(trigram) + sizeof(postings) + 2 * sizeof(void*) + postings.nodes.capacity() * sizeof(postings.nodes[0]);
+  }
+  std::printf("benchmark: %zu paragraphs, %zu characters\n", num_paragraphs, text_size);
+  std::printf("  text index:   %zu trigrams, %zu postings, copy: %6.1f ms, build: %6.1f ms, %6.1f MB per million characters\n",
+    index.postings.size(), index.num_postings, ns_between(t0, t1) / 1e6, ns_between(t1, t2) / 1e6, double(num_bytes) / 1e6 / (double(text_size) / 1e6));
+
+  // Every search, with and without the index.
+  TextRange whole = { ui_text_point(0), ui_text_point(text_size) };
+  const auto find = [&](TextRange range, std::wstring_view search_text, bool backward, bool ignore_case) {
+    TextRange found;
+    return ui_text_range_find(range, search_text, backward, ignore_case, &found) ? ui_text_offset(found.start) : size_t(-1);
+  };
+  struct Search { std::wstring_view text; bool backward; bool ignore_case; };
+  Search const searches[] = {
+    { L"xylophone", false, false },
+    { L"xylophone", true, false },
+    { L"XYLOPHONE", false, true },
+    { L"zebra crossing", false, false }, // not there.
+    { L".123456:", false, false }, // across names.
+    { vocabulary[0], true, false }, // frequent.
+  };
+  for (auto search : searches) {
+    auto const num_runs = 4;
+    size_t pos = 0;
+    auto t3 = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_runs; i++) pos = find(whole, search.text, search.backward, search.ignore_case);
+    auto t4 = std::chrono::steady_clock::now();
+    auto text_index = std::move(g_ui.text_index);
+    auto expected = find(whole, search.text, search.backward, search.ignore_case);
+    auto t5 = std::chrono::steady_clock::now();
+    g_ui.text_index = std::move(text_index);
+    VERIFY(pos == expected);
+    std::printf("  find text:    \"%ls\"%s%s: %s, index: %10.1f ns, scan: %10.1f ns\n", search.text.data(), search.backward ? " backward" : "",
+      search.ignore_case ? " ignoring case" : "", pos == size_t(-1) ? "not found" : "found", ns_between(t3, t4) / num_runs, ns_between(t4, t5));
+  }
+  for (int i = 0; i < 200; i++) {
+    auto a = wy2u0k(wyrand(&seed), text_size + 1), b = wy2u0k(wyrand(&seed), text_size + 1);
+    auto len = 3 + wy2u0k(wyrand(&seed), 12);
+    auto at = wy2u0k(wyrand(&seed), text_size - len);
+    std::wstring search_text(len, L'\0');
+    ui_text_range_copy({ ui_text_point(at), ui_text_point(at + len) }, len, search_text.data());
+    TextRange range = { ui_text_point(std::min(a, b)), ui_text_point(std::max(a, b)) };
+    bool backward = i % 2, ignore_case = i % 3 == 0;
+    auto pos = find(range, search_text, backward, ignore_case);
+    auto text_index = std::move(g_ui.text_index);
+    VERIFY(pos == find(range, search_text, backward, ignore_case));
+    g_ui.text_index = std::move(text_index);
+  }
+
+  // Live updates, some of them while the index is rebuilt.
+  auto const num_updates = size_t(10000);
+  std::vector<UiTree::Id> ids(num_updates);
+  for (auto& id : ids) id = g_ui.node_ids[1 + wy2u0k(wyrand(&seed), num_paragraphs)];
+  auto t6 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < num_updates; i++) {
+    text = L"update " + std::to_wstring(i) + L" " + vocabulary[wy2u0k(wyrand(&seed), vocabulary.size())] + L".";
+    ui_set_text(ids[i], text.c_str());
+  }
+  auto t7 = std::chrono::steady_clock::now();
+
+  // Updating a name adds at most its own trigrams and the two that read into it.
+  auto num_postings = g_ui.text_index->num_postings;
+  text = L"the same update.";
+  for (size_t i = 0; i < 1000; i++) ui_set_text(ids[0], text.c_str());
+  VERIFY(g_ui.text_index->num_postings - num_postings <= 1000 * (text.size() + 2));
+
+  ui_text_index_build();
+  ui_set_text(ids[0], L"a zebra crossing");
+  g_ui.text_index_building.wait();
+  VERIFY(ui_text_index_poll());
+  whole = { ui_text_point(0), ui_text_point(ui_node_text_offset(g_ui.node_ids.size())) };
+  VERIFY(find(whole, L"zebra crossing", false, false) == ui_node_text_offset(ui_find_index(ids[0])) + 2);
+  VERIFY(find(whole, L"update 9999 ", true, false) == ui_node_text_offset(ui_find_index(ids[9999])));
+  std::printf("  set text:     %zu updates with the index: %6.1f ns/update\n", num_updates, ns_between(t6, t7) / num_updates);
+}
+
+int
+main(int argc, char** argv) {
+  auto max_num_nodes = argc > 1 ? size_t(std::strtoull(argv[1], nullptr, 10)) : size_t(10000000);
+
+  for (size_t num_nodes = 1000; num_nodes <= max_num_nodes; num_nodes *= 10) {
+    auto t0 = std::chrono::steady_clock::now();
+    ui_benchmark_build_tree(num_nodes);
+    auto t1 = std::chrono::steady_clock::now();
+    std::printf("benchmark: %zu nodes, built in %.1f ns/node\n", g_ui.node_ids.size(), ns_between(t0, t1) / g_ui.node_ids.size());
+
+    ui_benchmark_lookup();
+    ui_benchmark_navigation();
+    ui_benchmark_text_offsets();
+    ui_benchmark_text_ranges();
+    ui_benchmark_hover();
+    ui_benchmark_set_text();
+    std::fflush(stdout);
+  }
+  ui_benchmark_text_units(4 * 1024 * 1024);
+  ui_benchmark_text_scanner();
+  ui_benchmark_text_characters(4 * 1024 * 1024);
+  ui_benchmark_text_index(200000);
+  g_ui = {};
+  return 0;
+}